@@ -17,28 +17,73 @@
 //	String mappings are denoted by calling judy_open with zero as
 //	the second argument.  Integer mappings are denoted by calling
 //	judy_open with the Integer depth of the Judy Trie as the second
-//	argument.
+//	argument.  Binary mappings of fixed length keys, which may hold
+//	zero bytes, are denoted by calling judy_open_seg with the key
+//	length and the JUDY_binary flag.
 
 //#define STANDALONE
 
 //	functions:
 //	judy_open:	open a new judy array returning a judy object.
+//	judy_open_seg: open a judy array with a given segment size, backing and node layout.
 //	judy_close:	close an open judy array, freeing all memory.
 //	judy_clone:	clone an open judy array, duplicating the stack.
 //	judy_data:	allocate data memory within judy array for external use.
 //	judy_cell:	insert a string into the judy array, return cell pointer.
 //	judy_strt:	retrieve the cell pointer greater than or equal to given key
 //	judy_slot:	retrieve the cell pointer, or return NULL for a given key.
+//	judy_slot_batch: retrieve the cell pointers for an array of keys.
+//	judy_slot32/64/128: retrieve the cell pointer for an integer key.
+//	judy_cell32/64/128: insert an integer key, return cell pointer.
 //	judy_key:	retrieve the string value for the most recent judy query.
+//	judy_scan:	pass the keys and cells in a key range to a callback.
+//	judy_scan_buff: copy the keys and values in a key range into a buffer.
+//	judy_rank:	return the number of keys below a given key.
+//	judy_select: retrieve the cell pointer for the key of a given rank.
+//	judy_count_prefix: return the number of keys starting with given bytes.
 //	judy_end:	retrieve the cell pointer for the last string in the array.
 //	judy_nxt:	retrieve the cell pointer for the next string in the array.
 //	judy_prv:	retrieve the cell pointer for the prev string in the array.
 //	judy_del:	delete the key and cell for the current stack entry.
+//	judy_del_range: delete the keys in a key range.
+//	judy_del_prefix: delete the keys starting with given bytes.
+//	judy_build_parallel: insert an array of keys using several threads.
+//	judy_load_sorted: insert an array of sorted keys bottom up.
+//	judy_concurrent: allow reader clones while the array changes.
+//	judy_enter:	begin a read section on a concurrent reader clone.
+//	judy_leave:	end a read section on a concurrent reader clone.
+//	judy_shared: add a shared allocator pool for worker threads.
+//	judy_worker: open a worker judy object allocating from the pool.
+//	judy_release: return a worker's free blocks and memory to the pool.
+//	judy_save:	write the judy array to a position independent file image.
+//	judy_map:	map a file image read-only as a judy object for queries.
+//	judy_log_open: recover an array from its snapshot and log, then log its changes.
+//	judy_log_commit: write and sync the logged changes.
+//	judy_snapshot: write a snapshot of the array and drop the log it covers.
+//	judy_stats:	report node counts, memory use and key depths.
+//	judy_compact: move live nodes into new segments and free the old ones.
 
 #include <stdlib.h>
 #include <memory.h>
 #include <string.h>
 
+#include <stdio.h>
+#include <time.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#if defined(__APPLE__) && !defined(MAP_ANONYMOUS)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+
 #ifdef linux
 	#define _FILE_OFFSET_BITS 64
 	#define _LARGEFILE_SOURCE
@@ -103,11 +148,25 @@ typedef unsigned int uint;
 
 #define JUDY_mask (~(JudySlot)0x07)
 
+//	node address from a tree pointer, which is an
+//	offset from the image start in a mapped image
+
+#define JUDY_addr(judy, next) ((judy)->base + ((next) & JUDY_mask))
+
 //	define the alignment factor for judy nodes and allocations
-//	to enable this feature, set to 64
+//	to enable this feature, set to 64, or open the array
+//	with JUDY_lines to align only the larger nodes
 
 #define JUDY_cache_line 8	// minimum size is 8 bytes
 
+//	linear node searches use SSE2/AVX2 when the cpu
+//	supports them, -D NOSIMD keeps the scalar loop only
+
+#if !defined(NOSIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define JUDY_simd
+#endif
+
 #if defined(STANDALONE) || defined(ASKITIS)
 #include <assert.h>
 #include <stdio.h>
@@ -124,6 +183,57 @@ void judy_abort (char *msg)
 
 #define JUDY_seg	65536
 
+//	judy_open_seg segment backing flags
+
+#define JUDY_mmap		1	// map segments instead of malloc
+#define JUDY_hugepage	2	// map segments on huge page boundaries, advising transparent huge pages
+#define JUDY_hugetlb	4	// map segments from the huge page pool, else as JUDY_hugepage
+#define JUDY_lines		8	// start nodes of a cache line or more on a cache line
+#define JUDY_set		16	// integer set: dense last key bytes kept in bitmap leaves
+#define JUDY_binary		32	// fixed length binary keys of max bytes
+
+#define JUDY_backing	(JUDY_mmap | JUDY_hugepage | JUDY_hugetlb)
+#define JUDY_line	64	// cache line size for JUDY_lines
+
+#define JUDY_huge	(2 * 1024 * 1024)	// huge page size
+
+#define JUDY_binmax	256		// longest JUDY_binary key
+
+#ifdef __GNUC__
+#define JUDY_prefetch(addr) __builtin_prefetch (addr)
+#define JUDY_popcnt(bits) __builtin_popcount (bits)
+#else
+#define JUDY_prefetch(addr)
+#define JUDY_popcnt(bits) judy_popcnt (bits)
+#endif
+
+//	publish tree pointers to concurrent readers
+
+#ifdef __GNUC__
+#define JUDY_load(addr) __atomic_load_n (addr, __ATOMIC_ACQUIRE)
+#define JUDY_store(addr, val) __atomic_store_n (addr, val, __ATOMIC_RELEASE)
+#define JUDY_fence() __atomic_thread_fence (__ATOMIC_SEQ_CST)
+#elif defined(_WIN32)
+#define JUDY_load(addr) (*(addr))
+#define JUDY_store(addr, val) (MemoryBarrier(), *(addr) = (val))
+#define JUDY_fence() MemoryBarrier()
+#endif
+
+#define JUDY_retire 256	// frees between epoch advance attempts
+
+//	spin lock for the shared allocator pool
+
+#ifdef __GNUC__
+#define JUDY_lock(lock) while( __atomic_test_and_set (lock, __ATOMIC_ACQUIRE) )
+#define JUDY_unlock(lock) __atomic_clear (lock, __ATOMIC_RELEASE)
+#elif defined(_WIN32)
+#define JUDY_lock(lock) while( _InterlockedExchange8 (lock, 1) )
+#define JUDY_unlock(lock) _InterlockedExchange8 (lock, 0)
+#endif
+
+#define JUDY_cache 64	// free blocks a worker keeps for each node size
+#define JUDY_refill 32	// blocks moved to or from the pool at once
+
 enum JUDY_types {
 	JUDY_radix		= 0,	// inner and outer radix fan-out
 	JUDY_1			= 1,	// linear list nodes of designated count
@@ -139,6 +249,21 @@ enum JUDY_types {
 #endif
 };
 
+//	a span node either ends the key with a zero byte,
+//	or continues it in the next node after all of its
+//	bytes.  a span left behind by judy_splitspan may
+//	hold fewer whole key words: its unused bytes are
+//	zero and its last byte is JUDY_span_short.
+
+//	integer arrays have no span nodes, and use type 7
+//	for a leaf of 256 bits, one for each value of the
+//	last key byte, in the 32 bytes of a span node
+
+#ifndef ASKITIS
+#define JUDY_bitmap	JUDY_span
+#define JUDY_span_short	1
+#endif
+
 int JudySize[] = {
 	(JUDY_slot_size * 16),						// JUDY_radix node size
 	(JUDY_slot_size + JUDY_key_size),			// JUDY_1 node size
@@ -164,6 +289,7 @@ judyvalue JudyMask[9] = {
 typedef struct {
 	void *seg;			// next used allocator
 	uint next;			// next available offset
+	uint data;			// holds judy_data memory, which can not move
 } JudySeg;
 
 typedef struct {
@@ -172,13 +298,149 @@ typedef struct {
 	int slot;			// slot within object
 } JudyStack;
 
+//	concurrent mode: one writer thread and reader clones.
+//	blocks freed by the writer wait on the limbo list of
+//	the epoch they were freed in until every reader
+//	has moved on to a later epoch.  readers may still
+//	be looking at them, so the limbo lists are kept
+//	outside of the blocks.
+
+#define JUDY_limbo 250
+
+typedef struct {
+	void *next;					// next limbo list
+	uint count;					// blocks in this list
+	JudySlot block[JUDY_limbo];	// freed blocks tagged with their type
+} JudyLimbo;
+
+typedef struct {
+	uint epoch;			// epoch entered by the reader, or zero when idle
+	uchar pad[60];		// keep readers on separate cache lines
+} JudyReader;
+
+typedef struct {
+	uint global;		// current epoch
+	uint retired;		// blocks freed since the last advance attempt
+	uint count;			// number of reader slots
+	uint used;			// reader slots assigned to clones
+	JudySlot *root;		// writer's root of the judy array
+	JudyLimbo *limbo[2];	// blocks freed in the current and previous epochs
+	JudyLimbo *spare;	// emptied limbo lists
+	JudyReader reader[1];
+} JudyEpoch;
+
+//	shared allocator for worker judy objects
+//	building subtrees in separate threads.
+//	free blocks move between the workers and
+//	the pool in batches chained through the
+//	second word of each batch's first block.
+
+typedef struct {
+	char lock;			// spin lock for the pool
+	void **reuse[8];	// batches of free blocks returned by workers
+	JudySeg *seg;		// segments of released workers
+} JudyPool;
+
+//	judy_compact state kept between calls
+
+typedef struct {
+	JudySeg **old;		// segments being emptied, by address
+	uint count;			// number of old segments
+	uint size;			// segment size
+	uint resume;		// key holds the place to resume at
+	uint len;			// resume key length
+	JudyStack *prev;	// stack of the previous key
+	uchar *key;			// key to resume at
+} JudyCompact;
+
+//	key counts below nodes and inner radix tables
+//	holding at least JUDY_countmin keys, kept from
+//	the first judy_rank, judy_select or
+//	judy_count_prefix call on, in a hash table
+//	by node address
+
+#define JUDY_countmin	32
+
+typedef struct {
+	JudySlot node;		// node or inner radix table address, or zero
+	JudySlot count;		// keys below it
+} JudyCount;
+
+typedef struct {
+	uint size;			// hash slots, a power of two
+	uint used;			// slots in use
+	JudyCount slot[1];
+} JudyCounts;
+
+//	judy_log_open: a write ahead log of the keys set
+//	by judy_cell and removed by judy_del, judy_del_range
+//	and judy_del_prefix.  records collect in a buffer
+//	written out a group at a time, and judy_log_commit
+//	syncs them.  judy_snapshot starts a new generation
+//	of the log, path.gen, for the records after it.
+
+#define JUDY_loggroup	(1024 * 1024)	// default bytes written at once
+
+enum JUDY_logop {
+	JUDY_logcell = 1,	// set key's cell to value
+	JUDY_logdel,		// delete key
+	JUDY_logrange,		// delete keys from lo thru hi
+	JUDY_logprefix,		// delete keys starting with key
+	JUDY_loglo = 16,	// range from the first key
+	JUDY_loghi = 32		// range to the last key
+};
+
+typedef struct {
+	uint sum;			// FNV-1a hash of the rest of the record
+	uint op;			// JUDY_logop
+	uint len;			// key bytes, or lo bytes of a range
+	uint hilen;			// hi bytes of a range
+	JudySlot value;		// cell value
+} JudyLogRec;			// followed by the key bytes
+
+#ifdef _WIN32
+typedef HANDLE JudyFile;
+#else
+typedef int JudyFile;
+#endif
+
+typedef struct {
+	char lock;			// spin lock for the buffer and file
+	char fail;			// a write or sync failed
+	JudyFile file;		// current generation
+	uint gen;			// current generation
+	uint oldest;		// oldest generation not yet removed
+	uint group;			// bytes to collect before writing
+	uint room;			// buffer size
+	uint used;			// buffer bytes in use
+	uint pending;		// offset of the record awaiting its cell, or used
+	JudySlot *cell;		// cell of the pending record, set by judy_cell
+	uchar *buff;		// records
+	uchar *key;			// key assembled for judy_del
+	char *path;			// snapshot path, with room for the suffix
+} JudyLog;
+
 typedef struct {
 	JudySlot root[1];	// root of judy array
 	void **reuse[8];	// reuse judy blocks
 	JudySeg *seg;		// current judy allocator
+	JudyEpoch *epoch;	// concurrent mode state, or NULL
+	JudyReader *reader;	// epoch slot for a reader clone
+	JudySlot pending;	// concurrent mode: link to a node built privately, until published
+	JudyPool *pool;		// shared allocator, or NULL
+	uint cache[8];		// blocks on each reuse list
+	uint segsize;		// memory segment size
+	uint segflags;		// memory segment backing
+	JudySlot base;		// start of a mapped image, or zero
+	JudySlot mapped;	// length of a mapped image, or zero
+	JudyCompact *compact;	// judy_compact in progress, or NULL
+	JudySlot bit;		// cell returned for a key in a bitmap leaf
+	JudyCounts *counts;	// key counts for judy_rank, or NULL
+	JudyLog *log;		// write ahead log, or NULL
 	uint level;			// current height of stack
 	uint max;			// max height of stack
 	uint depth;			// number of Integers in a key, or zero for string keys
+	uint keylen;		// bytes in a JUDY_binary key, or zero
 	JudyStack stack[1];	// current cursor
 } Judy;
 
@@ -193,24 +455,107 @@ typedef struct {
 #define JUDY_max	JUDY_32
 #endif
 
-//	open judy object
-//		call with max key size
-//		and Integer tree depth.
+//	allocate a memory segment from malloc, or map it
 
-void *judy_open (uint max, uint depth)
+void *judy_segalloc (uint size, uint flags)
+{
+#ifdef _WIN32
+void *seg;
+
+	if( !(flags & JUDY_backing) )
+		return malloc (size);
+
+	if( flags & JUDY_hugetlb )
+	  if( (seg = VirtualAlloc (NULL, size, MEM_COMMIT | MEM_RESERVE | MEM_LARGE_PAGES, PAGE_READWRITE)) )
+		return seg;
+
+	return VirtualAlloc (NULL, size, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+#else
+uchar *seg, *aligned;
+
+	if( !(flags & JUDY_backing) )
+		return malloc (size);
+
+#ifdef MAP_HUGETLB
+	if( flags & JUDY_hugetlb )
+	  if( (seg = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0)) != MAP_FAILED )
+		return seg;
+#endif
+
+	if( !(flags & (JUDY_hugepage | JUDY_hugetlb)) || size < JUDY_huge ) {
+		seg = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		return seg == MAP_FAILED ? NULL : seg;
+	}
+
+	//	trim the mapping to start on a huge page
+
+	seg = mmap (NULL, size + JUDY_huge, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if( seg == MAP_FAILED )
+		return NULL;
+
+	aligned = (uchar *)(((JudySlot)seg + JUDY_huge - 1) & ~(JudySlot)(JUDY_huge - 1));
+
+	if( aligned > seg )
+		munmap (seg, aligned - seg);
+
+	munmap (aligned + size, seg + JUDY_huge - aligned);
+#ifdef MADV_HUGEPAGE
+	madvise (aligned, size, MADV_HUGEPAGE);
+#endif
+	return aligned;
+#endif
+}
+
+void judy_segfree (void *seg, uint size, uint flags)
+{
+	if( !(flags & JUDY_backing) )
+		free (seg);
+	else
+#ifdef _WIN32
+		VirtualFree (seg, 0, MEM_RELEASE);
+#else
+		munmap (seg, size);
+#endif
+}
+
+//	judy_open_seg: open judy object whose memory
+//	segments have the given size, at least JUDY_seg,
+//	and backing flags.  JUDY_hugetlb rounds the
+//	size up to a whole number of huge pages.
+//	JUDY_lines places each node of a cache line
+//	or more on a cache line boundary.  JUDY_binary
+//	keys are max bytes, up to JUDY_binmax, kept as
+//	Integers, and depth is ignored.
+
+void *judy_open_seg (uint max, uint depth, uint size, uint flags)
 {
+uint keylen = max;
 JudySeg *seg;
 Judy *judy;
 uint amt;
 
+	if( flags & JUDY_binary )
+	  if( !keylen || keylen > JUDY_binmax )
+		return NULL;
+	  else
+		depth = (keylen + JUDY_key_size - 1) / JUDY_key_size;
+
 	if( depth )
 		max = JUDY_key_size * depth;
 	else
 		max++;		// allow for zero terminator on keys
 
-	if( (seg = malloc(JUDY_seg)) ) {
+	if( size < JUDY_seg )
+		size = JUDY_seg;
+
+	if( flags & JUDY_hugetlb )
+		size = (size + JUDY_huge - 1) & ~(JUDY_huge - 1);
+
+	if( (seg = judy_segalloc (size, flags)) ) {
 		seg->seg = NULL;
-		seg->next = JUDY_seg;
+		seg->next = size;
+		seg->data = 1;		// holds the judy object
 	} else {
 #if defined(STANDALONE) || defined(ASKITIS)
 		judy_abort ("No virtual memory");
@@ -225,7 +570,7 @@ uint amt;
 		amt |= JUDY_cache_line - 1, amt++;
 
 #if defined(STANDALONE) || defined(ASKITIS)
-	MaxMem += JUDY_seg;
+	MaxMem += size;
 #endif
 
 	seg->next -= (JudySlot)seg & (JUDY_cache_line - 1);
@@ -236,15 +581,334 @@ uint amt;
 	judy->depth = depth;
  	judy->seg = seg;
 	judy->max = max;
+	judy->segsize = size;
+	judy->segflags = flags;
+
+	if( flags & JUDY_binary )
+		judy->keylen = keylen;
+
 	return judy;
 }
 
+//	open judy object
+//		call with max key size
+//		and Integer tree depth.
+
+void *judy_open (uint max, uint depth)
+{
+	return judy_open_seg (max, depth, JUDY_seg, 0);
+}
+
+//	write ahead log files
+
+int judy_fcreate (JudyFile *file, char *path)
+{
+#ifdef _WIN32
+	*file = CreateFile (path, GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	return *file != INVALID_HANDLE_VALUE;
+#else
+	*file = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	return *file >= 0;
+#endif
+}
+
+int judy_fwrite (JudyFile file, uchar *buff, uint amt)
+{
+#ifdef _WIN32
+DWORD done;
+
+	while( amt ) {
+		if( !WriteFile (file, buff, amt, &done, NULL) )
+			return 0;
+		buff += done, amt -= done;
+	}
+#else
+int done;
+
+	while( amt ) {
+		if( (done = write (file, buff, amt)) < 0 )
+			return 0;
+		buff += done, amt -= done;
+	}
+#endif
+	return 1;
+}
+
+int judy_fsync (JudyFile file)
+{
+#ifdef _WIN32
+	return FlushFileBuffers (file);
+#elif defined(linux)
+	return !fdatasync (file);
+#else
+	return !fsync (file);
+#endif
+}
+
+void judy_fclose (JudyFile file)
+{
+#ifdef _WIN32
+	CloseHandle (file);
+#else
+	close (file);
+#endif
+}
+
+//	log records are padded to a JudySlot boundary
+
+#define JUDY_logrec(amt) (sizeof(JudyLogRec) + ((amt) + sizeof(JudySlot) - 1 & ~(sizeof(JudySlot) - 1)))
+
+#define JUDY_logseed	2166136261U
+
+uint judy_logsum (uint sum, uchar *buff, uint amt)
+{
+	while( amt-- )
+		sum = (sum ^ *buff++) * 16777619U;
+
+	return sum;
+}
+
+void judy_logseal (JudyLog *log, uint off)
+{
+JudyLogRec *rec = (JudyLogRec *)(log->buff + off);
+
+	rec->sum = judy_logsum (JUDY_logseed, (uchar *)rec + sizeof(uint), JUDY_logrec(rec->len + rec->hilen) - sizeof(uint));
+}
+
+//	seal the pending record with the value its cell
+//	now holds, or drop it if judy_cell failed.
+//	called by the writer with the lock held.
+
+void judy_logsettle (JudyLog *log)
+{
+	if( log->pending == log->used )
+		return;
+
+	if( log->cell ) {
+		((JudyLogRec *)(log->buff + log->pending))->value = *log->cell;
+		judy_logseal (log, log->pending);
+	} else
+		log->used = log->pending;
+
+	log->pending = log->used;
+}
+
+//	write the records ahead of the pending one, and
+//	sync them if asked.  roll closes the generation
+//	and starts the next one.  called with the lock held.
+
+void judy_logwrite (JudyLog *log, int sync, int roll)
+{
+uint amt = log->pending, len;
+
+	if( !judy_fwrite (log->file, log->buff, amt) )
+		log->fail = 1;
+
+	memmove (log->buff, log->buff + amt, log->used - amt);
+	log->used -= amt;
+	log->pending = 0;
+
+	if( sync || roll )
+	  if( !judy_fsync (log->file) )
+		log->fail = 1;
+
+	if( !roll )
+		return;
+
+	judy_fclose (log->file);
+	len = (uint)strlen (log->path);
+	sprintf (log->path + len, ".%u", ++log->gen);
+
+	if( !judy_fcreate (&log->file, log->path) )
+		log->fail = 1;
+
+	log->path[len] = 0;
+}
+
+//	key bytes logged for a key passed to judy_cell
+
+uint judy_loglen (Judy *judy, uint max)
+{
+	if( judy->keylen )
+		return max < judy->keylen ? max : judy->keylen;
+
+	if( judy->depth )
+		return judy->depth * JUDY_key_size;
+
+	return max;
+}
+
+//	append a record, first sealing the pending one.
+//	a JUDY_logcell record waits for judy_cell to give
+//	it the cell holding its value.
+
+void judy_logop (Judy *judy, uint op, uchar *lo, uint lolen, uchar *hi, uint hilen)
+{
+uint amt = JUDY_logrec(lolen + hilen);
+JudyLog *log = judy->log;
+JudyLogRec *rec;
+uchar *buff;
+
+	JUDY_lock (&log->lock);
+	judy_logsettle (log);
+
+	if( log->used + amt > log->group )
+		judy_logwrite (log, 0, 0);
+
+	if( log->used + amt > log->room ) {
+	  if( !(buff = realloc (log->buff, log->used + amt)) ) {
+		log->fail = 1;
+		JUDY_unlock (&log->lock);
+		return;
+	  }
+
+	  log->buff = buff;
+	  log->room = log->used + amt;
+	}
+
+	rec = (JudyLogRec *)(log->buff + log->used);
+	memset (rec, 0, amt);
+	rec->op = op;
+	rec->len = lolen;
+	rec->hilen = hilen;
+
+	if( lolen )
+		memcpy (rec + 1, lo, lolen);
+	if( hilen )
+		memcpy ((uchar *)(rec + 1) + lolen, hi, hilen);
+
+	if( op == JUDY_logcell ) {
+		log->pending = log->used;
+		log->cell = NULL;
+	} else
+		judy_logseal (log, log->used);
+
+	log->used += amt;
+
+	if( op != JUDY_logcell )
+		log->pending = log->used;
+
+	JUDY_unlock (&log->lock);
+}
+
+//	seal the pending record before its cell can move
+//	or go.  deletes are logged once they are done, so
+//	a snapshot rolling the log in the meantime leaves
+//	their records in the next generation, and replays
+//	of keys already gone do nothing.
+
+void judy_logready (Judy *judy)
+{
+	JUDY_lock (&judy->log->lock);
+	judy_logsettle (judy->log);
+	JUDY_unlock (&judy->log->lock);
+}
+
+//	judy_log_commit: write and sync the log records of
+//	every change so far.  returns zero if any write or
+//	sync of the log has failed.
+
+int judy_log_commit (Judy *judy)
+{
+JudyLog *log = judy->log;
+int ok;
+
+	if( !log )
+		return 0;
+
+	JUDY_lock (&log->lock);
+	judy_logsettle (log);
+	judy_logwrite (log, 1, 0);
+	ok = !log->fail;
+	JUDY_unlock (&log->lock);
+	return ok;
+}
+
 void judy_close (Judy *judy)
 {
 JudySeg *seg, *nxt = judy->seg;
+uint size = judy->segsize;
+uint flags = judy->segflags;
+
+	if( judy->counts )
+		free (judy->counts);
+
+	if( judy->log ) {
+		judy_log_commit (judy);
+		judy_fclose (judy->log->file);
+		free (judy->log->buff);
+		free (judy->log->key);
+		free (judy->log->path);
+		free (judy->log);
+	}
+
+	if( judy->mapped ) {
+#ifdef _WIN32
+		UnmapViewOfFile ((void *)judy->base);
+#else
+		munmap ((void *)judy->base, judy->mapped);
+#endif
+		free (judy);
+		return;
+	}
+
+	if( judy->pool )
+	  for( nxt = judy->pool->seg, judy->pool = NULL; (seg = nxt); )
+		nxt = seg->seg, judy_segfree (seg, size, flags);
+
+	if( judy->compact ) {
+		while( judy->compact->count )
+			judy_segfree (judy->compact->old[--judy->compact->count], size, flags);
+		free (judy->compact);
+	}
+
+	for( nxt = judy->seg; (seg = nxt); )
+		nxt = seg->seg, judy_segfree (seg, size, flags);
+}
+
+//	take a batch of free blocks from the pool
+
+void **judy_refill (Judy *judy, uint type)
+{
+JudyPool *pool = judy->pool;
+void **block;
+
+	JUDY_lock (&pool->lock);
+
+	if( (block = pool->reuse[type]) )
+		pool->reuse[type] = block[1];
+
+	JUDY_unlock (&pool->lock);
+
+	if( !(judy->reuse[type] = block) )
+		return NULL;
+
+	for( judy->cache[type] = 0; block; block = *block )
+		judy->cache[type]++;
+
+	return judy->reuse[type];
+}
+
+//	give a batch of free blocks back to the pool
+
+void judy_return (Judy *judy, uint type, uint cnt)
+{
+JudyPool *pool = judy->pool;
+void **batch, **block;
+
+	if( !(block = batch = judy->reuse[type]) )
+		return;
+
+	for( judy->cache[type]--; --cnt && *block; judy->cache[type]-- )
+		block = *block;
 
-	while( (seg = nxt) )
-		nxt = seg->seg, free (seg);
+	judy->reuse[type] = *block;
+	*block = NULL;
+
+	JUDY_lock (&pool->lock);
+	batch[1] = pool->reuse[type];
+	pool->reuse[type] = batch;
+	JUDY_unlock (&pool->lock);
 }
 
 //	allocate judy node
@@ -277,8 +941,10 @@ void **rtn;
 		amt |= 0x07, amt += 1;
 
 	//	see if free block is already available
+	//	or can be had from the shared pool
 
-	if( (block = judy->reuse[type]) ) {
+	if( (block = judy->reuse[type]) || judy->pool && (block = judy_refill (judy, type)) ) {
+		judy->cache[type]--;
 		judy->reuse[type] = *block;
 		memset (block, 0, amt);
 		return (void *)block;
@@ -291,9 +957,11 @@ void **rtn;
 	  for( idx = type; idx++ < JUDY_max; )
 		if( block = judy->reuse[idx] ) {
 		  judy->reuse[idx] = *block;
+		  judy->cache[idx]--;
 		  while( idx-- > type) {
 			judy->reuse[idx] = block + JudySize[idx] / sizeof(void *);
 			block[JudySize[idx] / sizeof(void *)] = 0;
+			judy->cache[idx]++;
 		  }
 		  memset (block, 0, amt);
 		  return (void *)block;
@@ -301,10 +969,14 @@ void **rtn;
 
 	min = amt < JUDY_cache_line ? JUDY_cache_line : amt;
 
+	if( judy->segflags & JUDY_lines && amt >= JUDY_line )
+		min += JUDY_line - 8;
+
 	if( judy->seg->next < min + sizeof(*seg) ) {
-		if( (seg = malloc (JUDY_seg)) ) {
-			seg->next = JUDY_seg;
+		if( (seg = judy_segalloc (judy->segsize, judy->segflags)) ) {
+			seg->next = judy->segsize;
 			seg->seg = judy->seg;
+			seg->data = 0;
 			judy->seg = seg;
 			seg->next -= (JudySlot)seg & (JUDY_cache_line - 1);
 		} else {
@@ -316,10 +988,30 @@ void **rtn;
 		}
 
 #if defined(STANDALONE) || defined(ASKITIS)
-		MaxMem += JUDY_seg;
+		MaxMem += judy->segsize;
 #endif
 	}
 
+	//	with JUDY_lines, hand the bytes between the
+	//	node and the cache line below it to the
+	//	small node reuse lists
+
+	if( judy->segflags & JUDY_lines && amt >= JUDY_line )
+	  while( (min = (uint)((JudySlot)((uchar *)judy->seg + judy->seg->next - amt) & (JUDY_line - 1))) ) {
+		for( idx = JUDY_1; JudySize[idx + 1] <= min; idx++ );
+
+		if( JudySize[idx] > min ) {
+			judy->seg->next -= min;		// too small for any node
+			break;
+		}
+
+		judy->seg->next -= JudySize[idx];
+		block = (void **)((uchar *)judy->seg + judy->seg->next);
+		*block = judy->reuse[idx];
+		judy->reuse[idx] = block;
+		judy->cache[idx]++;
+	  }
+
 	//	generate additional free blocks
 	//	to fill up to cache line size
 
@@ -327,6 +1019,7 @@ void **rtn;
 
 	for( idx = type; amt & (JUDY_cache_line - 1); amt <<= 1 ) {
 		block = (void **)((uchar *)judy->seg + judy->seg->next - 2 * amt);
+		judy->cache[idx]++;
 		judy->reuse[idx++] = block;
 		*block = 0;
 	}
@@ -352,10 +1045,18 @@ void *block;
 	if( amt & (JUDY_cache_line - 1))
 		amt |= (JUDY_cache_line - 1), amt += 1;
 
+	if( amt > judy->segsize - sizeof(*seg) - JUDY_cache_line )
+#if defined(STANDALONE) || defined(ASKITIS)
+			judy_abort("judy_data request exceeds segment size");
+#else
+			return NULL;
+#endif
+
 	if( judy->seg->next < amt + sizeof(*seg) ) {
-		if( (seg = malloc (JUDY_seg)) ) {
-			seg->next = JUDY_seg;
+		if( (seg = judy_segalloc (judy->segsize, judy->segflags)) ) {
+			seg->next = judy->segsize;
 			seg->seg = judy->seg;
+			seg->data = 0;
 			judy->seg = seg;
 			seg->next -= (JudySlot)seg & (JUDY_cache_line - 1);
 		} else {
@@ -367,11 +1068,12 @@ void *block;
 		}
 	
 #if defined(STANDALONE) || defined(ASKITIS)
-		MaxMem += JUDY_seg;
+		MaxMem += judy->segsize;
 #endif
 	}
 
 	judy->seg->next -= amt;
+	judy->seg->data = 1;
 
 	block = (void *)((uchar *)judy->seg + judy->seg->next);
 	memset (block, 0, amt);
@@ -387,46 +1089,544 @@ uint amt;
 	clone = judy_data (judy, amt);
 	memcpy (clone, judy, amt);
 	clone->seg = NULL;	// stop allocations from cloned array
+	clone->counts = NULL;	// kept by the array, not its clones
+	clone->log = NULL;
+
+	//	assign a reader epoch slot in concurrent mode
+
+	if( clone->epoch )
+	  if( clone->epoch->used < clone->epoch->count )
+		clone->reader = clone->epoch->reader + clone->epoch->used++;
+	  else
+		return NULL;
+
 	return clone;
 }
 
-void judy_free (Judy *judy, void *block, int type)
-{
-	if( type == JUDY_radix )
-		type = JUDY_radix_equiv;
+//	move blocks freed two epochs ago to the reuse lists
+//	and advance the epoch, if every reader has
+//	entered the current epoch or is idle.  a change
+//	frees blocks before it stores the links that
+//	replace them, so this is only called between
+//	changes, at the start of judy_cell, judy_del,
+//	judy_del_range and judy_del_prefix.
+
+void judy_reclaim (Judy *judy)
+{
+JudyEpoch *epoch = judy->epoch;
+uint now = epoch->global;
+uint idx, type, seen;
+JudyLimbo *limbo;
+void **block;
+
+	epoch->retired = 0;
+	JUDY_fence ();
+
+	for( idx = 0; idx < epoch->used; idx++ )
+	  if( (seen = JUDY_load (&epoch->reader[idx].epoch)) )
+		if( seen != now )
+			return;
+
+	while( (limbo = epoch->limbo[~now & 1]) ) {
+		epoch->limbo[~now & 1] = limbo->next;
+
+		for( idx = 0; idx < limbo->count; idx++ ) {
+			block = (void **)(limbo->block[idx] & JUDY_mask);
+			type = limbo->block[idx] & 0x07;
+			*block = judy->reuse[type];
+			judy->reuse[type] = block;
+			judy->cache[type]++;
+		}
+
+		limbo->next = epoch->spare;
+		epoch->spare = limbo;
+	}
+
+	JUDY_store (&epoch->global, now + 1);
+}
+
+//	is the block in a segment judy_compact is emptying?
+
+int judy_old (JudyCompact *compact, void *block)
+{
+uint low = 0, high = compact->count, mid;
+
+	while( low < high ) {
+		mid = (low + high) / 2;
+
+		if( (uchar *)block < (uchar *)compact->old[mid] )
+			high = mid;
+		else if( (uchar *)block >= (uchar *)compact->old[mid] + compact->size )
+			low = mid + 1;
+		else
+			return 1;
+	}
+
+	return 0;
+}
+
+//	find the key count kept for a node, or the
+//	empty hash slot for it
+
+JudyCount *judy_counted (JudyCounts *counts, JudySlot node)
+{
+uint idx = (uint)(node >> 4) * 2654435761U & (counts->size - 1);
+
+	while( counts->slot[idx].node && counts->slot[idx].node != node )
+		idx = (idx + 1) & (counts->size - 1);
+
+	return counts->slot + idx;
+}
+
+//	keep the key count for a node, doubling
+//	the hash table when it is half full
+
+void judy_setcount (Judy *judy, JudySlot node, JudySlot count)
+{
+JudyCounts *counts = judy->counts, *grown;
+JudyCount *entry;
+uint idx;
+
+	if( 2 * (counts->used + 1) > counts->size ) {
+		if( !(grown = calloc (1, sizeof(JudyCounts) + (2 * counts->size - 1) * sizeof(JudyCount))) )
+			return;
+
+		grown->size = 2 * counts->size;
+		grown->used = counts->used;
+
+		for( idx = 0; idx < counts->size; idx++ )
+		  if( counts->slot[idx].node )
+			*judy_counted (grown, counts->slot[idx].node) = counts->slot[idx];
+
+		free (counts);
+		judy->counts = counts = grown;
+	}
+
+	if( !(entry = judy_counted (counts, node))->node )
+		counts->used++;
+
+	entry->node = node;
+	entry->count = count;
+}
+
+//	drop the key count of a freed block, moving
+//	later entries of its probe run back
+
+void judy_uncount (JudyCounts *counts, JudySlot node)
+{
+JudyCount *entry = judy_counted (counts, node);
+uint idx = entry - counts->slot, nxt = idx, home;
+
+	if( !entry->node )
+		return;
+
+	while( counts->slot[nxt = (nxt + 1) & (counts->size - 1)].node ) {
+		home = (uint)(counts->slot[nxt].node >> 4) * 2654435761U & (counts->size - 1);
+
+		//	leave entries whose home slot lies
+		//	cyclically between the hole and themselves
+
+		if( idx < nxt ? idx < home && home <= nxt : idx < home || home <= nxt )
+			continue;
+
+		counts->slot[idx] = counts->slot[nxt];
+		idx = nxt;
+	}
+
+	counts->slot[idx].node = 0;
+	counts->used--;
+}
+
+//	add delta to the kept key counts of the nodes
+//	and inner radix tables on the stack
+
+void judy_recount (Judy *judy, int delta)
+{
+JudySlot next, *table;
+JudyCount *entry;
+uint idx;
+
+	for( idx = 1; idx <= judy->level; idx++ ) {
+		next = judy->stack[idx].next;
+
+		if( (entry = judy_counted (judy->counts, JUDY_addr(judy, next)))->node )
+			entry->count += delta;
+
+		if( (next & 0x07) != JUDY_radix )
+			continue;
+
+		table = (JudySlot *)JUDY_addr(judy, next);
+
+		if( (next = table[judy->stack[idx].slot >> 4]) )
+		  if( (entry = judy_counted (judy->counts, JUDY_addr(judy, next)))->node )
+			entry->count += delta;
+	}
+}
+
+//	carry the kept key count of a block over
+//	to its copy
+
+void judy_movecount (Judy *judy, void *block, void *copy)
+{
+JudyCount *entry;
+
+	if( judy->counts )
+	  if( (entry = judy_counted (judy->counts, (JudySlot)block))->node ) {
+		judy_setcount (judy, (JudySlot)copy, entry->count);
+		judy_uncount (judy->counts, (JudySlot)block);
+	  }
+}
+
+void judy_free (Judy *judy, void *block, int type)
+{
+JudyEpoch *epoch = judy->epoch;
+JudyLimbo *limbo;
+
+	if( judy->counts )
+		judy_uncount (judy->counts, (JudySlot)block);
+
+	if( type == JUDY_radix )
+		type = JUDY_radix_equiv;
 
 #ifndef ASKITIS
 	if( type == JUDY_span )
 		type = JUDY_span_equiv;
 #endif
 
+	//	drop blocks in segments judy_compact is emptying
+
+	if( judy->compact && judy_old (judy->compact, block) )
+		return;
+
+	//	readers may still be looking at the block
+
+	if( epoch ) {
+	  limbo = epoch->limbo[epoch->global & 1];
+
+	  if( !limbo || limbo->count == JUDY_limbo ) {
+		if( (limbo = epoch->spare) )
+			epoch->spare = limbo->next;
+		else if( !(limbo = judy_data (judy, sizeof(JudyLimbo))) )
+			return;
+
+		limbo->next = epoch->limbo[epoch->global & 1];
+		limbo->count = 0;
+		epoch->limbo[epoch->global & 1] = limbo;
+	  }
+
+	  limbo->block[limbo->count++] = (JudySlot)block | type;
+	  epoch->retired++;
+	  return;
+	}
+
 	*((void **)(block)) = judy->reuse[type];
 	judy->reuse[type] = (void **)block;
-	return;
+
+	//	return surplus blocks to the shared pool
+
+	if( ++judy->cache[type] > JUDY_cache && judy->pool )
+		judy_return (judy, type, JUDY_refill);
+}
+
+//	judy_concurrent: let reader clones search the array
+//	while this judy object continues to change it.
+//	call before making the clones, with the number
+//	of clones to be made.
+
+uint judy_concurrent (Judy *judy, uint readers)
+{
+JudyEpoch *epoch;
+
+	if( !readers || judy->epoch )
+		return 0;
+
+	if( !(epoch = judy_data (judy, sizeof(JudyEpoch) + (readers - 1) * sizeof(JudyReader))) )
+		return 0;
+
+	epoch->global = 1;
+	epoch->count = readers;
+	epoch->root = judy->root;
+	judy->epoch = epoch;
+	return readers;
+}
+
+//	judy_enter: begin reading with a clone in concurrent mode.
+//	blocks seen after entering are not reused
+//	until judy_leave is called.  the stack is
+//	reset, so iterators restart with judy_strt.
+
+void judy_enter (Judy *judy)
+{
+JudyEpoch *epoch = judy->epoch;
+
+	JUDY_store (&judy->reader->epoch, JUDY_load (&epoch->global));
+	JUDY_fence ();
+
+	*judy->root = JUDY_load (epoch->root);
+	judy->level = 0;
+}
+
+//	judy_leave: finish reading with a clone
+
+void judy_leave (Judy *judy)
+{
+	JUDY_store (&judy->reader->epoch, 0);
+}
+
+//	judy_shared: give the array a shared allocator pool
+//	for worker judy objects in other threads
+
+uint judy_shared (Judy *judy)
+{
+	if( !judy->pool )
+		judy->pool = judy_data (judy, sizeof(JudyPool));
+
+	return judy->pool != NULL;
+}
+
+//	judy_worker: open a judy object for use by another
+//	thread, with the same key type as the array.
+//	it keeps its own free blocks and segments, and
+//	trades surplus free blocks with the shared pool.
+
+void *judy_worker (Judy *judy)
+{
+Judy *worker;
+
+	if( !judy->pool )
+		return NULL;
+
+	if( (worker = judy_open_seg (judy->keylen ? judy->keylen : judy->depth ? 0 : judy->max - 1, judy->depth, judy->segsize, judy->segflags)) )
+		worker->pool = judy->pool;
+
+	return worker;
+}
+
+//	judy_release: return a worker's free blocks and segments
+//	to the pool.  nodes built by the worker remain
+//	until judy_close of the array, and the worker
+//	object is not used again.
+
+void judy_release (Judy *worker)
+{
+JudyPool *pool = worker->pool;
+JudySeg *seg, *first = worker->seg;
+uint type;
+
+	for( type = 0; type < 8; type++ )
+		judy_return (worker, type, ~0);
+
+	for( seg = first; seg->seg; seg = seg->seg );
+
+	worker->seg = NULL;
+
+	JUDY_lock (&pool->lock);
+	seg->seg = pool->seg;
+	pool->seg = first;
+	JUDY_unlock (&pool->lock);
 }
 		
-//	assemble key from current path
+//	assemble key from current path, starting at the
+//	given stack level.  the key bytes before that
+//	level are already in the buffer.
+
+//	sparse inner radix tables: an inner table with
+//	few slots in use is kept in a JUDY_1, JUDY_2 or
+//	JUDY_4 block, tagged with that type in its outer
+//	table, holding a bitmap of the slots in use and
+//	then their tree pointers in slot order.  a table
+//	with more slots than JUDY_sparse holds is kept
+//	whole and tagged JUDY_radix.  deletes only clear
+//	the tree pointer, leaving its place for reuse.
+
+#define JUDY_sparse	JUDY_4
+
+uint judy_popcnt (uint bits)
+{
+uint cnt = 0;
 
-uint judy_key (Judy *judy, uchar *buff, uint max)
+	while( bits )
+		bits &= bits - 1, cnt++;
+
+	return cnt;
+}
+
+//	return the address of the slot in an inner table,
+//	or NULL when a sparse table has no place for it
+
+JudySlot *judy_inner (Judy *judy, JudySlot inner, int slot)
+{
+JudySlot *table = (JudySlot *)JUDY_addr(judy, inner);
+uint bit = 1 << (slot & 0x0F);
+
+	if( (inner & 0x07) == JUDY_radix )
+		return &table[slot & 0x0F];
+
+	if( table[0] & bit )
+		return &table[1 + JUDY_popcnt ((uint)table[0] & (bit - 1))];
+
+	return NULL;
+}
+
+//	return the address of the slot in the inner table
+//	under an outer table entry, making the inner table,
+//	or giving the slot a place by moving the table to
+//	a larger block.  in concurrent mode a sparse table
+//	is changed in a copy linked in when finished.
+
+JudySlot *judy_room (Judy *judy, JudySlot *outer, int slot)
+{
+uint bit = 1 << (slot & 0x0F), type, bits, cnt, rank, idx;
+JudySlot *table, *block, *cell;
+
+	if( *outer && (cell = judy_inner (judy, *outer, slot)) )
+		return cell;
+
+	type = *outer & 0x07;
+	table = (JudySlot *)(*outer & JUDY_mask);
+	bits = table ? (uint)table[0] : 0;
+	rank = JUDY_popcnt (bits & (bit - 1));
+	cnt = JUDY_popcnt (bits);
+
+	//	open a place in a sparse table with room
+
+	if( table && !judy->epoch && cnt + 1 < JudySize[type] / sizeof(JudySlot) ) {
+		memmove (table + rank + 2, table + rank + 1, (cnt - rank) * sizeof(JudySlot));
+		table[rank + 1] = 0;
+		table[0] = bits | bit;
+		return &table[rank + 1];
+	}
+
+	for( idx = JUDY_1; idx <= JUDY_sparse; idx++ )
+	  if( cnt + 1 < JudySize[idx] / sizeof(JudySlot) )
+		break;
+
+	//	spread a full sparse table into a whole one
+
+	if( idx > JUDY_sparse ) {
+		block = judy_alloc (judy, JUDY_radix);
+
+		for( cnt = idx = 0; idx < 16; idx++ )
+		  if( bits & 1 << idx )
+			block[idx] = table[++cnt];
+
+		JUDY_store (outer, (JudySlot)block | JUDY_radix);
+		judy_free (judy, table, type);
+		return &block[slot & 0x0F];
+	}
+
+	block = judy_alloc (judy, idx);
+	block[0] = bits | bit;
+
+	if( table ) {
+		memcpy (block + 1, table + 1, rank * sizeof(JudySlot));
+		memcpy (block + rank + 2, table + rank + 1, (cnt - rank) * sizeof(JudySlot));
+	}
+
+	JUDY_store (outer, (JudySlot)block | idx);
+
+	if( table )
+		judy_free (judy, table, type);
+
+	return &block[rank + 1];
+}
+
+//	bitmap leaf: return the next key byte present
+//	after slot, or before it when dir is negative,
+//	or -1 when there is none
+
+int judy_bit (uchar *base, int slot, int dir)
+{
+	while( (slot += dir) >= 0 && slot < 256 )
+	  if( base[slot >> 3] & 1 << (slot & 7) )
+		return slot;
+
+	return -1;
+}
+
+//	return the number of key bytes a span node
+//	passes on to its next node
+
+#ifndef ASKITIS
+uint judy_spanlen (uchar *base)
+{
+uint len;
+
+	if( !base[JUDY_span_bytes - 1] )	// leaf node
+		return JUDY_span_bytes;
+
+	for( len = 0; len < JUDY_span_bytes - 1; len++ )
+	  if( !base[len] )
+		return len;
+
+	return JUDY_span_bytes;
+}
+#endif
+
+//	return the bitmap leaf cell, which reads as one
+
+JudySlot *judy_bitcell (Judy *judy)
+{
+	judy->bit = 1;
+	return &judy->bit;
+}
+
+//	JUDY_binary: pack max key bytes into Integers,
+//	most significant byte first, padding the key
+//	out to its length with zero bytes
+
+judyvalue *judy_pack (Judy *judy, judyvalue *dest, uchar *buff, uint max)
+{
+uint len = judy->keylen ? judy->keylen : judy->depth * JUDY_key_size;
+uint idx;
+
+	if( max > len )
+		max = len;
+
+	memset (dest, 0, judy->depth * sizeof(judyvalue));
+
+	for( idx = 0; idx < max; idx++ )
+		dest[idx / JUDY_key_size] |= (judyvalue)buff[idx] << (JUDY_key_size - 1 - (idx & JUDY_key_mask)) * 8;
+
+	return dest;
+}
+
+uint judy_suffix (Judy *judy, uchar *buff, uint max, uint idx)
 {
 judyvalue *dest = (judyvalue *)buff;
-uint len = 0, idx = 0, depth;
+uint len = idx <= judy->level ? judy->stack[idx].off : 0;
+uint bin = judy->keylen;
+uint depth;
 int slot, off, type;
 judyvalue value;
 uchar *base;
 int keysize;
 
-	if( judy->depth )
+	if( bin ) {				// key bytes, no terminator
+		if( max > judy->keylen )
+			max = judy->keylen;
+	} else if( judy->depth )
 		max = judy->depth * JUDY_key_size;
 	else
 		max--;		// leave room for zero terminator
 
+	if( len > max )
+		len = max;
+
+	//	clear the rest of a partly assembled Integer
+
+	if( judy->depth && !bin )
+	  if( len & JUDY_key_mask )
+		dest[len / JUDY_key_size] &= ~JudyMask[JUDY_key_size - (len & JUDY_key_mask)];
+
+	idx--;
+
 	while( len < max && ++idx <= judy->level ) {
 		type = judy->stack[idx].next & 0x07;
 		slot = judy->stack[idx].slot;
 		depth = len / JUDY_key_size;
 
-		if( judy->depth )
+		if( judy->depth && !bin )
 		  if( !(len & JUDY_key_mask) )
 			dest[depth] = 0;
 
@@ -441,7 +1641,17 @@ int keysize;
 		case JUDY_64:
 #endif
 			keysize = JUDY_key_size - (judy->stack[idx].off & JUDY_key_mask);
-			base = (uchar *)(judy->stack[idx].next & JUDY_mask);
+			base = (uchar *)JUDY_addr(judy, judy->stack[idx].next);
+
+			if( bin ) {
+				value = *(judyvalue *)(base + slot * keysize);
+				value &= JudyMask[keysize];
+
+				for( off = keysize; off--; len++ )
+				  if( len < max )
+					buff[len] = (uchar)(value >> off * 8);
+				continue;
+			}
 
 			if( judy->depth ) {
 				value = *(judyvalue *)(base + slot * keysize);
@@ -473,6 +1683,11 @@ int keysize;
 			continue;
 
 		case JUDY_radix:
+			if( bin ) {
+				buff[len++] = (uchar)slot;
+				continue;
+			}
+
 			if( judy->depth ) {
 				dest[depth] |= (judyvalue)slot << (JUDY_key_size - (++len & JUDY_key_mask)) * 8;
 		  		if( !(len & JUDY_key_mask) )
@@ -490,7 +1705,17 @@ int keysize;
 
 #ifndef ASKITIS
 		case JUDY_span:
-			base = (uchar *)(judy->stack[idx].next & JUDY_mask);
+			if( bin ) {				// bitmap leaf
+				buff[len++] = (uchar)slot;
+				return len;
+			}
+
+			if( judy->depth ) {		// bitmap leaf
+				dest[depth] |= slot;
+				return ++len;
+			}
+
+			base = (uchar *)JUDY_addr(judy, judy->stack[idx].next);
 
 			for( slot = 0; slot < JUDY_span_bytes && base[slot]; slot++ )
 			  if( len < max )
@@ -499,54 +1724,220 @@ int keysize;
 #endif
 		}
 	}
+	if( bin )
+		return len < max ? len : max;
+
 	buff[len] = 0;
 	return len;
 }
 
-//	find slot & setup cursor
+uint judy_key (Judy *judy, uchar *buff, uint max)
+{
+	return judy_suffix (judy, buff, max, 1);
+}
 
-JudySlot *judy_slot (Judy *judy, uchar *buff, uint max)
+//	linear node search:
+//	return highest slot with key <= value, or -1.
+//	Keys are stored in ascending order with empty
+//	zero slots at the bottom, so the answer is also
+//	the count of keys <= value, less one.
+
+int judy_linear (uchar *base, int cnt, int keysize, judyvalue value)
 {
-judyvalue *src = (judyvalue *)buff;
-int slot, size, keysize, tst, cnt;
-JudySlot next = *judy->root;
-judyvalue value, test = 0;
-JudySlot *table;
-JudySlot *node;
-uint depth = 0;
-uint off = 0;
-uchar *base;
+judyvalue test;
 
-#ifndef ASKITIS
-	judy->level = 0;
+	while( cnt-- ) {
+		test = *(judyvalue *)(base + cnt * keysize);
+#if BYTE_ORDER == BIG_ENDIAN
+		test >>= 8 * (JUDY_key_size - keysize);
+#else
+		test &= JudyMask[keysize];
 #endif
+		if( test <= value )
+			break;
+	}
 
-	while( next ) {
-#ifndef ASKITIS
-		if( judy->level < judy->max )
-			judy->level++;
+	return cnt;
+}
 
-		judy->stack[judy->level].next = next;
-		judy->stack[judy->level].off = off;
-#endif
-		size = JudySize[next & 0x07];
+//	return the key value stored in a linear node slot
 
-		switch( next & 0x07 ) {
+judyvalue judy_test (uchar *base, int slot, int keysize)
+{
+judyvalue test = *(judyvalue *)(base + slot * keysize);
 
-		case JUDY_1:
-		case JUDY_2:
-		case JUDY_4:
-		case JUDY_8:
-		case JUDY_16:
-		case JUDY_32:
-#ifdef ASKITIS
-		case JUDY_64:
+#if BYTE_ORDER == BIG_ENDIAN
+	return test >> 8 * (JUDY_key_size - keysize);
+#else
+	return test & JudyMask[keysize];
 #endif
-			base = (uchar *)(next & JUDY_mask);
-			node = (JudySlot *)((next & JUDY_mask) + size);
+}
+
+#ifdef JUDY_simd
+
+//	SSE2 search for 1, 2 and 4 byte keys.
+//	compare 16 bytes at a time down from the top,
+//	the bottom load overlaps the one above it.
+//	the first load with any key <= value gives
+//	the count of keys below the slot.
+
+__attribute__((target("sse2")))
+int judy_sse2 (uchar *base, int cnt, int keysize, judyvalue value)
+{
+__m128i zero = _mm_setzero_si128();
+__m128i sign, val, key;
+int off = cnt * keysize;
+uint mask;
+
+	if( off < 16 )
+		return judy_linear (base, cnt, keysize, value);
+
+	switch( keysize ) {
+	case 1:	val = _mm_set1_epi8 ((char)value);	break;
+	case 2:	val = _mm_set1_epi16 ((short)value);	break;
+	case 4:	sign = _mm_set1_epi32 (0x80000000);
+			val = _mm_xor_si128 (_mm_set1_epi32 ((int)value), sign);
+			break;
+	default:
+		return judy_linear (base, cnt, keysize, value);
+	}
+
+	do {
+		if( (off -= 16) < 0 )
+			off = 0;
+
+		key = _mm_loadu_si128 ((__m128i *)(base + off));
+
+		switch( keysize ) {
+		case 1:	key = _mm_cmpeq_epi8 (_mm_subs_epu8 (key, val), zero);	break;
+		case 2:	key = _mm_cmpeq_epi16 (_mm_subs_epu16 (key, val), zero);	break;
+		case 4:	key = _mm_cmpeq_epi32 (_mm_cmpgt_epi32 (_mm_xor_si128 (key, sign), val), zero);	break;
+		}
+
+		if( (mask = _mm_movemask_epi8 (key)) )
+			return (off + __builtin_popcount (mask)) / keysize - 1;
+	} while( off );
+
+	return -1;
+}
+
+//	AVX2 search for 1, 2, 4 and 8 byte keys
+
+__attribute__((target("avx2")))
+int judy_avx2 (uchar *base, int cnt, int keysize, judyvalue value)
+{
+__m256i sign, val, key;
+int off = cnt * keysize;
+uint mask;
+
+	if( off < 16 )
+		return judy_linear (base, cnt, keysize, value);
+
+	if( off < 32 )
+		return judy_sse2 (base, cnt, keysize, value);
+
+	switch( keysize ) {
+	case 1:	val = _mm256_set1_epi8 ((char)value);	break;
+	case 2:	val = _mm256_set1_epi16 ((short)value);	break;
+	case 4:	val = _mm256_set1_epi32 ((int)value);	break;
+	case 8:	sign = _mm256_set1_epi64x (0x8000000000000000LL);
+			val = _mm256_xor_si256 (_mm256_set1_epi64x ((long long)value), sign);
+			break;
+	default:
+		return judy_linear (base, cnt, keysize, value);
+	}
+
+	do {
+		if( (off -= 32) < 0 )
+			off = 0;
+
+		key = _mm256_loadu_si256 ((__m256i *)(base + off));
+
+		switch( keysize ) {
+		case 1:	key = _mm256_cmpeq_epi8 (_mm256_max_epu8 (key, val), val);	break;
+		case 2:	key = _mm256_cmpeq_epi16 (_mm256_max_epu16 (key, val), val);	break;
+		case 4:	key = _mm256_cmpeq_epi32 (_mm256_max_epu32 (key, val), val);	break;
+		case 8:	key = _mm256_cmpgt_epi64 (_mm256_xor_si256 (key, sign), val);
+				key = _mm256_cmpeq_epi64 (key, _mm256_setzero_si256());
+				break;
+		}
+
+		if( (mask = _mm256_movemask_epi8 (key)) )
+			return (off + __builtin_popcount (mask)) / keysize - 1;
+	} while( off );
+
+	return -1;
+}
+
+int judy_pick (uchar *base, int cnt, int keysize, judyvalue value);
+int (*JudySearch)(uchar *base, int cnt, int keysize, judyvalue value) = judy_pick;
+
+//	select search routine on first use
+
+int judy_pick (uchar *base, int cnt, int keysize, judyvalue value)
+{
+	__builtin_cpu_init ();
+
+	if( __builtin_cpu_supports ("avx2") )
+		JudySearch = judy_avx2;
+	else if( __builtin_cpu_supports ("sse2") )
+		JudySearch = judy_sse2;
+	else
+		JudySearch = judy_linear;
+
+	return JudySearch (base, cnt, keysize, value);
+}
+#else
+int (*JudySearch)(uchar *base, int cnt, int keysize, judyvalue value) = judy_linear;
+#endif
+
+//	find slot & setup cursor
+
+JudySlot *judy_slot (Judy *judy, uchar *buff, uint max)
+{
+judyvalue bin[JUDY_binmax / JUDY_key_size];
+judyvalue *src = (judyvalue *)buff;
+int slot, size, keysize, tst, cnt;
+JudySlot next = *judy->root;
+judyvalue value, test;
+JudySlot *table;
+JudySlot *node;
+uint depth = 0;
+uint off = 0;
+uchar *base;
+
+	if( judy->keylen )
+		src = judy_pack (judy, bin, buff, max);
+
+#ifndef ASKITIS
+	judy->level = 0;
+#endif
+
+	while( next ) {
+#ifndef ASKITIS
+		if( judy->level < judy->max )
+			judy->level++;
+
+		judy->stack[judy->level].next = next;
+		judy->stack[judy->level].off = off;
+#endif
+		size = JudySize[next & 0x07];
+
+		switch( next & 0x07 ) {
+
+		case JUDY_1:
+		case JUDY_2:
+		case JUDY_4:
+		case JUDY_8:
+		case JUDY_16:
+		case JUDY_32:
+#ifdef ASKITIS
+		case JUDY_64:
+#endif
+			base = (uchar *)JUDY_addr(judy, next);
+			node = (JudySlot *)(JUDY_addr(judy, next) + size);
 			keysize = JUDY_key_size - (off & JUDY_key_mask);
 			cnt = size / (sizeof(JudySlot) + keysize);
-			slot = cnt;
 			value = 0;
 
 			if( judy->depth ) {
@@ -563,16 +1954,10 @@ uchar *base;
 
 			//  find slot > key
 
-			while( slot-- ) {
-				test = *(judyvalue *)(base + slot * keysize);
-#if BYTE_ORDER == BIG_ENDIAN
-				test >>= 8 * (JUDY_key_size - keysize); 
-#else
-				test &= JudyMask[keysize];
-#endif
-				if( test <= value )
-					break;
-			}
+			if( (slot = JudySearch (base, cnt, keysize, value)) >= 0 )
+				test = judy_test (base, slot, keysize);
+			else
+				test = ~value;	// all keys > value
 #ifndef ASKITIS
 			judy->stack[judy->level].slot = slot;
 #endif
@@ -590,7 +1975,7 @@ uchar *base;
 			return NULL;
 
 		case JUDY_radix:
-			table = (JudySlot  *)(next & JUDY_mask); // outer radix
+			table = (JudySlot  *)JUDY_addr(judy, next); // outer radix
 
 			if( judy->depth )
 				slot = (src[depth] >> ((JUDY_key_size - ++off & JUDY_key_mask) * 8)) & 0xff;
@@ -603,29 +1988,38 @@ uchar *base;
 
 			judy->stack[judy->level].slot = slot;
 #endif
-			if( (next = table[slot >> 4]) )
-				table = (JudySlot  *)(next & JUDY_mask); // inner radix
-			else
-				return NULL;
+			if( !(next = table[slot >> 4]) || !(node = judy_inner (judy, next, slot)) )
+				return NULL;	// inner radix
 
 			if( judy->depth )
 				if( !(off & JUDY_key_mask) )
 					depth++;
 
 			if( !judy->depth && !slot || judy->depth && depth == judy->depth )	// leaf?
-				if( table[slot & 0x0F] )	// occupied?
-					return &table[slot & 0x0F];
+				if( *node )	// occupied?
+					return node;
 				else
 					return NULL;
 
-			next = table[slot & 0x0F];
+			next = *node;
 			continue;
 
 #ifndef ASKITIS
 		case JUDY_span:
-			node = (JudySlot *)((next & JUDY_mask) + JudySize[JUDY_span]);
-			base = (uchar *)(next & JUDY_mask);
-			cnt = tst = JUDY_span_bytes;
+			node = (JudySlot *)(JUDY_addr(judy, next) + JudySize[JUDY_span]);
+			base = (uchar *)JUDY_addr(judy, next);
+
+			if( judy->depth ) {		// bitmap leaf
+				slot = (uchar)src[depth];
+				judy->stack[judy->level].slot = slot;
+
+				if( base[slot >> 3] & 1 << (slot & 7) )
+					return judy_bitcell (judy);
+
+				return NULL;
+			}
+
+			cnt = tst = judy_spanlen (base);
 			if( tst > (int)(max - off) )
 				tst = max - off;
 			value = strncmp((const char *)base, (const char *)(buff + off), tst);
@@ -645,6 +2039,265 @@ uchar *base;
 	return NULL;
 }
 
+//	integer key engines for arrays of depth 1 (64 bit
+//	keys, and 32 bit keys held as 64 bit Integers) and
+//	depth 2 (128 bit keys).  judy_int descends the levels
+//	of one Integer without the string key checks: each
+//	linear node holds the rest of the Integer and each
+//	radix node takes its next byte, so the key size of
+//	every level follows from the level above and no key
+//	bytes are assembled.  Returns the slot holding the
+//	tree for the next Integer, or the cell for the last.
+//	The cursor stack is not set.
+
+JudySlot *judy_int (Judy *judy, JudySlot next, judyvalue value)
+{
+int keysize = JUDY_key_size;
+JudySlot *table, *node;
+int slot, size;
+uchar *base;
+
+	while( next )
+	  if( (next & 0x07) == JUDY_radix ) {
+		table = (JudySlot *)JUDY_addr(judy, next);
+		slot = (uchar)(value >> --keysize * 8);
+
+		if( !(next = table[slot >> 4]) || !(node = judy_inner (judy, next, slot)) )
+			return NULL;
+
+		if( !keysize )
+			return *node ? node : NULL;
+
+		next = *node;
+#ifndef ASKITIS
+	  } else if( (next & 0x07) == JUDY_bitmap ) {
+		base = (uchar *)JUDY_addr(judy, next);
+		slot = (uchar)value;
+		return base[slot >> 3] & 1 << (slot & 7) ? judy_bitcell (judy) : NULL;
+#endif
+	  } else {
+		size = JudySize[next & 0x07];
+		base = (uchar *)JUDY_addr(judy, next);
+		node = (JudySlot *)(base + size);
+		value &= JudyMask[keysize];
+
+		if( (slot = JudySearch (base, size / (sizeof(JudySlot) + keysize), keysize, value)) < 0 )
+			return NULL;
+
+		return judy_test (base, slot, keysize) == value ? &node[-slot-1] : NULL;
+	  }
+
+	return NULL;
+}
+
+JudySlot *judy_slot32 (Judy *judy, uint key)
+{
+	return judy_int (judy, *judy->root, key);
+}
+
+JudySlot *judy_slot64 (Judy *judy, judyvalue key)
+{
+	return judy_int (judy, *judy->root, key);
+}
+
+//	key[0] holds the high order Integer
+
+JudySlot *judy_slot128 (Judy *judy, judyvalue *key)
+{
+JudySlot *next = judy_int (judy, *judy->root, key[0]);
+
+	return next ? judy_int (judy, *next, key[1]) : NULL;
+}
+
+//	judy_slot_batch: find the cells for n keys together.
+//	each pass steps every unfinished key down one node
+//	and prefetches the node it will visit next pass, so
+//	the cache misses of independent keys overlap.
+//	out[idx] is set to the cell or NULL, the cursor
+//	stack is not set.  lens is ignored for integer keys.
+
+#define JUDY_batch 64
+
+void judy_prefetch (Judy *judy, JudySlot next)
+{
+uint size = JudySize[next & 0x07], line;
+uchar *base = (uchar *)JUDY_addr(judy, next);
+
+	if( (next & 0x07) == JUDY_radix )
+		size = JUDY_slot_size * 16;
+
+	for( line = 0; line < size; line += 64 )
+		JUDY_prefetch (base + line);
+}
+
+uint judy_slot_batch (Judy *judy, uchar **keys, uint *lens, uint n, JudySlot **out)
+{
+judyvalue bin[JUDY_batch][JUDY_binmax / JUDY_key_size];
+int radix[JUDY_batch], live[JUDY_batch];
+uint off[JUDY_batch], depth[JUDY_batch];
+JudySlot next[JUDY_batch];
+int size, keysize, cnt, tst, slot;
+uint first, idx, act, keep, key;
+uint found = 0, max;
+JudySlot *table, *node, *cell;
+judyvalue value;
+judyvalue *src;
+uchar *buff;
+uchar *base;
+
+  //	an empty array has no root node to descend
+
+  if( !*judy->root ) {
+	for( idx = 0; idx < n; idx++ )
+		out[idx] = NULL;
+	return 0;
+  }
+
+  for( first = 0; first < n; first += JUDY_batch ) {
+	act = n - first < JUDY_batch ? n - first : JUDY_batch;
+
+	for( idx = 0; idx < act; idx++ ) {
+		out[first + idx] = NULL;
+		next[idx] = *judy->root;
+		off[idx] = depth[idx] = 0;
+		radix[idx] = -1;
+		live[idx] = idx;
+
+		if( judy->keylen )
+			judy_pack (judy, bin[idx], keys[first + idx], lens[first + idx]);
+	}
+
+	while( act ) {
+	  for( keep = idx = 0; idx < act; idx++ ) {
+		key = live[idx];
+		buff = keys[first + key];
+		src = judy->keylen ? bin[key] : (judyvalue *)buff;
+		max = judy->depth ? 0 : lens[first + key];
+		cell = NULL;
+
+		//	inner radix table, whole or sparse
+
+		if( (slot = radix[key]) >= 0 ) {
+			radix[key] = -1;
+
+			if( !(table = judy_inner (judy, next[key], slot)) )
+				next[key] = 0;
+			else if( !judy->depth && !slot || judy->depth && depth[key] == judy->depth ) {
+				if( *table )
+					cell = table;
+				next[key] = 0;
+			} else
+				next[key] = *table;
+		} else
+		switch( next[key] & 0x07 ) {
+		case JUDY_1:
+		case JUDY_2:
+		case JUDY_4:
+		case JUDY_8:
+		case JUDY_16:
+		case JUDY_32:
+#ifdef ASKITIS
+		case JUDY_64:
+#endif
+			size = JudySize[next[key] & 0x07];
+			base = (uchar *)JUDY_addr(judy, next[key]);
+			node = (JudySlot *)(JUDY_addr(judy, next[key]) + size);
+			keysize = JUDY_key_size - (off[key] & JUDY_key_mask);
+			cnt = size / (sizeof(JudySlot) + keysize);
+			value = 0;
+
+			if( judy->depth ) {
+				value = src[depth[key]++];
+				off[key] |= JUDY_key_mask;
+				off[key]++;
+				value &= JudyMask[keysize];
+			} else
+			  do {
+				value <<= 8;
+				if( off[key] < max )
+					value |= buff[off[key]];
+			  } while( ++off[key] & JUDY_key_mask );
+
+			slot = JudySearch (base, cnt, keysize, value);
+
+			if( slot < 0 || judy_test (base, slot, keysize) != value ) {
+				next[key] = 0;
+				break;
+			}
+
+			if( !judy->depth && !(value & 0xFF) || judy->depth && depth[key] == judy->depth ) {
+				cell = &node[-slot-1];
+				next[key] = 0;
+				break;
+			}
+
+			next[key] = node[-slot-1];
+			break;
+
+		case JUDY_radix:
+			table = (JudySlot *)JUDY_addr(judy, next[key]);
+
+			//	outer radix: pick the inner table
+			//	and visit it on the next pass
+
+			if( judy->depth )
+				slot = (src[depth[key]] >> ((JUDY_key_size - ++off[key] & JUDY_key_mask) * 8)) & 0xff;
+			else if( off[key] < max )
+				slot = buff[off[key]++];
+			else
+				slot = 0;
+
+			if( judy->depth )
+			  if( !(off[key] & JUDY_key_mask) )
+				depth[key]++;
+
+			if( (next[key] = table[slot >> 4]) )
+				radix[key] = slot;
+			break;
+
+#ifndef ASKITIS
+		case JUDY_span:
+			node = (JudySlot *)(JUDY_addr(judy, next[key]) + JudySize[JUDY_span]);
+			base = (uchar *)JUDY_addr(judy, next[key]);
+			next[key] = 0;
+
+			if( judy->depth ) {		// bitmap leaf
+				slot = (uchar)src[depth[key]];
+
+				if( base[slot >> 3] & 1 << (slot & 7) )
+					cell = judy_bitcell (judy);
+
+				break;
+			}
+
+			cnt = tst = judy_spanlen (base);
+			if( tst > (int)(max - off[key]) )
+				tst = max - off[key];
+			value = strncmp((const char *)base, (const char *)(buff + off[key]), tst);
+
+			if( !value && tst < cnt && !base[tst] ) // leaf?
+				cell = &node[-1];
+			else if( !value && tst == cnt ) {
+				next[key] = node[-1];
+				off[key] += cnt;
+			}
+			break;
+#endif
+		}
+
+		if( cell )
+			out[first + key] = cell, found++;
+		else if( next[key] )
+			judy_prefetch (judy, next[key]), live[keep++] = key;
+	  }
+
+	  act = keep;
+	}
+  }
+
+  return found;
+}
+
 //	promote full nodes to next larger size
 
 JudySlot *judy_promote (Judy *judy, JudySlot *next, int idx, judyvalue value, int keysize)
@@ -716,19 +2369,16 @@ uint type = JUDY_1 - 1;
 JudySlot *table;
 uchar *base;
 
-	//	if necessary, setup inner radix node
-
-	if( !(table = (JudySlot *)(radix[key >> 4] & JUDY_mask)) ) {
-		table = judy_alloc (judy, JUDY_radix);
-		radix[key >> 4] = (JudySlot)table | JUDY_radix;
-	}
+	//	find or make the inner radix slot
 
+	table = judy_room (judy, &radix[key >> 4], key);
 	oldnode = (JudySlot *)(old + JudySize[JUDY_max]);
 
-	// is this slot a leaf?
+	// is this slot a leaf, or the end of an integer
+	//	whose slot holds the tree for the next Integer?
 
-	if( !judy->depth && (!key || !keysize) || judy->depth && !keysize && depth == judy->depth) {
-		table[key & 0x0F] = oldnode[-start-1];
+	if( !judy->depth && (!key || !keysize) || judy->depth && !keysize ) {
+		*table = oldnode[-start-1];
 		return;
 	}
 
@@ -740,11 +2390,33 @@ uchar *base;
 		newcnt = size / (sizeof(JudySlot) + keysize);
 	} while( cnt > newcnt && type < JUDY_max );
 
+#ifndef ASKITIS
+	//	integer sets keep last key bytes in a bitmap
+	//	leaf when they need more than its size
+
+	if( judy->segflags & JUDY_set && judy->depth && keysize == 1 && depth == judy->depth )
+	  if( size > JudySize[JUDY_bitmap] ) {
+		base = judy_alloc (judy, JUDY_bitmap);
+		*table = (JudySlot)base | JUDY_bitmap;
+
+		for( idx = start; idx < slot; idx++ ) {
+#if BYTE_ORDER != BIG_ENDIAN
+			key = old[idx * 2];
+#else
+			key = old[idx * 2 + 1];
+#endif
+			base[key >> 3] |= 1 << (key & 7);
+		}
+
+		return;
+	  }
+#endif
+
 	//	store new node pointer in inner table
 
 	base = judy_alloc (judy, type);
 	node = (JudySlot *)(base + size);
-	table[key & 0x0F] = (JudySlot)base | type;
+	*table = (JudySlot)base | type;
 
 	//	allocate node and copy old contents
 	//	shorten keys by 1 byte during copy
@@ -774,7 +2446,6 @@ uchar *base;
 	//	allocate outer judy_radix node
 
 	newradix = judy_alloc (judy, JUDY_radix);
-	*next = (JudySlot)newradix | JUDY_radix;
 
 	for( slot = 0; slot < cnt; slot++ ) {
 #if BYTE_ORDER != BIG_ENDIAN
@@ -796,6 +2467,10 @@ uchar *base;
 	}
 
 	judy_radix (judy, newradix, base, start, slot, keysize - 1, (uchar)key, depth);
+
+	//	link in the finished radix nodes
+
+	JUDY_store (next, (JudySlot)newradix | JUDY_radix);
 	judy_free (judy, (void **)base, JUDY_max);
 }
 
@@ -828,11 +2503,15 @@ uchar *base;
 		case JUDY_64:
 #endif
 			keysize = JUDY_key_size - (off & JUDY_key_mask);
-			node = (JudySlot *)((next & JUDY_mask) + size);
-			base = (uchar *)(next & JUDY_mask);
+			node = (JudySlot *)(JUDY_addr(judy, next) + size);
+			base = (uchar *)JUDY_addr(judy, next);
 			cnt = size / (sizeof(JudySlot) + keysize);
 
-			for( slot = 0; slot < cnt; slot++ )
+			//	the top slot is always in use, lower slots
+			//	are empty or, for a concurrent reader,
+			//	leaf cells not yet filled in by the writer
+
+			for( slot = 0; slot < cnt - 1; slot++ )
 				if( node[-slot-1] )
 					break;
 
@@ -854,13 +2533,13 @@ uchar *base;
 			  if( !(off & JUDY_key_mask) )
 				depth++;
 
-			table = (JudySlot *)(next & JUDY_mask);
+			table = (JudySlot *)JUDY_addr(judy, next);
 			for( slot = 0; slot < 256; slot++ )
-			  if( (inner = (JudySlot *)(table[slot >> 4] & JUDY_mask)) ) {
-				if( (next = inner[slot & 0x0F]) ) {
+			  if( table[slot >> 4] ) {
+				if( (inner = judy_inner (judy, table[slot >> 4], slot)) && (next = *inner) ) {
 				  judy->stack[judy->level].slot = slot;
 				  if( !judy->depth && !slot || judy->depth && depth == judy->depth )
-					return &inner[slot & 0x0F];
+					return inner;
 				  else
 					break;
 				}
@@ -869,13 +2548,18 @@ uchar *base;
 			continue;
 #ifndef ASKITIS
 		case JUDY_span:
-			node = (JudySlot *)((next & JUDY_mask) + JudySize[JUDY_span]);
-			base = (uchar *)(next & JUDY_mask);
-			cnt = JUDY_span_bytes;
-			if( !base[cnt - 1] )	// leaf node?
+			node = (JudySlot *)(JUDY_addr(judy, next) + JudySize[JUDY_span]);
+			base = (uchar *)JUDY_addr(judy, next);
+
+			if( judy->depth ) {		// bitmap leaf
+				judy->stack[judy->level].slot = judy_bit (base, -1, 1);
+				return judy_bitcell (judy);
+			}
+
+			if( !base[JUDY_span_bytes - 1] )	// leaf node?
 				return &node[-1];
 			next = node[-1];
-			off += cnt;
+			off += judy_spanlen (base);
 			continue;
 #endif
 		}
@@ -890,7 +2574,7 @@ JudySlot *judy_last (Judy *judy, JudySlot next, uint off, uint depth)
 JudySlot *table, *inner;
 uint keysize, size;
 JudySlot *node;
-int slot, cnt;
+int slot;
 uchar *base;
 
 	while( next ) {
@@ -912,8 +2596,8 @@ uchar *base;
 #endif
 			keysize = JUDY_key_size - (off & JUDY_key_mask);
 			slot = size / (sizeof(JudySlot) + keysize);
-			base = (uchar *)(next & JUDY_mask);
-			node = (JudySlot *)((next & JUDY_mask) + size);
+			base = (uchar *)JUDY_addr(judy, next);
+			node = (JudySlot *)(JUDY_addr(judy, next) + size);
 			judy->stack[judy->level].slot = --slot;
 
 #if BYTE_ORDER != BIG_ENDIAN
@@ -928,7 +2612,7 @@ uchar *base;
 			continue;
 
 		case JUDY_radix:
-			table = (JudySlot *)(next & JUDY_mask);
+			table = (JudySlot *)JUDY_addr(judy, next);
 			off++;
 
 			if( judy->depth )
@@ -937,10 +2621,10 @@ uchar *base;
 
 			for( slot = 256; slot--; ) {
 			  judy->stack[judy->level].slot = slot;
-			  if( (inner = (JudySlot *)(table[slot >> 4] & JUDY_mask)) ) {
-				if( (next = inner[slot & 0x0F]) )
+			  if( table[slot >> 4] ) {
+				if( (inner = judy_inner (judy, table[slot >> 4], slot)) && (next = *inner) )
 				  if( !judy->depth && !slot || judy->depth && depth == judy->depth )
-					return &inner[0];
+					return inner;
 				  else
 					break;
 			  } else
@@ -950,13 +2634,18 @@ uchar *base;
 
 #ifndef ASKITIS
 		case JUDY_span:
-			node = (JudySlot *)((next & JUDY_mask) + JudySize[JUDY_span]);
-			base = (uchar *)(next & JUDY_mask);
-			cnt = JUDY_span_bytes;
-			if( !base[cnt - 1] )	// leaf node?
+			node = (JudySlot *)(JUDY_addr(judy, next) + JudySize[JUDY_span]);
+			base = (uchar *)JUDY_addr(judy, next);
+
+			if( judy->depth ) {		// bitmap leaf
+				judy->stack[judy->level].slot = judy_bit (base, 256, -1);
+				return judy_bitcell (judy);
+			}
+
+			if( !base[JUDY_span_bytes - 1] )	// leaf node?
 				return &node[-1];
 			next = node[-1];
-			off += cnt;
+			off += judy_spanlen (base);
 			continue;
 #endif
 		}
@@ -1005,8 +2694,8 @@ uint off;
 		case JUDY_64:
 #endif
 			cnt = size / (sizeof(JudySlot) + keysize);
-			node = (JudySlot *)((next & JUDY_mask) + size);
-			base = (uchar *)(next & JUDY_mask);
+			node = (JudySlot *)(JUDY_addr(judy, next) + size);
+			base = (uchar *)JUDY_addr(judy, next);
 			if( ++slot < cnt )
 #if BYTE_ORDER != BIG_ENDIAN
 				if( !judy->depth && !base[slot * keysize] || judy->depth && ++depth == judy->depth )
@@ -1024,19 +2713,19 @@ uint off;
 			continue;
 
 		case JUDY_radix:
-			table = (JudySlot *)(next & JUDY_mask);
+			table = (JudySlot *)JUDY_addr(judy, next);
 
 			if( judy->depth )
 			  if( !((off+1) & JUDY_key_mask) )
 				depth++; 
 
 			while( ++slot < 256 )
-			  if( (inner = (JudySlot *)(table[slot >> 4] & JUDY_mask)) ) {
-				if( inner[slot & 0x0F] ) {
+			  if( table[slot >> 4] ) {
+				if( (inner = judy_inner (judy, table[slot >> 4], slot)) && *inner ) {
 				  judy->stack[judy->level].slot = slot;
 				  if( !judy->depth || depth < judy->depth )
-					return judy_first(judy, inner[slot & 0x0F], off + 1, depth);
-				  return &inner[slot & 0x0F];
+					return judy_first(judy, *inner, off + 1, depth);
+				  return inner;
 				}
 			  } else
 				slot |= 0x0F;
@@ -1045,6 +2734,12 @@ uint off;
 			continue;
 #ifndef ASKITIS
 		case JUDY_span:
+			if( judy->depth )	// bitmap leaf
+			  if( (slot = judy_bit ((uchar *)JUDY_addr(judy, next), slot, 1)) >= 0 ) {
+				judy->stack[judy->level].slot = slot;
+				return judy_bitcell (judy);
+			  }
+
 			judy->level--;
 			continue;
 #endif
@@ -1084,15 +2779,18 @@ uint off;
 #ifdef ASKITIS
 		case JUDY_64:
 #endif
-			node = (JudySlot *)((next & JUDY_mask) + size);
-			if( !slot || !node[-slot] ) {
+			node = (JudySlot *)(JUDY_addr(judy, next) + size);
+			base = (uchar *)JUDY_addr(judy, next);
+			keysize = JUDY_key_size - (off & JUDY_key_mask);
+
+			//	empty slots have zero key and pointer
+
+			if( !slot || !node[-slot] && !judy_test (base, slot - 1, keysize) ) {
 				judy->level--;
 				continue;
 			}
 
-			base = (uchar *)(next & JUDY_mask);
 			judy->stack[judy->level].slot--;
-			keysize = JUDY_key_size - (off & JUDY_key_mask);
 
 #if BYTE_ORDER != BIG_ENDIAN
 			if( !judy->depth && !base[(slot - 1) * keysize] || judy->depth && ++depth == judy->depth )
@@ -1103,7 +2801,7 @@ uint off;
 			return judy_last (judy, node[-slot], (off | JUDY_key_mask) + 1, depth);
 
 		case JUDY_radix:
-			table = (JudySlot *)(next & JUDY_mask);
+			table = (JudySlot *)JUDY_addr(judy, next);
 
 			if( judy->depth )
 			  if( !((off + 1) & JUDY_key_mask) )
@@ -1111,12 +2809,12 @@ uint off;
 
 			while( slot-- ) {
 			  judy->stack[judy->level].slot--;
-			  if( (inner = (JudySlot *)(table[slot >> 4] & JUDY_mask)) )
-				if( inner[slot & 0x0F] )
+			  if( table[slot >> 4] && (inner = judy_inner (judy, table[slot >> 4], slot)) )
+				if( *inner )
 				  if( !judy->depth && !slot || judy->depth && depth == judy->depth )
-					return &inner[0];
+					return inner;
 				  else
-				    return judy_last(judy, inner[slot & 0x0F], off + 1, depth);
+				    return judy_last(judy, *inner, off + 1, depth);
 			}
 
 			judy->level--;
@@ -1124,6 +2822,12 @@ uint off;
 
 #ifndef ASKITIS
 		case JUDY_span:
+			if( judy->depth )	// bitmap leaf
+			  if( (slot = judy_bit ((uchar *)JUDY_addr(judy, next), slot, -1)) >= 0 ) {
+				judy->stack[judy->level].slot = slot;
+				return judy_bitcell (judy);
+			  }
+
 			judy->level--;
 			continue;
 #endif
@@ -1132,17 +2836,67 @@ uint off;
 	return NULL;
 }
 
-//	judy_del: delete string from judy array
-//		returning previous entry.
+//	return the tree pointer slot that
+//	leads to the node at the stack level
 
-JudySlot *judy_del (Judy *judy)
+JudySlot *judy_parent (Judy *judy, uint level)
 {
-int slot, off, size, type, high;
-JudySlot *table, *inner;
+JudySlot next, *table;
+int slot;
+
+	if( level < 2 )
+		return judy->root;
+
+	next = judy->stack[level - 1].next;
+	slot = judy->stack[level - 1].slot;
+
+	switch( next & 0x07 ) {
+	case JUDY_radix:
+		table = (JudySlot *)(next & JUDY_mask);
+		return judy_inner (judy, table[slot >> 4], slot);
+#ifndef ASKITIS
+	case JUDY_span:
+		return (JudySlot *)((next & JUDY_mask) + JudySize[JUDY_span]) - 1;
+#endif
+	default:
+		return (JudySlot *)((next & JUDY_mask) + JudySize[next & 0x07]) - slot - 1;
+	}
+}
+
+//	does a linear node slot end its key?
+
+int judy_ends (Judy *judy, uchar *base, int slot, int keysize, uint depth)
+{
+	if( judy->depth )
+		return depth + 1 == judy->depth;
+#if BYTE_ORDER != BIG_ENDIAN
+	return !base[slot * keysize];
+#else
+	return !base[slot * keysize + keysize - 1];
+#endif
+}
+
+//	judy_remove: delete the key on the stack
+//		returning previous entry.
+
+JudySlot *judy_remove (Judy *judy)
+{
+int slot, off, size, type, high;
+JudySlot *table, *inner;
 JudySlot next, *node;
 int keysize, cnt;
+uchar *newbase;
 uchar *base;
 
+	if( judy->mapped )	// images are read-only
+		return NULL;
+
+	if( judy->epoch && judy->epoch->retired >= JUDY_retire )
+		judy_reclaim (judy);
+
+	if( judy->counts )
+		judy_recount (judy, -1);
+
 	while( judy->level ) {
 		next = judy->stack[judy->level].next;
 		slot = judy->stack[judy->level].slot;
@@ -1164,6 +2918,17 @@ uchar *base;
 			node = (JudySlot *)((next & JUDY_mask) + size);
 			base = (uchar *)(next & JUDY_mask);
 
+			//	readers may be in this node, change a copy
+
+			if( judy->epoch ) {
+				newbase = judy_alloc (judy, type);
+				memcpy (newbase, base, size);
+				judy_free (judy, base, type);
+				base = newbase;
+				node = (JudySlot *)(base + size);
+				judy->stack[judy->level].next = next = (JudySlot)base | type;
+			}
+
 			//	move deleted slot to first slot
 
 			while( slot ) {
@@ -1178,6 +2943,8 @@ uchar *base;
 			memset (base, 0, keysize);
 
 			if( node[-cnt] ) {	// does node have any slots left?
+				if( judy->epoch )
+					JUDY_store (judy_parent (judy, judy->level), next);
 				judy->stack[judy->level].slot++;
 				return judy_prv (judy);
 			}
@@ -1189,14 +2956,17 @@ uchar *base;
 		case JUDY_radix:
 			table = (JudySlot  *)(next & JUDY_mask);
 			inner = (JudySlot *)(table[slot >> 4] & JUDY_mask);
-			inner[slot & 0x0F] = 0;
+			type = table[slot >> 4] & 0x07;
+			*judy_inner (judy, table[slot >> 4], slot) = 0;
 			high = slot & 0xF0;
 
-			for( cnt = 16; cnt--; )
+			//	the first slot of a sparse table is its bitmap
+
+			for( cnt = type == JUDY_radix ? 16 : JUDY_popcnt ((uint)inner[0]) + 1; cnt-- > (type != JUDY_radix); )
 				if( inner[cnt] )
 					return judy_prv (judy);
 
-			judy_free (judy, inner, JUDY_radix);
+			judy_free (judy, inner, type);
 			table[slot >> 4] = 0;
 
 			for( cnt = 16; cnt--; )
@@ -1210,6 +2980,15 @@ uchar *base;
 #ifndef ASKITIS
 		case JUDY_span:
 			base = (uchar *)(next & JUDY_mask);
+
+			if( judy->depth ) {		// bitmap leaf
+				base[slot >> 3] &= ~(1 << (slot & 7));
+
+				for( cnt = 0; cnt < JudySize[JUDY_bitmap]; cnt++ )
+				  if( base[cnt] )
+					return judy_prv (judy);
+			}
+
 			judy_free (judy, base, type);
 			judy->level--;
 			continue;
@@ -1223,575 +3002,7293 @@ uchar *base;
 	return NULL;
 }
 
-//	return cell for first key greater than or equal to given key
+//	judy_del: delete string from judy array
+//		returning previous entry.  the key is
+//		logged after it is gone.
 
-JudySlot *judy_strt (Judy *judy, uchar *buff, uint max)
+JudySlot *judy_del (Judy *judy)
 {
-JudySlot *cell;
+JudySlot *prev;
+uint len;
 
-	judy->level = 0;
+	if( !judy->log )
+		return judy_remove (judy);
 
-	if( !max )
-		return judy_first (judy, *judy->root, 0, 0);
+	len = judy_key (judy, judy->log->key, judy->max);
+	judy_logready (judy);
+	prev = judy_remove (judy);
+	judy_logop (judy, JUDY_logdel, judy->log->key, len, NULL, 0);
+	return prev;
+}
 
-	if( (cell = judy_slot (judy, buff, max)) )
-		return cell;
+//	judy_del_range: delete the keys from lo thru hi,
+//	taking whole subtrees between the bounds off the
+//	tree at once.  judy_del_prefix: delete the keys
+//	starting with the given bytes.  both return the
+//	number of keys deleted and clear the cursor stack.
 
-	return judy_nxt (judy);
-}
+typedef struct {
+	uchar *lo, *hi;		// bounds, or NULL for the ends of the array
+	uint lomax, himax;	// bound string lengths
+	uchar pad;			// hi string byte past himax
+} JudyRange;
 
-//	split open span node
+//	free the subtree under a tree pointer at key byte
+//	off, or under an inner radix table at outer slot
+//	idx, returning the number of keys it held
 
-#ifndef ASKITIS
-void judy_splitspan (Judy *judy, JudySlot *next, uchar *base)
+JudySlot judy_wipe (Judy *judy, JudySlot next, uint off, uint depth, int idx)
 {
-JudySlot *node = (JudySlot *)(base + JudySize[JUDY_span]);
-uint cnt = JUDY_span_bytes;
-uchar *newbase;
-uint off = 0;
-#if BYTE_ORDER != BIG_ENDIAN
-int i;
+JudySlot count = 0, *table, *inner, *node;
+uint keysize, size;
+int slot, cnt;
+uchar *base;
+
+	base = (uchar *)(next & JUDY_mask);
+	size = JudySize[next & 0x07];
+
+	if( idx >= 0 ) {		// inner radix table
+		for( slot = 0; slot < 16; slot++ )
+		  if( (inner = judy_inner (judy, next, slot)) && *inner )
+			if( !judy->depth && !idx && !slot || judy->depth && depth == judy->depth )
+				count++;
+			else
+				count += judy_wipe (judy, *inner, off, depth, -1);
+
+		judy_free (judy, base, next & 0x07);
+		return count;
+	}
+
+	switch( next & 0x07 ) {
+	case JUDY_1:
+	case JUDY_2:
+	case JUDY_4:
+	case JUDY_8:
+	case JUDY_16:
+	case JUDY_32:
+#ifdef ASKITIS
+	case JUDY_64:
 #endif
+		keysize = JUDY_key_size - (off & JUDY_key_mask);
+		node = (JudySlot *)(base + size);
+		cnt = size / (sizeof(JudySlot) + keysize);
 
-	do {
-		newbase = judy_alloc (judy, JUDY_1);
-		*next = (JudySlot)newbase | JUDY_1;
+		for( slot = 0; slot < cnt; slot++ )
+		  if( node[-slot-1] )
+			if( judy_ends (judy, base, slot, keysize, depth) )
+				count++;
+			else
+				count += judy_wipe (judy, node[-slot-1], (off | JUDY_key_mask) + 1, depth + 1, -1);
+		break;
 
-#if BYTE_ORDER != BIG_ENDIAN
-		i = JUDY_key_size;
-		while( i-- )
-			*newbase++ = base[off + i];
-#else
-		memcpy (newbase, base + off, JUDY_key_size);
-		newbase += JUDY_key_size;
+	case JUDY_radix:
+		off++;
+
+		if( judy->depth )
+		  if( !(off & JUDY_key_mask) )
+			depth++;
+
+		table = (JudySlot *)base;
+
+		for( idx = 0; idx < 16; idx++ )
+		  if( table[idx] )
+			count += judy_wipe (judy, table[idx], off, depth, idx);
+		break;
+
+#ifndef ASKITIS
+	case JUDY_span:
+		node = (JudySlot *)(base + size);
+
+		if( judy->depth )		// bitmap leaf
+			for( slot = 0; slot < 32; slot += sizeof(uint) )
+				count += JUDY_popcnt (*(uint *)(base + slot));
+		else if( !base[JUDY_span_bytes - 1] )	// leaf node?
+			count = 1;
+		else
+			count = judy_wipe (judy, node[-1], off + judy_spanlen (base), depth, -1);
+		break;
 #endif
-		next = (JudySlot *)newbase;
+	}
 
-		off += JUDY_key_size;
-		cnt -= JUDY_key_size;
-	} while( cnt && base[off - 1] );
+	judy_free (judy, base, next & 0x07);
+	return count;
+}
 
-	*next = node[-1];
-	judy_free (judy, base, JUDY_span);
+//	bound key bytes off thru the end of their key word,
+//	or the bound Integer's bytes for an Integer array
+
+judyvalue judy_bound (Judy *judy, uchar *buff, uint max, uchar pad, uint off, uint depth, uint keysize)
+{
+judyvalue value = 0;
+uint len;
+
+	if( judy->depth )
+		return ((judyvalue *)buff)[depth] & JudyMask[keysize];
+
+	for( len = off; len < (off | JUDY_key_mask) + 1; len++ )
+		value = value << 8 | (len < max ? buff[len] : pad);
+
+	return value;
 }
-#endif
 
-//	judy_cell: add string to judy array
+//	bound key byte off, in the tree's radix order
 
-JudySlot *judy_cell (Judy *judy, uchar *buff, uint max)
+uint judy_boundbyte (Judy *judy, uchar *buff, uint max, uchar pad, uint off, uint depth)
 {
-judyvalue *src = (judyvalue *)buff;
-int size, idx, slot, cnt, tst;
-JudySlot *next = judy->root;
-judyvalue test, value;
-uint off = 0, start;
-JudySlot *table;
-JudySlot *node;
-uint depth = 0;
-uint keysize;
-uchar *base;
+	if( judy->depth )
+		return (((judyvalue *)buff)[depth] >> ((JUDY_key_size - (off + 1) & JUDY_key_mask) * 8)) & 0xff;
 
-	judy->level = 0;
+	return off < max ? buff[off] : pad;
+}
 
-	while( *next ) {
-#ifndef ASKITIS
-		if( judy->level < judy->max )
-			judy->level++;
+//	delete the keys in range below the tree pointer at
+//	*parent, clearing it if its node empties.  lotight
+//	and hitight are set while the key bytes above off
+//	equal those of the lo or hi bound.
 
-		judy->stack[judy->level].next = *next;
-		judy->stack[judy->level].off = off;
+JudySlot judy_prune (Judy *judy, JudyRange *range, JudySlot *parent, uint off, uint depth, int lotight, int hitight)
+{
+JudySlot next = *parent, count = 0, *table, *inner, *node;
+int slot, cnt, idx, put, type, sl, sh;
+judyvalue test, lov = 0, hiv = 0;
+uint keysize, size, lob = 0, hib = 0xff;
+uchar *base, *newbase;
+
+	base = (uchar *)(next & JUDY_mask);
+	size = JudySize[type = next & 0x07];
+
+	switch( type ) {
+	case JUDY_1:
+	case JUDY_2:
+	case JUDY_4:
+	case JUDY_8:
+	case JUDY_16:
+	case JUDY_32:
+#ifdef ASKITIS
+	case JUDY_64:
 #endif
-		switch( *next & 0x07 ) {
-		default:
-			size = JudySize[*next & 0x07];
-			keysize = JUDY_key_size - (off & JUDY_key_mask);
-			cnt = size / (sizeof(JudySlot) + keysize);
-			base = (uchar *)(*next & JUDY_mask);
-			node = (JudySlot *)((*next & JUDY_mask) + size);
-			start = off;
-			slot = cnt;
-			value = 0;
+		keysize = JUDY_key_size - (off & JUDY_key_mask);
+		cnt = size / (sizeof(JudySlot) + keysize);
 
-			if( judy->depth ) {
-				value = src[depth++];
-				off |= JUDY_key_mask;
-				off++;
-				value &= JudyMask[keysize];
-			} else
-			  do {
-				value <<= 8;
-				if( off < max )
-					value |= buff[off];
-			  } while( ++off & JUDY_key_mask );
+		//	readers may be in this node, change a copy
 
-			//  find slot > key
+		if( judy->epoch ) {
+			newbase = judy_alloc (judy, type);
+			memcpy (newbase, base, size);
+			judy_free (judy, base, type);
+			base = newbase;
+		}
 
-			while( slot-- ) {
-				test = *(judyvalue *)(base + slot * keysize);
-#if BYTE_ORDER == BIG_ENDIAN
-				test >>= 8 * (JUDY_key_size - keysize); 
-#else
-				test &= JudyMask[keysize];
-#endif
-				if( test <= value )
-					break;
-			}
-#ifndef ASKITIS
-			judy->stack[judy->level].slot = slot;
-#endif
-			if( test == value ) {		// new key is equal to slot key
-				next = &node[-slot-1];
+		node = (JudySlot *)(base + size);
 
-				// is this a leaf?
+		if( lotight )
+			lov = judy_bound (judy, range->lo, range->lomax, 0, off, depth, keysize);
+		if( hitight )
+			hiv = judy_bound (judy, range->hi, range->himax, range->pad, off, depth, keysize);
 
-				if( !judy->depth && !(value & 0xFF) || judy->depth && depth == judy->depth ) {
-				  return next;
+		//	keys fill the node from the top slot down
+
+		for( slot = put = cnt; slot--; ) {
+			if( !node[-slot-1] )
+				break;
+
+			test = judy_test (base, slot, keysize);
+
+			if( lotight && test < lov || hitight && test > hiv ) {
+				if( --put > slot ) {
+					node[-put-1] = node[-slot-1];
+					memcpy (base + put * keysize, base + slot * keysize, keysize);
 				}
+				continue;
+			}
 
+			sl = lotight && test == lov;
+			sh = hitight && test == hiv;
+
+			if( judy_ends (judy, base, slot, keysize, depth) )
+				count++;
+			else if( !sl && !sh )
+				count += judy_wipe (judy, node[-slot-1], (off | JUDY_key_mask) + 1, depth + 1, -1);
+			else if( count += judy_prune (judy, range, node - slot - 1, (off | JUDY_key_mask) + 1, depth + 1, sl, sh), node[-slot-1] ) {
+				if( --put > slot ) {
+					node[-put-1] = node[-slot-1];
+					memcpy (base + put * keysize, base + slot * keysize, keysize);
+				}
 				continue;
 			}
+		}
 
-			//	if this node is not full
-			//	open up cell after slot
+		if( put < cnt ) {
+			memset (base, 0, put * keysize);
+			memset (node - put, 0, put * sizeof(JudySlot));
+			JUDY_store (parent, (JudySlot)base | type);
+			return count;
+		}
 
-			if( !node[-1] ) {
-		 	  memmove(base, base + keysize, slot * keysize);	// move keys less than new key down one slot
-#if BYTE_ORDER != BIG_ENDIAN
-			  memcpy(base + slot * keysize, &value, keysize);	// copy new key into slot
-#else
-			  test = value;
-			  idx = keysize;
+		judy_free (judy, base, type);
+		JUDY_store (parent, 0);
+		return count;
 
-			  while( idx-- )
-				  base[slot * keysize + idx] = test, test >>= 8;
-#endif
-			  for( idx = 0; idx < slot; idx++ )
-				node[-idx-1] = node[-idx-2];// copy tree ptrs/cells down one slot
+	case JUDY_radix:
+		if( lotight )
+			lob = judy_boundbyte (judy, range->lo, range->lomax, 0, off, depth);
+		if( hitight )
+			hib = judy_boundbyte (judy, range->hi, range->himax, range->pad, off, depth);
 
-			  node[-slot-1] = 0;			// set new tree ptr/cell
-			  next = &node[-slot-1];
+		off++;
 
-			  if( !judy->depth && !(value & 0xFF) || judy->depth && depth == judy->depth ) {
-			  	return next;
-			  }
+		if( judy->depth )
+		  if( !(off & JUDY_key_mask) )
+			depth++;
 
-			  continue;
-			}
+		table = (JudySlot *)base;
 
-			if( size < JudySize[JUDY_max] ) {
-			  next = judy_promote (judy, next, slot+1, value, keysize);
+		for( idx = lob >> 4; idx <= (int)hib >> 4; idx++ ) {
+			if( !table[idx] )
+				continue;
 
-			  if( !judy->depth && !(value & 0xFF) || judy->depth && depth == judy->depth ) {
-				return next;
-			  }
+			//	take whole inner tables inside the bounds
 
-			  continue;
+			if( (!lotight || idx > (int)lob >> 4) && (!hitight || idx < (int)hib >> 4) ) {
+				count += judy_wipe (judy, table[idx], off, depth, idx);
+				JUDY_store (table + idx, 0);
+				continue;
 			}
 
-			//	split full maximal node into JUDY_radix nodes
-			//  loop to reprocess new insert
-
-			judy_splitnode (judy, next, size, keysize, depth);
-#ifndef ASKITIS
-			judy->level--;
-#endif
-			off = start;
-			if( judy->depth )
-				depth--;
-			continue;
-		
-		case JUDY_radix:
-			table = (JudySlot *)(*next & JUDY_mask); // outer radix
+			for( slot = 0; slot < 16; slot++ ) {
+				if( lotight && (idx << 4 | slot) < (int)lob || hitight && (idx << 4 | slot) > (int)hib )
+					continue;
 
-			if( judy->depth )
-				slot = (src[depth] >> ((JUDY_key_size - ++off & JUDY_key_mask) * 8)) & 0xff;
-			else if( off < max )
-				slot = buff[off++];
-			else
-				slot = 0, off++;
+				if( !(inner = judy_inner (judy, table[idx], slot)) || !*inner )
+					continue;
 
-			if( judy->depth )
-				if( !(off & JUDY_key_mask) )
-					depth++;
+				sl = lotight && (idx << 4 | slot) == (int)lob;
+				sh = hitight && (idx << 4 | slot) == (int)hib;
+
+				if( !judy->depth && !idx && !slot || judy->depth && depth == judy->depth ) {
+					JUDY_store (inner, 0);
+					count++;
+				} else if( !sl && !sh ) {
+					count += judy_wipe (judy, *inner, off, depth, -1);
+					JUDY_store (inner, 0);
+				} else
+					count += judy_prune (judy, range, inner, off, depth, sl, sh);
+			}
 
-			// allocate inner radix if empty
+			//	the first slot of a sparse table is its bitmap
 
-			if( !table[slot >> 4] )
-				table[slot >> 4] = (JudySlot)judy_alloc (judy, JUDY_radix) | JUDY_radix;
+			inner = (JudySlot *)(table[idx] & JUDY_mask);
+			type = table[idx] & 0x07;
 
-			table = (JudySlot *)(table[slot >> 4] & JUDY_mask);
-#ifndef ASKITIS
-			judy->stack[judy->level].slot = slot;
-#endif
-			next = &table[slot & 0x0F];
+			for( cnt = type == JUDY_radix ? 16 : JUDY_popcnt ((uint)inner[0]) + 1; cnt-- > (type != JUDY_radix); )
+				if( inner[cnt] )
+					break;
 
-			if( !judy->depth && !slot || judy->depth && depth == judy->depth ) { // leaf?
-				return next;
+			if( cnt < (type != JUDY_radix) ) {
+				judy_free (judy, inner, type);
+				JUDY_store (table + idx, 0);
 			}
+		}
 
-			continue;
+		for( idx = 16; idx--; )
+			if( table[idx] )
+				return count;
+
+		judy_free (judy, table, JUDY_radix);
+		JUDY_store (parent, 0);
+		return count;
 
 #ifndef ASKITIS
-		case JUDY_span:
-			base = (uchar *)(*next & JUDY_mask);
-			node = (JudySlot *)((*next & JUDY_mask) + JudySize[JUDY_span]);
-			cnt = JUDY_span_bytes;
-			tst = cnt;
+	case JUDY_span:
+		node = (JudySlot *)(base + size);
+
+		if( judy->depth ) {		// bitmap leaf
+			if( lotight )
+				lob = (uchar)((judyvalue *)range->lo)[depth];
+			if( hitight )
+				hib = (uchar)((judyvalue *)range->hi)[depth];
+
+			for( slot = lob; slot <= (int)hib; slot++ )
+			  if( base[slot >> 3] & 1 << (slot & 7) ) {
+				base[slot >> 3] &= ~(1 << (slot & 7));
+				count++;
+			  }
 
-			if( tst > (int)(max - off) )
-				tst = max - off;
+			for( slot = 0; slot < JudySize[JUDY_bitmap]; slot++ )
+			  if( base[slot] )
+				return count;
 
-			value = strncmp((const char *)base, (const char *)(buff + off), tst);
+			judy_free (judy, base, type);
+			JUDY_store (parent, 0);
+			return count;
+		}
 
-			if( !value && tst < cnt && !base[tst] ) // leaf?
-				return &node[-1];
+		if( !base[JUDY_span_bytes - 1] )	// leaf: compare the terminator too
+			cnt = (int)strlen ((char *)base) + 1;
+		else
+			cnt = judy_spanlen (base);
 
-			if( !value && tst == cnt ) {
-				next = &node[-1];
-				off += cnt;
-				continue;
+		sl = lotight, sh = hitight;
+
+		for( idx = 0; idx < cnt && (sl || sh); idx++ ) {
+			if( sl && base[idx] != (off + idx < range->lomax ? range->lo[off + idx] : 0) ) {
+				if( base[idx] < (off + idx < range->lomax ? range->lo[off + idx] : 0) )
+					return 0;
+				sl = 0;
 			}
+			if( sh && base[idx] != (off + idx < range->himax ? range->hi[off + idx] : range->pad) ) {
+				if( base[idx] > (off + idx < range->himax ? range->hi[off + idx] : range->pad) )
+					return 0;
+				sh = 0;
+			}
+		}
 
-			//	bust up JUDY_span node and produce JUDY_1 nodes
+		if( !base[JUDY_span_bytes - 1] || !sl && !sh ) {
+			JUDY_store (parent, 0);
+			return judy_wipe (judy, next, off, depth, -1);
+		}
+
+		count = judy_prune (judy, range, node - 1, off + cnt, depth, sl, sh);
+
+		if( node[-1] )
+			return count;
+
+		JUDY_store (parent, 0);
+		judy_free (judy, base, type);
+		return count;
+#endif
+	}
+
+	return count;
+}
+
+//	prune the range from the root
+
+JudySlot judy_cut (Judy *judy, JudyRange *range, int lotight, int hitight)
+{
+	//	the counts of the nodes above the pruned
+	//	subtrees are rebuilt by the next judy_rank
+
+	if( judy->counts )
+		free (judy->counts), judy->counts = NULL;
+
+	judy->level = 0;
+	return judy_prune (judy, range, judy->root, 0, 0, lotight, hitight);
+}
+
+JudySlot judy_del_range (Judy *judy, uchar *lo, uint lolen, uchar *hi, uint hilen)
+{
+judyvalue lobin[JUDY_binmax / JUDY_key_size];
+judyvalue hibin[JUDY_binmax / JUDY_key_size];
+JudyRange range[1];
+JudySlot count;
+
+	if( judy->mapped || !*judy->root )	// images are read-only
+		return 0;
+
+	if( judy->epoch && judy->epoch->retired >= JUDY_retire )
+		judy_reclaim (judy);
+
+	if( judy->log )
+		judy_logready (judy);
+
+	range->lo = lo, range->lomax = lolen;
+	range->hi = hi, range->himax = hilen;
+	range->pad = 0;
+
+	if( judy->keylen ) {	// binary keys padded with zeros
+		range->lo = lo ? (uchar *)judy_pack (judy, lobin, lo, lolen) : NULL;
+		range->hi = hi ? (uchar *)judy_pack (judy, hibin, hi, hilen) : NULL;
+	}
+
+	count = judy_cut (judy, range, lo != NULL, hi != NULL);
+
+	if( judy->log )
+		judy_logop (judy, JUDY_logrange | (lo ? 0 : JUDY_loglo) | (hi ? 0 : JUDY_loghi), lo, lo ? judy_loglen (judy, lolen) : 0, hi, hi ? judy_loglen (judy, hilen) : 0);
+
+	return count;
+}
+
+JudySlot judy_del_prefix (Judy *judy, uchar *buff, uint max)
+{
+JudyRange range[1];
+judyvalue *lo = NULL;
+JudySlot count;
+uchar *fill;
+uint len;
+
+	if( judy->mapped || !*judy->root )
+		return 0;
+
+	if( judy->epoch && judy->epoch->retired >= JUDY_retire )
+		judy_reclaim (judy);
+
+	if( judy->log )
+		judy_logready (judy);
+
+	range->lo = range->hi = buff;
+	range->lomax = range->himax = max;
+	range->pad = 0xff;
+
+	//	Integer keys run from the prefix padded
+	//	with zero bytes to it padded with 0xff
+
+	if( judy->depth ) {
+		len = judy->keylen ? judy->keylen : judy->depth * JUDY_key_size;
+
+		if( max > len )
+			max = len;
+
+		if( !(lo = malloc (2 * judy->depth * sizeof(judyvalue) + len)) )
+			return 0;
+
+		fill = (uchar *)(lo + 2 * judy->depth);
+		memcpy (fill, buff, max);
+		memset (fill + max, 0xff, len - max);
+		range->lo = (uchar *)judy_pack (judy, lo, buff, max);
+		range->hi = (uchar *)judy_pack (judy, lo + judy->depth, fill, len);
+	}
+
+	count = judy_cut (judy, range, max > 0, max > 0);
+	free (lo);
+
+	if( judy->log )
+		judy_logop (judy, JUDY_logprefix, buff, max, NULL, 0);
+
+	return count;
+}
+
+//	return cell for first key greater than or equal to given key.
+//	descend as judy_slot does; where the key leaves the tree,
+//	leave the stack on the slot below it and step to the next
+//	key with judy_nxt, or take the first key of a span above it.
+//	empty cells are vacant slots, not keys.
+
+JudySlot *judy_strt (Judy *judy, uchar *buff, uint max)
+{
+judyvalue bin[JUDY_binmax / JUDY_key_size];
+judyvalue *src = (judyvalue *)buff;
+int slot, size, keysize, tst, cnt;
+JudySlot next = *judy->root;
+judyvalue value;
+JudySlot *table;
+JudySlot *node;
+uint depth = 0;
+uint off = 0;
+uchar *base;
+
+	judy->level = 0;
+
+	if( !max )
+		return judy_first (judy, next, 0, 0);
+
+	if( judy->keylen )
+		src = judy_pack (judy, bin, buff, max);
+
+	while( next ) {
+		if( judy->level < judy->max )
+			judy->level++;
+
+		judy->stack[judy->level].next = next;
+		judy->stack[judy->level].off = off;
+		size = JudySize[next & 0x07];
+
+		switch( next & 0x07 ) {
+		case JUDY_1:
+		case JUDY_2:
+		case JUDY_4:
+		case JUDY_8:
+		case JUDY_16:
+		case JUDY_32:
+#ifdef ASKITIS
+		case JUDY_64:
+#endif
+			base = (uchar *)JUDY_addr(judy, next);
+			node = (JudySlot *)(JUDY_addr(judy, next) + size);
+			keysize = JUDY_key_size - (off & JUDY_key_mask);
+			cnt = size / (sizeof(JudySlot) + keysize);
+			value = 0;
+
+			if( judy->depth ) {
+				value = src[depth++];
+				off |= JUDY_key_mask;
+				off++;
+				value &= JudyMask[keysize];
+			} else
+			  do {
+				value <<= 8;
+				if( off < max )
+					value |= buff[off];
+			  } while( ++off & JUDY_key_mask );
+
+			//	slot of the last key <= value, which judy_nxt
+			//	steps past when it is not the key's own
+
+			slot = JudySearch (base, cnt, keysize, value);
+			judy->stack[judy->level].slot = slot;
+
+			if( slot < 0 || judy_test (base, slot, keysize) != value || !node[-slot-1] )
+				return judy_nxt (judy);
+
+			if( !judy->depth && !(value & 0xFF) || judy->depth && depth == judy->depth )
+				return &node[-slot-1];
+
+			next = node[-slot-1];
+			continue;
+
+		case JUDY_radix:
+			table = (JudySlot *)JUDY_addr(judy, next);
+
+			if( judy->depth )
+				slot = (src[depth] >> ((JUDY_key_size - ++off & JUDY_key_mask) * 8)) & 0xff;
+			else if( off < max )
+				slot = buff[off++];
+			else
+				slot = 0;
+
+			judy->stack[judy->level].slot = slot;
+
+			if( !(next = table[slot >> 4]) || !(node = judy_inner (judy, next, slot)) || !*node )
+				return judy_nxt (judy);
+
+			if( judy->depth )
+				if( !(off & JUDY_key_mask) )
+					depth++;
+
+			if( !judy->depth && !slot || judy->depth && depth == judy->depth )
+				return node;
+
+			next = *node;
+			continue;
+
+#ifndef ASKITIS
+		case JUDY_span:
+			node = (JudySlot *)(JUDY_addr(judy, next) + JudySize[JUDY_span]);
+			base = (uchar *)JUDY_addr(judy, next);
+
+			if( judy->depth ) {		// bitmap leaf
+				slot = (uchar)src[depth];
+				judy->stack[judy->level].slot = slot;
+
+				if( base[slot >> 3] & 1 << (slot & 7) )
+					return judy_bitcell (judy);
+
+				return judy_nxt (judy);
+			}
+
+			cnt = tst = judy_spanlen (base);
+			if( tst > (int)(max - off) )
+				tst = max - off;
+			value = strncmp((const char *)base, (const char *)(buff + off), tst);
+
+			if( !value && tst < cnt && !base[tst] ) // leaf?
+				return node[-1] ? &node[-1] : judy_nxt (judy);
+
+			if( !value && tst == cnt ) {
+				next = node[-1];
+				off += cnt;
+				continue;
+			}
+
+			//	the span's keys are all below the key,
+			//	or all above it when the key ends first
+
+			if( (int)value < 0 )
+				return judy_nxt (judy);
+
+			judy->level--;
+			return judy_first (judy, next, off, depth);
+#endif
+		}
+	}
+
+	return NULL;
+}
+
+//	judy_scan: pass the keys from lo thru hi to a
+//	callback, rebuilding only the part of each key
+//	below the stack level judy_nxt changed.  lo NULL
+//	continues after the current key, as judy_nxt does,
+//	and hi NULL runs to the last key.  the callback
+//	returns non-zero to refuse a key and stop.  a limit
+//	of zero is unlimited.  the current key is left at
+//	the last key accepted, or at the last key in the
+//	array at its end.  returns the number accepted.
+
+typedef int JudyScan (void *arg, uchar *key, uint len, JudySlot *cell);
+
+//	compare an assembled key with the hi bound
+
+int judy_above (Judy *judy, uchar *key, uint len, uchar *hi, uint hilen)
+{
+judyvalue *x = (judyvalue *)key;
+judyvalue *y = (judyvalue *)hi;
+uint idx;
+int diff;
+
+	if( judy->keylen ) {	// binary keys padded with zeros
+		for( idx = 0; idx < len; idx++ )
+		  if( key[idx] != (idx < hilen ? hi[idx] : 0) )
+			return key[idx] > (idx < hilen ? hi[idx] : 0);
+		return 0;
+	}
+
+	if( judy->depth ) {
+		for( idx = 0; idx < judy->depth; idx++ )
+		  if( x[idx] != y[idx] )
+			return x[idx] > y[idx];
+		return 0;
+	}
+
+	if( (diff = memcmp (key, hi, len < hilen ? len : hilen)) )
+		return diff > 0;
+
+	return len > hilen;
+}
+
+uint judy_scan (Judy *judy, uchar *lo, uint lolen, uchar *hi, uint hilen, JudyScan *scan, void *arg, uint limit)
+{
+uint cnt = 0, top = 0, idx, len;
+JudyStack *prev;
+JudySlot *cell;
+uchar *key;
+
+	//	previous key's stack, then the key itself
+
+	if( !(prev = malloc ((judy->max + 1) * sizeof(JudyStack) + judy->max + JUDY_key_size)) )
+		return 0;
+
+	key = (uchar *)(prev + judy->max + 1);
+
+	if( lo )
+		cell = judy_strt (judy, lo, judy->depth && !judy->keylen ? judy->depth * JUDY_key_size : lolen);
+	else
+		cell = judy_nxt (judy);
+
+	while( cell ) {
+		//	levels whose node and slot are unchanged
+		//	still hold the previous key's bytes
+
+		for( idx = top < judy->level ? top : judy->level; idx; idx-- )
+		  if( prev[idx].next == judy->stack[idx].next && prev[idx].slot == judy->stack[idx].slot )
+			break;
+
+		len = judy_suffix (judy, key, judy->max, idx + 1);
+		memcpy (prev + idx + 1, judy->stack + idx + 1, (judy->level - idx) * sizeof(JudyStack));
+		top = judy->level;
+
+		if( hi && judy_above (judy, key, len, hi, hilen) || scan (arg, key, len, cell) ) {
+			judy_prv (judy);
+			break;
+		}
+
+		if( ++cnt == limit )
+			break;
+
+		if( !(cell = judy_nxt (judy)) )
+			judy_end (judy);	// stay on the last key
+	}
+
+	free (prev);
+	return cnt;
+}
+
+//	judy_scan_buff: copy the keys from lo thru hi and
+//	their cell values into a buffer of JudyRecords,
+//	stopping when the next record will not fit.
+
+typedef struct {
+	JudySlot value;		// cell value
+	JudySlot len;		// key length
+	uchar key[1];		// zero terminated key, padded to a JudySlot
+} JudyRecord;
+
+#define JUDY_record(len) ((3 * sizeof(JudySlot) + (len)) & ~(sizeof(JudySlot) - 1))
+
+typedef struct {
+	uchar *buff;		// next record
+	uint size;			// space left
+} JudyFill;
+
+int judy_fill (void *arg, uchar *key, uint len, JudySlot *cell)
+{
+JudyFill *fill = (JudyFill *)arg;
+JudyRecord *rec = (JudyRecord *)fill->buff;
+uint amt = JUDY_record(len);
+
+	if( amt > fill->size )
+		return 1;
+
+	rec->value = *cell;
+	rec->len = len;
+	memcpy (rec->key, key, len);
+	memset (rec->key + len, 0, amt - len - 2 * sizeof(JudySlot));
+	fill->buff += amt;
+	fill->size -= amt;
+	return 0;
+}
+
+uint judy_scan_buff (Judy *judy, uchar *lo, uint lolen, uchar *hi, uint hilen, uchar *buff, uint size, uint limit)
+{
+JudyFill fill[1];
+
+	fill->buff = buff;
+	fill->size = size;
+	return judy_scan (judy, lo, lolen, hi, hilen, judy_fill, fill, limit);
+}
+
+//	split open span node lazily: the key words up to
+//	the one holding byte diff, where a new key leaves
+//	the span, become JUDY_1 nodes, and the rest of the
+//	span's key bytes stay behind in a shorter span node
+//	when they would take more than one JUDY_1 node
+
+#ifndef ASKITIS
+void judy_splitspan (Judy *judy, JudySlot *next, uchar *base, uint diff)
+{
+JudySlot *node = (JudySlot *)(base + JudySize[JUDY_span]);
+JudySlot *span = next, first;
+uint cnt = judy_spanlen (base);
+uchar *newbase;
+uint off = 0;
+#if BYTE_ORDER != BIG_ENDIAN
+int i;
+#endif
+
+	if( !base[JUDY_span_bytes - 1] )	// leaf: count the terminator
+		cnt = strlen ((char *)base) + 1;
+
+	next = &first;
+
+	do {
+		newbase = judy_alloc (judy, JUDY_1);
+		*next = (JudySlot)newbase | JUDY_1;
+
+#if BYTE_ORDER != BIG_ENDIAN
+		i = JUDY_key_size;
+		while( i-- )
+			*newbase++ = base[off + i];
+#else
+		memcpy (newbase, base + off, JUDY_key_size);
+		newbase += JUDY_key_size;
+#endif
+		next = (JudySlot *)newbase;
+
+		off += JUDY_key_size;
+	} while( off < cnt && base[off - 1] && (off <= diff || cnt - off <= JUDY_key_size) );
+
+	if( off < cnt && base[off - 1] ) {
+		newbase = judy_alloc (judy, JUDY_span);
+		*next = (JudySlot)newbase | JUDY_span;
+		memcpy (newbase, base + off, cnt - off);
+
+		if( base[JUDY_span_bytes - 1] )
+			newbase[JUDY_span_bytes - 1] = JUDY_span_short;
+
+		next = (JudySlot *)(newbase + JudySize[JUDY_span]) - 1;
+	}
+
+	*next = node[-1];
+	JUDY_store (span, first);
+	judy_free (judy, base, JUDY_span);
+}
+#endif
+
+//	concurrent mode: link a privately built node or
+//	subtree, held in judy->pending, into the tree, and
+//	return the cell
+
+JudySlot *judy_publish (Judy *judy, JudySlot *publish, JudySlot *cell)
+{
+	if( !publish )
+		return cell;
+
+	JUDY_store (publish, judy->pending);
+	return cell == &judy->pending ? publish : cell;
+}
+
+//	add string to judy array
+
+JudySlot *judy_insert (Judy *judy, uchar *buff, uint max)
+{
+judyvalue bin[JUDY_binmax / JUDY_key_size];
+judyvalue *src = (judyvalue *)buff;
+int size, idx, slot, cnt, tst;
+JudySlot *next = judy->root;
+JudySlot *publish = NULL;
+judyvalue test, value;
+uint off = 0, start;
+JudySlot *table;
+JudySlot *node;
+uint depth = 0;
+uint keysize;
+uchar *base;
+
+	if( judy->mapped )	// images are read-only
+		return NULL;
+
+	if( judy->epoch && judy->epoch->retired >= JUDY_retire )
+		judy_reclaim (judy);
+
+	if( judy->keylen )
+		src = judy_pack (judy, bin, buff, max);
+
+	judy->level = 0;
+
+	while( *next ) {
+#ifndef ASKITIS
+		if( judy->level < judy->max )
+			judy->level++;
+
+		judy->stack[judy->level].next = *next;
+		judy->stack[judy->level].off = off;
+#endif
+		switch( *next & 0x07 ) {
+		default:
+			size = JudySize[*next & 0x07];
+			keysize = JUDY_key_size - (off & JUDY_key_mask);
+			cnt = size / (sizeof(JudySlot) + keysize);
+			base = (uchar *)(*next & JUDY_mask);
+			node = (JudySlot *)((*next & JUDY_mask) + size);
+			start = off;
+			value = 0;
+
+			if( judy->depth ) {
+				value = src[depth++];
+				off |= JUDY_key_mask;
+				off++;
+				value &= JudyMask[keysize];
+			} else
+			  do {
+				value <<= 8;
+				if( off < max )
+					value |= buff[off];
+			  } while( ++off & JUDY_key_mask );
+
+			//  find slot > key
+
+			if( (slot = JudySearch (base, cnt, keysize, value)) >= 0 )
+				test = judy_test (base, slot, keysize);
+			else
+				test = ~value;	// all keys > value
+#ifndef ASKITIS
+			judy->stack[judy->level].slot = slot;
+#endif
+			if( test == value ) {		// new key is equal to slot key
+				next = &node[-slot-1];
+
+				// is this a leaf?
+
+				if( !judy->depth && !(value & 0xFF) || judy->depth && depth == judy->depth ) {
+				  return next;
+				}
+
+				continue;
+			}
+
+			//	if this node is not full
+			//	open up cell after slot
+
+			if( !node[-1] ) {
+			  if( judy->epoch ) {	// readers may be in this node, change a copy
+				publish = next, next = &judy->pending;
+				*next = (JudySlot)judy_alloc (judy, *publish & 0x07) | (*publish & 0x07);
+				memcpy ((void *)(*next & JUDY_mask), base, size);
+				judy_free (judy, base, *publish & 0x07);
+				base = (uchar *)(*next & JUDY_mask);
+				node = (JudySlot *)((*next & JUDY_mask) + size);
+#ifndef ASKITIS
+				judy->stack[judy->level].next = *next;
+#endif
+			  }
+
+		 	  memmove(base, base + keysize, slot * keysize);	// move keys less than new key down one slot
+#if BYTE_ORDER != BIG_ENDIAN
+			  memcpy(base + slot * keysize, &value, keysize);	// copy new key into slot
+#else
+			  test = value;
+			  idx = keysize;
+
+			  while( idx-- )
+				  base[slot * keysize + idx] = test, test >>= 8;
+#endif
+			  for( idx = 0; idx < slot; idx++ )
+				node[-idx-1] = node[-idx-2];// copy tree ptrs/cells down one slot
+
+			  node[-slot-1] = 0;			// set new tree ptr/cell
+			  next = &node[-slot-1];
+
+			  if( !judy->depth && !(value & 0xFF) || judy->depth && depth == judy->depth ) {
+			  	return judy_publish (judy, publish, next);
+			  }
+
+			  continue;
+			}
+
+#ifndef ASKITIS
+			//	integer sets turn a full leaf of last
+			//	key bytes into a bitmap leaf
+
+			if( judy->segflags & JUDY_set && judy->depth && depth == judy->depth )
+			  if( keysize == 1 && size >= JudySize[JUDY_bitmap] ) {
+				base = judy_alloc (judy, JUDY_bitmap);
+
+				for( idx = 0; idx < cnt; idx++ )
+				  tst = ((uchar *)(*next & JUDY_mask))[idx], base[tst >> 3] |= 1 << (tst & 7);
+
+				slot = (uchar)value;
+				base[slot >> 3] |= 1 << (slot & 7);
+				judy_free (judy, (void *)(*next & JUDY_mask), *next & 0x07);
+				JUDY_store (next, (JudySlot)base | JUDY_bitmap);
+				judy->stack[judy->level].next = *next;
+				judy->stack[judy->level].slot = slot;
+				judy->bit = 0;
+				return judy_publish (judy, publish, &judy->bit);
+			  }
+#endif
+			if( size < JudySize[JUDY_max] ) {
+			  if( judy->epoch )	// build the larger node privately
+				publish = next, judy->pending = *next, next = &judy->pending;
+
+			  next = judy_promote (judy, next, slot+1, value, keysize);
+
+			  if( !judy->depth && !(value & 0xFF) || judy->depth && depth == judy->depth ) {
+				return judy_publish (judy, publish, next);
+			  }
+
+			  continue;
+			}
+
+			//	split full maximal node into JUDY_radix nodes
+			//  loop to reprocess new insert
+
+			judy_splitnode (judy, next, size, keysize, depth);
+#ifndef ASKITIS
+			judy->level--;
+#endif
+			off = start;
+			if( judy->depth )
+				depth--;
+			continue;
+		
+		case JUDY_radix:
+			table = (JudySlot *)(*next & JUDY_mask); // outer radix
+
+			if( judy->depth )
+				slot = (src[depth] >> ((JUDY_key_size - ++off & JUDY_key_mask) * 8)) & 0xff;
+			else if( off < max )
+				slot = buff[off++];
+			else
+				slot = 0, off++;
+
+			if( judy->depth )
+				if( !(off & JUDY_key_mask) )
+					depth++;
+
+			// find or make the inner radix slot
+
+#ifndef ASKITIS
+			judy->stack[judy->level].slot = slot;
+#endif
+			next = judy_room (judy, &table[slot >> 4], slot);
+
+			if( !judy->depth && !slot || judy->depth && depth == judy->depth ) { // leaf?
+				return next;
+			}
+
+			continue;
+
+#ifndef ASKITIS
+		case JUDY_span:
+			base = (uchar *)(*next & JUDY_mask);
+			node = (JudySlot *)((*next & JUDY_mask) + JudySize[JUDY_span]);
+
+			//	bitmap leaf: setting the bit is a
+			//	single store, safe for readers
+
+			if( judy->depth ) {
+				slot = (uchar)src[depth];
+				judy->stack[judy->level].slot = slot;
+				judy->bit = (base[slot >> 3] >> (slot & 7)) & 1;
+				base[slot >> 3] |= 1 << (slot & 7);
+				return judy_publish (judy, publish, &judy->bit);
+			}
+
+			cnt = judy_spanlen (base);
+			tst = cnt;
+
+			if( tst > (int)(max - off) )
+				tst = max - off;
+
+			value = strncmp((const char *)base, (const char *)(buff + off), tst);
+
+			if( !value && tst < cnt && !base[tst] ) // leaf?
+				return &node[-1];
+
+			if( !value && tst == cnt ) {
+				next = &node[-1];
+				off += cnt;
+				continue;
+			}
+
+			//	bust up JUDY_span node where the key leaves it
 			//	then loop to reprocess insert
 
-			judy_splitspan (judy, next, base);
-			judy->level--;
+			for( idx = 0; idx < tst && base[idx] == buff[off + idx]; idx++ );
+			judy_splitspan (judy, next, base, idx);
+			judy->level--;
+			continue;
+#endif
+		}
+	}
+
+	//	in concurrent mode build the rest of the key
+	//	privately and link it in when done
+
+	if( judy->epoch && !publish )
+		publish = next, judy->pending = 0, next = &judy->pending;
+
+	// place JUDY_1 node under JUDY_radix node(s)
+
+#ifndef ASKITIS
+	if( off & JUDY_key_mask )
+	 if( judy->depth || off <= max ) {
+#else
+	  while( off <= max ) {
+#endif
+		base = judy_alloc (judy, JUDY_1);
+		keysize = JUDY_key_size - (off & JUDY_key_mask);
+		node = (JudySlot  *)(base + JudySize[JUDY_1]);
+		*next = (JudySlot)base | JUDY_1;
+
+		//	fill in slot 0 with bytes of key
+
+		if( judy->depth ) {
+			value = src[depth];
+#if BYTE_ORDER != BIG_ENDIAN
+			  memcpy(base, &value, keysize);	// copy new key into slot
+#else
+			  while( keysize-- )
+				  base[keysize] = value, value >>= 8;
+#endif
+		} else {
+#if BYTE_ORDER != BIG_ENDIAN
+		  while( keysize )
+			if( off + keysize <= max )
+				*base++ = buff[off + --keysize];
+			else
+				base++, --keysize;
+#else
+		  tst = keysize;
+
+		  if( tst > (int)(max - off) )
+			tst = max - off;
+
+		  memcpy (base, buff + off, tst);
+#endif
+		}
+#ifndef ASKITIS
+		if( judy->level < judy->max )
+			judy->level++;
+		judy->stack[judy->level].next = *next;
+		judy->stack[judy->level].slot = 0;
+		judy->stack[judy->level].off = off;
+#endif
+		next = &node[-1];
+
+		off |= JUDY_key_mask;
+		depth++;
+		off++;
+	}
+
+	//	produce span nodes to consume rest of key
+	//  or judy_1 nodes if not string tree
+
+#ifndef ASKITIS
+	if( !judy->depth )
+	  while( off <= max ) {
+		base = judy_alloc (judy, JUDY_span);
+		*next = (JudySlot)base | JUDY_span;
+		node = (JudySlot  *)(base + JudySize[JUDY_span]);
+		cnt = tst = JUDY_span_bytes;
+		if( tst > (int)(max - off) )
+			tst = max - off;
+		memcpy (base, buff + off, tst);
+
+		if( judy->level < judy->max )
+			judy->level++;
+		judy->stack[judy->level].next = *next;
+		judy->stack[judy->level].slot = 0;
+		judy->stack[judy->level].off = off;
+		next = &node[-1];
+		off += tst;
+		depth++;
+
+		if( !base[cnt-1] )	// done on leaf
+			break;
+	  }
+	else
+	  while( depth < judy->depth ) {
+		base = judy_alloc (judy, JUDY_1);
+		node = (JudySlot  *)(base + JudySize[JUDY_1]);
+		*next = (JudySlot)base | JUDY_1;
+
+		//	fill in slot 0 with bytes of key
+
+		*(judyvalue *)base = src[depth];
+
+		if( judy->level < judy->max )
+			judy->level++;
+		judy->stack[judy->level].next = *next;
+		judy->stack[judy->level].slot = 0;
+		judy->stack[judy->level].off = off;
+		next = &node[-1];
+		off |= JUDY_key_mask;
+		depth++;
+		off++;
+	  }
+#endif
+
+	return judy_publish (judy, publish, next);
+}
+
+//	judy_cell: add string to judy array, counting
+//	a new key below the nodes on its path when key
+//	counts are kept
+
+JudySlot *judy_cell (Judy *judy, uchar *buff, uint max)
+{
+JudySlot *cell;
+
+	if( judy->log )
+		judy_logop (judy, JUDY_logcell, buff, judy_loglen (judy, max), NULL, 0);
+
+	cell = judy_insert (judy, buff, max);
+
+	if( judy->counts && cell && !*cell )
+		judy_recount (judy, 1);
+
+	if( judy->log )
+		judy->log->cell = cell;
+
+	return cell;
+}
+
+//	integer key inserts: an existing key's cell is
+//	found by the integer engine, new keys go through
+//	judy_cell, which also sets the cursor stack.  an
+//	empty cell may be the vacant slot matching a key
+//	ending in zero bytes, so it goes through judy_cell
+//	too, which keeps the key counts.
+
+JudySlot *judy_cell64 (Judy *judy, judyvalue key)
+{
+JudySlot *cell;
+
+	if( !judy->mapped && !judy->log )
+	  if( (cell = judy_int (judy, *judy->root, key)) && *cell )
+		return cell;
+
+	return judy_cell (judy, (uchar *)&key, 0);
+}
+
+JudySlot *judy_cell32 (Judy *judy, uint key)
+{
+	return judy_cell64 (judy, key);
+}
+
+JudySlot *judy_cell128 (Judy *judy, judyvalue *key)
+{
+JudySlot *cell;
+
+	if( !judy->mapped && !judy->log )
+	  if( (cell = judy_slot128 (judy, key)) && *cell )
+		return cell;
+
+	return judy_cell (judy, (uchar *)key, 0);
+}
+
+//	judy_build_parallel: add n keys using several threads.
+//	keys are split into ranges of their leading byte,
+//	and each thread builds the subtrees under its
+//	range of root radix slots with its own worker
+//	allocator.  the subtrees are then linked under
+//	one root radix node.  cells are set from values,
+//	or count the instances of each key if values
+//	is NULL.  an array with a log open takes the
+//	keys through judy_cell, which logs them.
+//	returns the number of new keys.
+
+typedef struct {
+	Judy *worker;		// worker judy object for the thread
+	uchar **keys;		// all keys
+	uint *lens;			// all key lengths
+	JudySlot *values;	// cell values, or NULL to count
+	uint *order;		// key indices grouped by leading byte, or NULL
+	uint first, last;	// this thread's range of order
+	uint lo, hi;		// this thread's range of leading bytes
+	uint added;			// new keys
+} JudyBuild;
+
+void judy_build (JudyBuild *build)
+{
+Judy *judy = build->worker;
+JudySlot *cell;
+uint idx, key;
+
+	for( idx = build->first; idx < build->last; idx++ ) {
+		key = build->order ? build->order[idx] : idx;
+		cell = judy_cell (judy, build->keys[key], judy->depth && !judy->keylen ? 0 : build->lens[key]);
+
+		if( !*cell )
+			build->added++;
+
+		if( build->values )
+			*cell = build->values[key];
+		else
+			*cell += 1;
+	}
+}
+
+#ifdef _WIN32
+DWORD WINAPI judy_builder (void *arg)
+#else
+void *judy_builder (void *arg)
+#endif
+{
+	judy_build (arg);
+	return 0;
+}
+
+//	leading byte of a key, the first root radix slot
+
+uint judy_lead (Judy *judy, uchar *buff, uint max)
+{
+	if( judy->depth && !judy->keylen )
+		return (*(judyvalue *)buff >> (JUDY_key_size - 1) * 8) & 0xff;
+
+	return max ? buff[0] : 0;
+}
+
+uint judy_build_parallel (Judy *judy, uchar **keys, uint *lens, JudySlot *values, uint n, uint threads)
+{
+uint count[256], start[257];
+JudySlot *table, *inner, *from;
+uint idx, slot, want, added;
+JudyBuild *build;
+uint *order;
+#ifdef _WIN32
+HANDLE *thread;
+#else
+pthread_t *thread;
+#endif
+
+	if( threads > 256 )
+		threads = 256;
+
+	//	add to an existing tree or a logged one
+	//	one key at a time
+
+	if( threads < 2 || n < threads || *judy->root || judy->log || !judy_shared (judy) ) {
+		JudyBuild one[1];
+
+		memset (one, 0, sizeof(one));
+		one->worker = judy, one->keys = keys, one->lens = lens, one->values = values;
+		one->last = n;
+		judy_build (one);
+		return one->added;
+	}
+
+	//	group the keys by leading byte
+
+	memset (count, 0, sizeof(count));
+
+	for( idx = 0; idx < n; idx++ )
+		count[judy_lead (judy, keys[idx], judy->depth && !judy->keylen ? 0 : lens[idx])]++;
+
+	for( start[0] = slot = 0; slot < 256; slot++ )
+		start[slot + 1] = start[slot] + count[slot];
+
+	order = malloc (n * sizeof(uint));
+	build = calloc (threads, sizeof(JudyBuild));
+	thread = calloc (threads, sizeof(*thread));
+
+	if( !order || !build || !thread ) {
+		free (order), free (build), free (thread);
+		return 0;
+	}
+
+	for( idx = 0; idx < n; idx++ ) {
+		slot = judy_lead (judy, keys[idx], judy->depth && !judy->keylen ? 0 : lens[idx]);
+		order[start[slot + 1] - count[slot]--] = idx;
+	}
+
+	//	give each thread a run of leading bytes
+	//	holding about n / threads keys
+
+	for( slot = idx = 0; idx < threads; idx++ ) {
+		build[idx].keys = keys, build[idx].lens = lens, build[idx].values = values;
+		build[idx].order = order;
+		build[idx].lo = slot;
+		build[idx].first = start[slot];
+		want = (uint)((unsigned long long)n * (idx + 1) / threads);
+
+		while( slot < 256 && (start[slot + 1] <= want || idx == threads - 1) )
+			slot++;
+
+		build[idx].hi = slot;
+		build[idx].last = start[slot];
+
+		//	each worker tree starts with a root radix node
+		//	so its subtrees sit at the same key offsets
+		//	as they will in the final tree
+
+		build[idx].worker = judy_worker (judy);
+		*build[idx].worker->root = (JudySlot)judy_alloc (build[idx].worker, JUDY_radix) | JUDY_radix;
+#ifdef _WIN32
+		thread[idx] = CreateThread (NULL, 0, judy_builder, build + idx, 0, NULL);
+#else
+		pthread_create (thread + idx, NULL, judy_builder, build + idx);
+#endif
+	}
+
+	//	link the workers' subtrees under one root radix node
+
+	table = judy_alloc (judy, JUDY_radix);
+	added = 0;
+
+	for( idx = 0; idx < threads; idx++ ) {
+#ifdef _WIN32
+		WaitForSingleObject (thread[idx], INFINITE);
+		CloseHandle (thread[idx]);
+#else
+		pthread_join (thread[idx], NULL);
+#endif
+		from = (JudySlot *)(*build[idx].worker->root & JUDY_mask);
+		added += build[idx].added;
+
+		for( slot = build[idx].lo; slot < build[idx].hi; slot++ ) {
+		  if( !from[slot >> 4] || !(inner = judy_inner (judy, from[slot >> 4], slot)) || !*inner )
+			continue;
+
+		  *judy_room (judy, &table[slot >> 4], slot) = *inner;
+		}
+
+		for( slot = 0; slot < 16; slot++ )
+		  if( from[slot] )
+			judy_free (build[idx].worker, (void *)(from[slot] & JUDY_mask), from[slot] & 0x07);
+
+		judy_free (build[idx].worker, from, JUDY_radix);
+		judy_release (build[idx].worker);
+	}
+
+	JUDY_store (judy->root, (JudySlot)table | JUDY_radix);
+	judy->level = 0;
+
+	free (thread);
+	free (build);
+	free (order);
+	return added;
+}
+
+//	judy_load_sorted: add n keys given in ascending order
+//	to an empty array, building each node at its
+//	final size from the bottom up.  cells are set
+//	as for judy_build_parallel.  keys out of order,
+//	an array that is not empty, or one with a log
+//	open, fall back to judy_cell for each key.
+//	returns the number of new keys.
+
+//	key bytes at off for linear node slot values
+
+judyvalue judy_chunk (Judy *judy, JudyBuild *build, uint key, uint off, uint depth)
+{
+uchar *buff = build->keys[key];
+judyvalue value = 0;
+uint max;
+
+	if( judy->depth && !judy->keylen )
+		return ((judyvalue *)buff)[depth] & JudyMask[JUDY_key_size - (off & JUDY_key_mask)];
+
+	max = build->lens[key];
+
+	if( judy->keylen && max > judy->keylen )
+		max = judy->keylen;
+
+	do {
+		value <<= 8;
+		if( off < max )
+			value |= buff[off];
+	} while( ++off & JUDY_key_mask );
+
+	return value;
+}
+
+//	key byte at off for radix node slots
+
+uint judy_byte (Judy *judy, JudyBuild *build, uint key, uint off, uint depth)
+{
+	if( judy->depth && !judy->keylen )
+		return (((judyvalue *)build->keys[key])[depth] >> ((JUDY_key_size - (off + 1) & JUDY_key_mask) * 8)) & 0xff;
+
+	if( judy->keylen && off >= judy->keylen )
+		return 0;
+
+	return off < build->lens[key] ? build->keys[key][off] : 0;
+}
+
+//	fill in the cell for a run of equal keys
+
+void judy_leaf (JudyBuild *build, JudySlot *cell, uint first, uint last)
+{
+	build->added++;
+
+	if( build->values )
+		*cell = build->values[last - 1];
+	else
+		*cell = last - first;
+}
+
+//	build the subtree for keys first thru last - 1,
+//	which agree up to off, and return its tree pointer
+
+JudySlot judy_sorted (Judy *judy, JudyBuild *build, uint first, uint last, uint off, uint depth)
+{
+uint keysize = JUDY_key_size - (off & JUDY_key_mask);
+uint type, size, cnt, idx, end, max;
+JudySlot *table, *inner, *node;
+int slot;
+JudySlot tree, *next;
+judyvalue value;
+uchar *base;
+#if BYTE_ORDER == BIG_ENDIAN
+int i;
+#endif
+
+#ifndef ASKITIS
+	//	a single string key finishing a tree level
+	//	is stored in span nodes
+
+	if( !judy->depth && !(off & JUDY_key_mask) )
+	  if( (max = build->lens[first]) == build->lens[last - 1] && !memcmp (build->keys[first] + off, build->keys[last - 1] + off, max > off ? max - off : 0) ) {
+		next = &tree;
+
+		while( off <= max ) {
+			base = judy_alloc (judy, JUDY_span);
+			*next = (JudySlot)base | JUDY_span;
+			node = (JudySlot *)(base + JudySize[JUDY_span]);
+			cnt = JUDY_span_bytes;
+			if( cnt > max - off )
+				memcpy (base, build->keys[first] + off, max - off);
+			else
+				memcpy (base, build->keys[first] + off, cnt);
+
+			next = &node[-1];
+			off += cnt > max - off ? max - off : cnt;
+
+			if( !base[cnt - 1] )
+				break;
+		}
+
+		judy_leaf (build, next, first, last);
+		return tree;
+	  }
+#endif
+
+	//	count the distinct slot values
+
+	value = judy_chunk (judy, build, first, off, depth);
+
+	for( cnt = 1, idx = first + 1; idx < last; idx++ )
+	  if( judy_chunk (judy, build, idx, off, depth) != value )
+		value = judy_chunk (judy, build, idx, off, depth), cnt++;
+
+	//	too many for the largest linear node:
+	//	break out the next key byte in radix nodes
+
+	if( cnt > JudySize[JUDY_max] / (sizeof(JudySlot) + keysize) ) {
+		table = judy_alloc (judy, JUDY_radix);
+
+		for( idx = first; idx < last; idx = end ) {
+			slot = judy_byte (judy, build, idx, off, depth);
+
+			for( end = idx + 1; end < last; end++ )
+			  if( judy_byte (judy, build, end, off, depth) != slot )
+				break;
+
+			if( !table[slot >> 4] )
+				table[slot >> 4] = (JudySlot)judy_alloc (judy, JUDY_radix) | JUDY_radix;
+
+			inner = (JudySlot *)(table[slot >> 4] & JUDY_mask);
+
+			if( judy->depth && !((off + 1) & JUDY_key_mask) ) {
+				if( depth + 1 == judy->depth )
+					judy_leaf (build, &inner[slot & 0x0F], idx, end);
+				else
+					inner[slot & 0x0F] = judy_sorted (judy, build, idx, end, off + 1, depth + 1);
+			} else if( !judy->depth && !slot )
+				judy_leaf (build, &inner[slot & 0x0F], idx, end);
+			else
+				inner[slot & 0x0F] = judy_sorted (judy, build, idx, end, off + 1, depth);
+		}
+
+		return (JudySlot)table | JUDY_radix;
+	}
+
+	//	smallest linear node holding the slots,
+	//	filled from the top slot down
+
+	for( type = JUDY_1; JudySize[type] / (sizeof(JudySlot) + keysize) < cnt; type++ );
+
+	size = JudySize[type];
+	base = judy_alloc (judy, type);
+	node = (JudySlot *)(base + size);
+	slot = size / (sizeof(JudySlot) + keysize) - cnt;
+
+	for( idx = first; idx < last; idx = end, slot++ ) {
+		value = judy_chunk (judy, build, idx, off, depth);
+
+		for( end = idx + 1; end < last; end++ )
+		  if( judy_chunk (judy, build, end, off, depth) != value )
+			break;
+
+#if BYTE_ORDER != BIG_ENDIAN
+		memcpy(base + slot * keysize, &value, keysize);	// copy new key into slot
+#else
+		i = keysize;
+
+		while( i-- )
+		  base[slot * keysize + i] = value, value >>= 8;
+#endif
+		if( !judy->depth && !(value & 0xFF) || judy->depth && depth + 1 == judy->depth )
+			judy_leaf (build, &node[-slot-1], idx, end);
+		else
+			node[-slot-1] = judy_sorted (judy, build, idx, end, (off | JUDY_key_mask) + 1, depth + 1);
+	}
+
+	return (JudySlot)base | type;
+}
+
+//	compare two keys in judy order
+
+int judy_order (Judy *judy, JudyBuild *build, uint a, uint b)
+{
+judyvalue *x = (judyvalue *)build->keys[a];
+judyvalue *y = (judyvalue *)build->keys[b];
+uint idx, len;
+int diff;
+
+	if( judy->keylen ) {	// binary keys padded with zeros
+		for( idx = 0; idx < judy->keylen; idx++ )
+		  if( (diff = (int)judy_byte (judy, build, a, idx, 0) - (int)judy_byte (judy, build, b, idx, 0)) )
+			return diff;
+		return 0;
+	}
+
+	if( judy->depth ) {
+		for( idx = 0; idx < judy->depth; idx++ )
+		  if( x[idx] != y[idx] )
+			return x[idx] < y[idx] ? -1 : 1;
+		return 0;
+	}
+
+	len = build->lens[a] < build->lens[b] ? build->lens[a] : build->lens[b];
+
+	if( (diff = memcmp (build->keys[a], build->keys[b], len)) )
+		return diff;
+
+	return (int)build->lens[a] - (int)build->lens[b];
+}
+
+uint judy_load_sorted (Judy *judy, uchar **keys, uint *lens, JudySlot *values, uint n)
+{
+JudyBuild build[1];
+uint idx;
+
+	memset (build, 0, sizeof(build));
+	build->worker = judy, build->keys = keys, build->lens = lens, build->values = values;
+	build->last = n;
+
+	for( idx = 1; idx < n; idx++ )
+	  if( judy_order (judy, build, idx - 1, idx) > 0 )
+		break;
+
+	if( !n || idx < n || *judy->root || judy->log ) {
+		judy_build (build);
+		return build->added;
+	}
+
+	JUDY_store (judy->root, judy_sorted (judy, build, 0, n, 0, 0));
+	judy->level = 0;
+	return build->added;
+}
+
+//	judy_save: write the judy array to a file image
+//	holding the nodes with tree pointers replaced by
+//	offsets from the start of the image.  cells are
+//	copied as they are, so cells pointing at judy_data
+//	memory are not carried over.  returns zero on error.
+
+//	judy_map: map an image read-only and return a judy
+//	object for judy_slot, judy_strt, judy_nxt, judy_prv,
+//	judy_end and judy_key to query in place.  several
+//	processes mapping the image share its pages.  the
+//	object is freed and unmapped by judy_close, and
+//	can not be changed or cloned.  returns NULL if
+//	the file is not an image from this build.
+
+#define JUDY_image "JudyImg3"
+
+typedef struct {
+	uchar magic[8];		// JUDY_image
+	uint order;			// 0x01020304 in the writer's byte order
+	uint slotsize;		// size of the writer's JudySlot
+	uint depth;			// number of Integers in a key, or zero for string keys
+	uint max;			// max height of stack
+	uint keylen;		// bytes in a JUDY_binary key, or zero
+	uint gen;			// first log generation after a judy_snapshot, or zero
+	JudySlot root;		// tagged offset of the root node
+	JudySlot size;		// image length
+} JudyImage;
+
+typedef struct {
+	uchar *buff;		// image, or NULL after running out of memory
+	JudySlot size;		// image length so far
+	JudySlot room;		// buffer size
+} JudyWriter;
+
+//	append a node to the image, aligned to its size
+//	up to a cache line, and return its offset.  the
+//	buffer doubles as needed, so the tree is walked
+//	once, and may change under a reader clone.
+
+JudySlot judy_append (JudyWriter *out, void *node, uint size)
+{
+uint align = size < 64 ? size : 64;
+JudySlot off = (out->size + align - 1) & ~(JudySlot)(align - 1);
+JudySlot room = out->room;
+uchar *buff;
+
+	while( room < off + size )
+		room <<= 1;
+
+	if( out->buff && room > out->room ) {
+	  if( (buff = realloc (out->buff, room)) ) {
+		memset (buff + out->room, 0, room - out->room);
+		out->room = room;
+	  } else
+		free (out->buff);
+
+	  out->buff = buff;
+	}
+
+	if( out->buff )
+		memcpy (out->buff + off, node, size);
+
+	out->size = off + size;
+	return off;
+}
+
+//	append the subtree under a tree pointer, children
+//	after their parent, and return its tagged offset
+
+JudySlot judy_image (Judy *judy, JudyWriter *out, JudySlot next, uint off, uint depth)
+{
+uint type = next & 0x07, size = JudySize[type];
+JudySlot pos, at, child;
+JudySlot *table, *inner;
+int slot, idx, cnt;
+uint keysize;
+JudySlot *node;
+uchar *base;
+
+	base = (uchar *)(next & JUDY_mask);
+	pos = judy_append (out, base, size);
+
+	switch( type ) {
+	case JUDY_1:
+	case JUDY_2:
+	case JUDY_4:
+	case JUDY_8:
+	case JUDY_16:
+	case JUDY_32:
+#ifdef ASKITIS
+	case JUDY_64:
+#endif
+		keysize = JUDY_key_size - (off & JUDY_key_mask);
+		node = (JudySlot *)(base + size);
+		cnt = size / (sizeof(JudySlot) + keysize);
+
+		//	a writer may relink a child under a reader
+		//	clone, so each pointer is read once
+
+		for( slot = 0; slot < cnt; slot++ ) {
+			if( !(child = node[-slot-1]) )
+				continue;
+#if BYTE_ORDER != BIG_ENDIAN
+			if( !judy->depth && !base[slot * keysize] || judy->depth && depth + 1 == judy->depth )
+				continue;
+#else
+			if( !judy->depth && !base[slot * keysize + keysize - 1] || judy->depth && depth + 1 == judy->depth )
+				continue;
+#endif
+			child = judy_image (judy, out, child, (off | JUDY_key_mask) + 1, depth + 1);
+
+			if( out->buff )
+				((JudySlot *)(out->buff + pos + size))[-slot-1] = child;
+		}
+
+		break;
+
+	case JUDY_radix:
+		off++;
+
+		if( judy->depth )
+		  if( !(off & JUDY_key_mask) )
+			depth++;
+
+		table = (JudySlot *)base;
+
+		for( idx = 0; idx < 16; idx++ ) {
+			if( !(next = table[idx]) )
+				continue;
+
+			inner = (JudySlot *)(next & JUDY_mask);
+			at = judy_append (out, inner, JudySize[next & 0x07]);
+
+			if( out->buff )
+				((JudySlot *)(out->buff + pos))[idx] = at | (next & 0x07);
+
+			for( slot = 0; slot < 16; slot++ ) {
+				if( !(node = judy_inner (judy, next, slot)) )
+					continue;
+
+				if( !judy->depth && !idx && !slot || judy->depth && depth == judy->depth )
+					continue;
+
+				if( (child = *node) )
+					child = judy_image (judy, out, child, off, depth);
+
+				if( out->buff )
+					((JudySlot *)(out->buff + at))[node - inner] = child;
+			}
+		}
+
+		break;
+
+#ifndef ASKITIS
+	case JUDY_span:
+		node = (JudySlot *)(base + size);
+
+		if( judy->depth || !base[JUDY_span_bytes - 1] )	// bitmap or leaf node?
+			break;
+
+		if( (child = node[-1]) )
+			child = judy_image (judy, out, child, off + judy_spanlen (base), depth);
+
+		if( out->buff )
+			((JudySlot *)(out->buff + pos + size))[-1] = child;
+
+		break;
+#endif
+	}
+
+	return pos | type;
+}
+
+//	lay out the image of the tree in one walk,
+//	returning it in malloc memory, or NULL
+
+JudyImage *judy_layout (Judy *judy, uint gen)
+{
+JudyWriter out[1];
+JudyImage *image;
+JudySlot root = 0;
+
+	out->room = 65536;
+	out->size = sizeof(JudyImage);
+
+	if( !(out->buff = calloc (out->room, 1)) )
+		return NULL;
+
+	if( *judy->root )
+		root = judy_image (judy, out, *judy->root, 0, 0);
+
+	if( !(image = (JudyImage *)out->buff) )
+		return NULL;
+
+	memcpy (image->magic, JUDY_image, sizeof(image->magic));
+	image->order = 0x01020304;
+	image->slotsize = sizeof(JudySlot);
+	image->depth = judy->depth;
+	image->max = judy->max;
+	image->keylen = judy->keylen;
+	image->gen = gen;
+	image->root = root;
+	image->size = out->size;
+	return image;
+}
+
+int judy_save (Judy *judy, char *path)
+{
+JudyImage *image;
+FILE *file;
+int ok = 0;
+
+	if( !(image = judy_layout (judy, 0)) )
+		return 0;
+
+	if( (file = fopen (path, "wb")) ) {
+		ok = fwrite (image, image->size, 1, file) == 1;
+		ok = !fclose (file) && ok;
+	}
+
+	free (image);
+	return ok;
+}
+
+Judy *judy_map (char *path)
+{
+JudyImage *image;
+JudySlot size;
+Judy *judy;
+uint amt;
+#ifdef _WIN32
+LARGE_INTEGER len[1];
+HANDLE hndl, fm;
+
+	hndl = CreateFile (path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if( hndl == INVALID_HANDLE_VALUE )
+		return NULL;
+
+	if( !GetFileSizeEx (hndl, len) || len->QuadPart < sizeof(JudyImage) ) {
+		CloseHandle (hndl);
+		return NULL;
+	}
+
+	size = len->QuadPart;
+	fm = CreateFileMapping (hndl, NULL, PAGE_READONLY, 0, 0, NULL);
+	CloseHandle (hndl);
+
+	if( !fm )
+		return NULL;
+
+	image = MapViewOfFile (fm, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle (fm);
+
+	if( !image )
+		return NULL;
+#else
+struct stat st[1];
+int fd;
+
+	if( (fd = open (path, O_RDONLY)) < 0 )
+		return NULL;
+
+	if( fstat (fd, st) || st->st_size < sizeof(JudyImage) ) {
+		close (fd);
+		return NULL;
+	}
+
+	size = st->st_size;
+	image = mmap (NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+	close (fd);
+
+	if( image == MAP_FAILED )
+		return NULL;
+#endif
+	amt = sizeof(Judy) + image->max * sizeof(JudyStack);
+
+	if( memcmp (image->magic, JUDY_image, sizeof(image->magic)) || image->order != 0x01020304 || image->slotsize != sizeof(JudySlot) || image->size != size || !(judy = calloc (amt, 1)) ) {
+#ifdef _WIN32
+		UnmapViewOfFile (image);
+#else
+		munmap (image, size);
+#endif
+		return NULL;
+	}
+
+	judy->base = (JudySlot)image;
+	judy->mapped = size;
+	judy->root[0] = image->root;
+	judy->depth = image->depth;
+	judy->max = image->max;
+	judy->keylen = image->keylen;
+	return judy;
+}
+
+//	copy the subtree under a tree pointer of a mapped
+//	image into the array, leaving out keys whose cells
+//	are zero, and return the copy's tree pointer,
+//	or zero when no keys are left
+
+JudySlot judy_restore (Judy *judy, Judy *image, JudySlot next, uint off, uint depth)
+{
+uint type = next & 0x07, size = JudySize[type];
+JudySlot *table, *inner, *node, child;
+int slot, idx, cnt, put;
+uint keysize;
+uchar *base;
+
+	if( !(base = judy_alloc (judy, type)) )
+		return 0;
+
+	memcpy (base, (uchar *)JUDY_addr(image, next), size);
+
+	switch( type ) {
+	case JUDY_1:
+	case JUDY_2:
+	case JUDY_4:
+	case JUDY_8:
+	case JUDY_16:
+	case JUDY_32:
+#ifdef ASKITIS
+	case JUDY_64:
+#endif
+		keysize = JUDY_key_size - (off & JUDY_key_mask);
+		node = (JudySlot *)(base + size);
+		cnt = size / (sizeof(JudySlot) + keysize);
+
+		//	move the keys kept up to the top slots
+
+		for( slot = put = cnt; slot--; ) {
+			if( !(child = node[-slot-1]) )
+				continue;
+
+			if( !judy_ends (judy, base, slot, keysize, depth) )
+				child = judy_restore (judy, image, child, (off | JUDY_key_mask) + 1, depth + 1);
+
+			if( !child )
+				continue;
+
+			node[-(--put)-1] = child;
+			memmove (base + put * keysize, base + slot * keysize, keysize);
+		}
+
+		memset (base, 0, put * keysize);
+		memset (node - put, 0, put * sizeof(JudySlot));
+
+		if( put < cnt )
+			break;
+
+		judy_free (judy, base, type);
+		return 0;
+
+	case JUDY_radix:
+		off++;
+
+		if( judy->depth )
+		  if( !(off & JUDY_key_mask) )
+			depth++;
+
+		table = (JudySlot *)base;
+
+		for( idx = 0; idx < 16; idx++ ) {
+			if( !table[idx] )
+				continue;
+
+			if( !(inner = judy_alloc (judy, table[idx] & 0x07)) )
+				return 0;
+
+			memcpy (inner, (uchar *)JUDY_addr(image, table[idx]), JudySize[table[idx] & 0x07]);
+			table[idx] = (JudySlot)inner | (table[idx] & 0x07);
+			cnt = 0;
+
+			for( slot = 0; slot < 16; slot++ ) {
+				if( !(node = judy_inner (judy, table[idx], slot)) || !*node )
+					continue;
+
+				if( !(!judy->depth && !idx && !slot || judy->depth && depth == judy->depth) )
+					*node = judy_restore (judy, image, *node, off, depth);
+
+				if( *node )
+					cnt++;
+			}
+
+			if( cnt )
+				continue;
+
+			judy_free (judy, inner, table[idx] & 0x07);
+			table[idx] = 0;
+		}
+
+		for( idx = 0; idx < 16; idx++ )
+			if( table[idx] )
+				break;
+
+		if( idx < 16 )
+			break;
+
+		judy_free (judy, base, type);
+		return 0;
+
+#ifndef ASKITIS
+	case JUDY_span:
+		node = (JudySlot *)(base + size);
+
+		if( judy->depth )		// bitmap leaf
+			break;
+
+		if( base[JUDY_span_bytes - 1] )
+		  if( node[-1] )
+			node[-1] = judy_restore (judy, image, node[-1], off + judy_spanlen (base), depth);
+
+		if( node[-1] )
+			break;
+
+		judy_free (judy, base, type);
+		return 0;
+#endif
+	}
+
+	return (JudySlot)base | type;
+}
+
+//	apply the records of a log generation, stopping at
+//	a record torn by a crash.  returns zero if there
+//	is no such generation.
+
+int judy_replay (Judy *judy, JudyLog *log, uint gen)
+{
+uint len = (uint)strlen (log->path), amt, room = 0;
+JudyLogRec rec[1];
+uchar *key = NULL;
+uchar *lo, *hi;
+JudySlot *cell;
+FILE *file;
+
+	sprintf (log->path + len, ".%u", gen);
+	file = fopen (log->path, "rb");
+	log->path[len] = 0;
+
+	if( !file )
+		return 0;
+
+	while( fread (rec, sizeof(JudyLogRec), 1, file) == 1 ) {
+		amt = JUDY_logrec(rec->len + rec->hilen) - sizeof(JudyLogRec);
+
+		//	key bytes are read into JudySlot aligned
+		//	memory, for Integer keys
+
+		if( amt > room ) {
+			free (key);
+			if( !(key = malloc (room = amt)) )
+				break;
+		}
+
+		if( amt && fread (key, amt, 1, file) != 1 )
+			break;
+
+		if( rec->sum != judy_logsum (judy_logsum (JUDY_logseed, (uchar *)rec + sizeof(uint), sizeof(JudyLogRec) - sizeof(uint)), key, amt) )
+			break;
+
+		lo = rec->op & JUDY_loglo ? NULL : key;
+		hi = rec->op & JUDY_loghi ? NULL : key + rec->len;
+
+		switch( rec->op & 0x0f ) {
+		case JUDY_logcell:
+			if( (cell = judy_cell (judy, key, rec->len)) )
+				*cell = rec->value;
+			break;
+
+		case JUDY_logdel:
+			if( judy_slot (judy, key, rec->len) )
+				judy_del (judy);
+			break;
+
+		case JUDY_logrange:
+			judy_del_range (judy, lo, rec->len, hi, rec->hilen);
+			break;
+
+		case JUDY_logprefix:
+			judy_del_prefix (judy, key, rec->len);
+			break;
+		}
+	}
+
+	free (key);
+	fclose (file);
+	return 1;
+}
+
+//	judy_log_open: recover an empty array from the
+//	snapshot at path and the log generations after
+//	it, then log its changes in the next generation,
+//	writing group bytes of records at a time, or
+//	JUDY_loggroup for zero.  returns zero on failure.
+
+int judy_log_open (Judy *judy, char *path, uint group)
+{
+uint len = (uint)strlen (path), gen = 1;
+JudyLog *log;
+Judy *image;
+
+	if( judy->mapped || judy->log || !judy->seg || *judy->root )
+		return 0;
+
+	if( !(log = calloc (1, sizeof(JudyLog))) )
+		return 0;
+
+	log->group = log->room = group ? group : JUDY_loggroup;
+	log->buff = malloc (log->room);
+	log->key = malloc (judy->max + JUDY_key_size);
+
+	if( (log->path = malloc (len + 16)) )
+		strcpy (log->path, path);
+
+	//	load the latest snapshot
+
+	if( log->buff && log->key && log->path )
+	  if( (image = judy_map (path)) ) {
+		if( image->depth != judy->depth || image->keylen != judy->keylen )
+			free (log->path), log->path = NULL;
+		else {
+			gen = ((JudyImage *)image->base)->gen;
+
+			if( *image->root )
+				JUDY_store (judy->root, judy_restore (judy, image, *image->root, 0, 0));
+		}
+
+		judy_close (image);
+	  }
+
+	if( !log->buff || !log->key || !log->path ) {
+		free (log->buff);
+		free (log->key);
+		free (log->path);
+		free (log);
+		return 0;
+	}
+
+	//	remove the generations the snapshot covers,
+	//	left behind by a crash before judy_snapshot
+	//	removed them, then replay the ones after it
+
+	for( log->gen = gen; log->gen > 1; log->gen-- ) {
+		sprintf (log->path + len, ".%u", log->gen - 1);
+		if( remove (log->path) )
+			break;
+	}
+
+	log->path[len] = 0;
+	log->oldest = gen;
+
+	while( judy_replay (judy, log, gen) )
+		gen++;
+
+	sprintf (log->path + len, ".%u", log->gen = gen);
+
+	if( !judy_fcreate (&log->file, log->path) ) {
+		free (log->buff);
+		free (log->key);
+		free (log->path);
+		free (log);
+		return 0;
+	}
+
+	log->path[len] = 0;
+	judy->log = log;
+	return 1;
+}
+
+//	judy_snapshot: write the image of the array to the
+//	log's path, starting a new log generation, and
+//	remove the generations it covers.  view is the
+//	array itself, or in concurrent mode a reader clone
+//	of it, letting another thread take the snapshot
+//	while the writer goes on.  returns zero on failure.
+
+int judy_snapshot (Judy *judy, Judy *view)
+{
+JudyLog *log = judy->log;
+JudyImage *image;
+JudyFile file;
+uint gen, len;
+char *tmp;
+int ok;
+
+	if( !log )
+		return 0;
+
+	//	a JUDY_logcell record still waiting for its
+	//	value goes to the new generation
+
+	JUDY_lock (&log->lock);
+
+	if( view == judy )
+		judy_logsettle (log);
+
+	judy_logwrite (log, 1, 1);
+	gen = log->gen;
+	JUDY_unlock (&log->lock);
+
+	if( view != judy )
+		judy_enter (view);
+
+	image = judy_layout (view, gen);
+
+	if( view != judy )
+		judy_leave (view);
+
+	len = (uint)strlen (log->path);
+
+	if( !image || !(tmp = malloc (len + 16)) ) {
+		free (image);
+		return 0;
+	}
+
+	sprintf (tmp, "%s.tmp", log->path);
+
+	if( (ok = judy_fcreate (&file, tmp)) ) {
+		ok = judy_fwrite (file, (uchar *)image, (uint)image->size) && judy_fsync (file);
+		judy_fclose (file);
+	}
+
+	free (image);
+
+	//	a clone's image may hold changes made while it
+	//	was laid out, so sync their records before
+	//	putting the image in place
+
+	if( ok && view != judy ) {
+		JUDY_lock (&log->lock);
+		judy_logwrite (log, 1, 0);
+		ok = !log->fail;
+		JUDY_unlock (&log->lock);
+	}
+
+#ifdef _WIN32
+	ok = ok && MoveFileEx (tmp, log->path, MOVEFILE_REPLACE_EXISTING);
+#else
+	ok = ok && !rename (tmp, log->path);
+#endif
+
+	if( ok )
+	  for( ; log->oldest < gen; log->oldest++ ) {
+		sprintf (tmp, "%s.%u", log->path, log->oldest);
+		remove (tmp);
+	  }
+
+	free (tmp);
+	return ok;
+}
+
+//	judy_stats: walk the tree and fill in a JudyStats
+//	with node counts and bytes by node type, bytes
+//	idle on the reuse lists by block size, memory
+//	segments, the number of keys reached through each
+//	number of nodes, and the fill of linear nodes.
+
+#define JUDY_levels 64	// depth histogram entries
+
+typedef struct {
+	JudySlot count[8];	// nodes by type, inner radix tables as JUDY_radix
+	JudySlot bytes[8];	// node bytes by type
+	JudySlot idle[8];	// bytes on each reuse list
+	JudySlot segs;		// memory segments, including a shared pool's
+	JudySlot memory;	// memory segment bytes
+	JudySlot keys;		// leaf cells
+	JudySlot depth[JUDY_levels];	// keys by nodes on their path, the last entry counts deeper keys
+	JudySlot slots;		// slots in linear nodes
+	JudySlot used;		// linear node slots in use
+	uint fill;			// percent of linear node slots in use
+} JudyStats;
+
+void judy_tally (JudyStats *stats, uint level)
+{
+	stats->keys++;
+	stats->depth[level < JUDY_levels ? level : JUDY_levels - 1]++;
+}
+
+void judy_census (Judy *judy, JudyStats *stats, JudySlot next, uint off, uint depth, uint level)
+{
+uint type = next & 0x07, size = JudySize[type];
+JudySlot *table, *inner;
+int slot, idx, cnt;
+uint keysize;
+JudySlot *node;
+uchar *base;
+
+	base = (uchar *)JUDY_addr(judy, next);
+	stats->count[type]++;
+	stats->bytes[type] += size;
+	level++;
+
+	switch( type ) {
+	case JUDY_1:
+	case JUDY_2:
+	case JUDY_4:
+	case JUDY_8:
+	case JUDY_16:
+	case JUDY_32:
+#ifdef ASKITIS
+	case JUDY_64:
+#endif
+		keysize = JUDY_key_size - (off & JUDY_key_mask);
+		node = (JudySlot *)(base + size);
+		cnt = size / (sizeof(JudySlot) + keysize);
+		stats->slots += cnt;
+
+		for( slot = 0; slot < cnt; slot++ ) {
+			if( !node[-slot-1] )
+				continue;
+
+			stats->used++;
+#if BYTE_ORDER != BIG_ENDIAN
+			if( !judy->depth && !base[slot * keysize] || judy->depth && depth + 1 == judy->depth )
+#else
+			if( !judy->depth && !base[slot * keysize + keysize - 1] || judy->depth && depth + 1 == judy->depth )
+#endif
+				judy_tally (stats, level);
+			else
+				judy_census (judy, stats, node[-slot-1], (off | JUDY_key_mask) + 1, depth + 1, level);
+		}
+
+		return;
+
+	case JUDY_radix:
+		off++;
+
+		if( judy->depth )
+		  if( !(off & JUDY_key_mask) )
+			depth++;
+
+		table = (JudySlot *)base;
+
+		for( idx = 0; idx < 16; idx++ ) {
+			if( !table[idx] )
+				continue;
+
+			stats->count[JUDY_radix]++;
+			stats->bytes[JUDY_radix] += JudySize[table[idx] & 0x07];
+
+			for( slot = 0; slot < 16; slot++ ) {
+				if( !(inner = judy_inner (judy, table[idx], slot)) || !*inner )
+					continue;
+
+				if( !judy->depth && !idx && !slot || judy->depth && depth == judy->depth )
+					judy_tally (stats, level);
+				else
+					judy_census (judy, stats, *inner, off, depth, level);
+			}
+		}
+
+		return;
+
+#ifndef ASKITIS
+	case JUDY_span:
+		node = (JudySlot *)(base + size);
+
+		if( judy->depth ) {		// bitmap leaf
+			for( slot = judy_bit (base, -1, 1); slot >= 0; slot = judy_bit (base, slot, 1) )
+				judy_tally (stats, level);
+		} else if( !base[JUDY_span_bytes - 1] )	// leaf node?
+			judy_tally (stats, level);
+		else
+			judy_census (judy, stats, node[-1], off + judy_spanlen (base), depth, level);
+
+		return;
+#endif
+	}
+}
+
+void judy_stats (Judy *judy, JudyStats *stats)
+{
+JudySeg *seg;
+void **block;
+uint type;
+
+	memset (stats, 0, sizeof(JudyStats));
+
+	if( *judy->root )
+		judy_census (judy, stats, *judy->root, 0, 0, 0);
+
+	for( type = 0; type < 8; type++ )
+	  for( block = judy->reuse[type]; block; block = *block )
+		stats->idle[type] += JudySize[type];
+
+	for( seg = judy->seg; seg; seg = seg->seg )
+		stats->segs++;
+
+	if( judy->pool )
+	  for( seg = judy->pool->seg; seg; seg = seg->seg )
+		stats->segs++;
+
+	stats->memory = stats->segs * judy->segsize;
+
+	if( stats->slots )
+		stats->fill = stats->used * 100 / stats->slots;
+}
+
+//	judy_rank: return the number of keys below the
+//	given key.  judy_select: return the cell of the
+//	key of the given rank, counting from zero, with
+//	the cursor stack set there, or NULL past the last
+//	key.  judy_count_prefix: return the number of keys
+//	starting with the given bytes, which for Integer
+//	keys are their bytes from the high order down.
+//	the first of these calls starts the array keeping
+//	the key counts below its larger nodes, updated by
+//	judy_cell and judy_del, so later calls take time
+//	in the depth of the tree.  clones count without
+//	keeping counts.
+
+void judy_counting (Judy *judy)
+{
+	if( !judy->counts && (judy->seg || judy->mapped) )
+	  if( (judy->counts = calloc (1, sizeof(JudyCounts) + 1023 * sizeof(JudyCount))) )
+		judy->counts->size = 1024;
+}
+
+//	keys below a tree pointer at key byte off, or
+//	below an inner radix table at outer slot idx
+
+JudySlot judy_count (Judy *judy, JudySlot next, uint off, uint depth, int idx)
+{
+JudySlot count = 0, *table, *inner, *node;
+JudyCount *entry;
+uint keysize, size;
+int slot, cnt;
+uchar *base;
+
+	if( judy->counts )
+	  if( (entry = judy_counted (judy->counts, JUDY_addr(judy, next)))->node )
+		return entry->count;
+
+	base = (uchar *)JUDY_addr(judy, next);
+	size = JudySize[next & 0x07];
+
+	if( idx >= 0 ) {		// inner radix table
+		for( slot = 0; slot < 16; slot++ )
+		  if( (inner = judy_inner (judy, next, slot)) && *inner )
+			if( !judy->depth && !idx && !slot || judy->depth && depth == judy->depth )
+				count++;
+			else
+				count += judy_count (judy, *inner, off, depth, -1);
+	} else
+	switch( next & 0x07 ) {
+	case JUDY_1:
+	case JUDY_2:
+	case JUDY_4:
+	case JUDY_8:
+	case JUDY_16:
+	case JUDY_32:
+#ifdef ASKITIS
+	case JUDY_64:
+#endif
+		keysize = JUDY_key_size - (off & JUDY_key_mask);
+		node = (JudySlot *)(base + size);
+		cnt = size / (sizeof(JudySlot) + keysize);
+
+		for( slot = 0; slot < cnt; slot++ )
+		  if( node[-slot-1] )
+			if( judy_ends (judy, base, slot, keysize, depth) )
+				count++;
+			else
+				count += judy_count (judy, node[-slot-1], (off | JUDY_key_mask) + 1, depth + 1, -1);
+		break;
+
+	case JUDY_radix:
+		off++;
+
+		if( judy->depth )
+		  if( !(off & JUDY_key_mask) )
+			depth++;
+
+		table = (JudySlot *)base;
+
+		for( idx = 0; idx < 16; idx++ )
+		  if( table[idx] )
+			count += judy_count (judy, table[idx], off, depth, idx);
+		break;
+
+#ifndef ASKITIS
+	case JUDY_span:
+		node = (JudySlot *)(base + size);
+
+		if( judy->depth )		// bitmap leaf
+			for( slot = 0; slot < 32; slot += sizeof(uint) )
+				count += JUDY_popcnt (*(uint *)(base + slot));
+		else if( !base[JUDY_span_bytes - 1] )	// leaf node?
+			count = 1;
+		else
+			count = judy_count (judy, node[-1], off + judy_spanlen (base), depth, -1);
+		break;
+#endif
+	}
+
+	if( judy->counts && count >= JUDY_countmin )
+		judy_setcount (judy, JUDY_addr(judy, next), count);
+
+	return count;
+}
+
+//	keys below the given key, whose Integers are
+//	in buff for an Integer array
+
+JudySlot judy_below (Judy *judy, uchar *buff, uint max)
+{
+judyvalue *src = (judyvalue *)buff;
+JudySlot next = *judy->root, rank = 0;
+JudySlot *table, *inner, *node;
+uint off = 0, depth = 0;
+int slot, cnt, idx, len;
+judyvalue value, test;
+uint keysize, size;
+uchar *base;
+
+	while( next ) {
+		base = (uchar *)JUDY_addr(judy, next);
+		size = JudySize[next & 0x07];
+
+		switch( next & 0x07 ) {
+		case JUDY_1:
+		case JUDY_2:
+		case JUDY_4:
+		case JUDY_8:
+		case JUDY_16:
+		case JUDY_32:
+#ifdef ASKITIS
+		case JUDY_64:
+#endif
+			keysize = JUDY_key_size - (off & JUDY_key_mask);
+			node = (JudySlot *)(base + size);
+			cnt = size / (sizeof(JudySlot) + keysize);
+			value = 0;
+
+			if( judy->depth )
+				value = src[depth] & JudyMask[keysize];
+			else
+			  for( len = off; len < (int)((off | JUDY_key_mask) + 1); len++ )
+				value = value << 8 | (len < (int)max ? buff[len] : 0);
+
+			//	count the keys in slots below the key's
+
+			for( slot = 0; slot < cnt; slot++ ) {
+				if( !node[-slot-1] )
+					continue;
+
+				if( (test = judy_test (base, slot, keysize)) >= value )
+					break;
+
+				if( judy_ends (judy, base, slot, keysize, depth) )
+					rank++;
+				else
+					rank += judy_count (judy, node[-slot-1], (off | JUDY_key_mask) + 1, depth + 1, -1);
+			}
+
+			if( slot == cnt || test > value || judy_ends (judy, base, slot, keysize, depth) )
+				return rank;
+
+			next = node[-slot-1];
+			off = (off | JUDY_key_mask) + 1;
+			depth++;
+			continue;
+
+		case JUDY_radix:
+			if( judy->depth )
+				slot = (src[depth] >> ((JUDY_key_size - (off + 1) & JUDY_key_mask) * 8)) & 0xff;
+			else
+				slot = off < max ? buff[off] : 0;
+
+			off++;
+
+			if( judy->depth )
+			  if( !(off & JUDY_key_mask) )
+				depth++;
+
+			table = (JudySlot *)base;
+
+			for( idx = 0; idx < slot >> 4; idx++ )
+			  if( table[idx] )
+				rank += judy_count (judy, table[idx], off, depth, idx);
+
+			if( !table[idx] )
+				return rank;
+
+			for( cnt = 0; cnt < (slot & 0x0F); cnt++ )
+			  if( (inner = judy_inner (judy, table[idx], cnt)) && *inner )
+				if( !judy->depth && !idx && !cnt || judy->depth && depth == judy->depth )
+					rank++;
+				else
+					rank += judy_count (judy, *inner, off, depth, -1);
+
+			if( !(inner = judy_inner (judy, table[idx], slot)) || !*inner )
+				return rank;
+
+			if( !judy->depth && !slot || judy->depth && depth == judy->depth )
+				return rank;	// the key itself
+
+			next = *inner;
+			continue;
+
+#ifndef ASKITIS
+		case JUDY_span:
+			node = (JudySlot *)(base + size);
+
+			if( judy->depth ) {		// bitmap leaf
+				for( idx = 0; idx < (uchar)src[depth]; idx++ )
+				  if( base[idx >> 3] & 1 << (idx & 7) )
+					rank++;
+				return rank;
+			}
+
+			if( !base[JUDY_span_bytes - 1] )	// leaf: compare the terminator too
+				len = (int)strlen ((char *)base) + 1;
+			else
+				len = judy_spanlen (base);
+
+			for( idx = 0; idx < len; idx++ )
+			  if( base[idx] != (off + idx < max ? buff[off + idx] : 0) ) {
+				if( base[idx] < (off + idx < max ? buff[off + idx] : 0) )
+				  if( !base[JUDY_span_bytes - 1] )
+					rank++;
+				  else
+					rank += judy_count (judy, node[-1], off + len, depth, -1);
+				return rank;
+			  }
+
+			if( !base[JUDY_span_bytes - 1] )
+				return rank;
+
+			next = node[-1];
+			off += len;
+			continue;
+#endif
+		}
+	}
+
+	return rank;
+}
+
+JudySlot judy_rank (Judy *judy, uchar *buff, uint max)
+{
+judyvalue bin[JUDY_binmax / JUDY_key_size];
+
+	judy_counting (judy);
+
+	if( judy->keylen )
+		buff = (uchar *)judy_pack (judy, bin, buff, max);
+
+	return judy_below (judy, buff, max);
+}
+
+//	count the keys from the prefix up to the prefix
+//	with its last byte below 0xff incremented
+
+JudySlot judy_count_prefix (Judy *judy, uchar *buff, uint max)
+{
+judyvalue *lo, *hi;
+JudySlot count;
+uchar *succ;
+uint len;
+
+	judy_counting (judy);
+
+	if( !(lo = malloc (2 * judy->depth * sizeof(judyvalue) + max + 1)) )
+		return 0;
+
+	hi = lo + judy->depth;
+	succ = (uchar *)(hi + judy->depth);
+	memcpy (succ, buff, max);
+
+	for( len = max; len && succ[len - 1] == 0xff; len-- );
+
+	if( len )
+		succ[len - 1]++;
+
+	if( judy->depth ) {
+		judy_pack (judy, lo, buff, max);
+		judy_pack (judy, hi, succ, len);
+		buff = (uchar *)lo;
+		succ = (uchar *)hi;
+	}
+
+	if( len )
+		count = judy_below (judy, succ, len);
+	else
+		count = *judy->root ? judy_count (judy, *judy->root, 0, 0, -1) : 0;
+
+	count -= judy_below (judy, buff, max);
+	free (lo);
+	return count;
+}
+
+JudySlot *judy_select (Judy *judy, JudySlot rank)
+{
+JudySlot next = *judy->root, count = 0;
+JudySlot *table, *inner, *node;
+uint off = 0, depth = 0;
+uint keysize, size;
+int slot, cnt, idx;
+int leaf = 0;
+uchar *base;
+
+	judy_counting (judy);
+	judy->level = 0;
+
+	if( !next || rank >= judy_count (judy, next, 0, 0, -1) )
+		return NULL;
+
+	while( next ) {
+		if( judy->level < judy->max )
+			judy->level++;
+
+		judy->stack[judy->level].off = off;
+		judy->stack[judy->level].next = next;
+		base = (uchar *)JUDY_addr(judy, next);
+		size = JudySize[next & 0x07];
+
+		switch( next & 0x07 ) {
+		case JUDY_1:
+		case JUDY_2:
+		case JUDY_4:
+		case JUDY_8:
+		case JUDY_16:
+		case JUDY_32:
+#ifdef ASKITIS
+		case JUDY_64:
+#endif
+			keysize = JUDY_key_size - (off & JUDY_key_mask);
+			node = (JudySlot *)(base + size);
+			cnt = size / (sizeof(JudySlot) + keysize);
+
+			for( slot = 0; slot < cnt; slot++ ) {
+				if( !node[-slot-1] )
+					continue;
+
+				if( (leaf = judy_ends (judy, base, slot, keysize, depth)) )
+					count = 1;
+				else
+					count = judy_count (judy, node[-slot-1], (off | JUDY_key_mask) + 1, depth + 1, -1);
+
+				if( rank < count )
+					break;
+
+				rank -= count;
+			}
+
+			if( slot == cnt )
+				return NULL;
+
+			judy->stack[judy->level].slot = slot;
+
+			if( leaf )
+				return &node[-slot-1];
+
+			next = node[-slot-1];
+			off = (off | JUDY_key_mask) + 1;
+			depth++;
+			continue;
+
+		case JUDY_radix:
+			off++;
+
+			if( judy->depth )
+			  if( !(off & JUDY_key_mask) )
+				depth++;
+
+			table = (JudySlot *)base;
+
+			for( idx = 0; idx < 16; idx++ )
+			  if( table[idx] )
+				if( rank < (count = judy_count (judy, table[idx], off, depth, idx)) )
+					break;
+				else
+					rank -= count;
+
+			if( idx == 16 )
+				return NULL;
+
+			for( slot = 0; slot < 16; slot++ ) {
+				if( !(inner = judy_inner (judy, table[idx], slot)) || !*inner )
+					continue;
+
+				if( (leaf = !judy->depth && !idx && !slot || judy->depth && depth == judy->depth) )
+					count = 1;
+				else
+					count = judy_count (judy, *inner, off, depth, -1);
+
+				if( rank < count )
+					break;
+
+				rank -= count;
+			}
+
+			if( slot == 16 )
+				return NULL;
+
+			judy->stack[judy->level].slot = idx << 4 | slot;
+
+			if( leaf )
+				return inner;
+
+			next = *inner;
+			continue;
+
+#ifndef ASKITIS
+		case JUDY_span:
+			node = (JudySlot *)(base + size);
+
+			if( judy->depth ) {		// bitmap leaf
+				for( slot = judy_bit (base, -1, 1); rank; rank-- )
+					slot = judy_bit (base, slot, 1);
+
+				judy->stack[judy->level].slot = slot;
+				return judy_bitcell (judy);
+			}
+
+			if( !base[JUDY_span_bytes - 1] )	// leaf node?
+				return &node[-1];
+
+			next = node[-1];
+			off += judy_spanlen (base);
+			continue;
+#endif
+		}
+	}
+
+	return NULL;
+}
+
+//	judy_compact: move the nodes out of the memory segments
+//	in use, shrinking linear nodes to fit their keys, and
+//	free those segments, leaving the free space behind.  segments holding judy_data memory stay.  the
+//	first call starts allocating from a new segment, and
+//	each call moves the nodes under keys in order from where
+//	the last one stopped.  with msecs non-zero a call stops
+//	after about that much cpu time.  the array can be used
+//	and changed between calls, but not by worker threads or
+//	in concurrent mode, which are not compacted.  returns
+//	the number of segments still to be freed, or zero when
+//	the compaction is done.
+
+int judy_segcmp (const void *a, const void *b)
+{
+uchar *x = *(uchar **)a, *y = *(uchar **)b;
+
+	return x < y ? -1 : x > y;
+}
+
+//	move the node at a stack level, or the inner tables
+//	of a radix node, out of the old segments.  linear
+//	nodes move into the smallest node holding their keys.
+
+void judy_move (Judy *judy, uint level)
+{
+JudySlot next = judy->stack[level].next;
+uint type = next & 0x07, keysize, size;
+uchar *base = (uchar *)(next & JUDY_mask);
+JudySlot *table, *inner, *node;
+int slot, cnt, idx;
+uchar *block;
+
+	if( judy_old (judy->compact, base) ) {
+	  size = type;
+
+	  if( type >= JUDY_1 && type <= JUDY_max ) {
+		keysize = JUDY_key_size - (judy->stack[level].off & JUDY_key_mask);
+		cnt = JudySize[type] / (sizeof(JudySlot) + keysize);
+		node = (JudySlot *)(base + JudySize[type]);
+
+		for( slot = 0; slot < cnt - 1; slot++ )
+		  if( node[-slot-1] )
+			break;
+
+		for( size = JUDY_1; JudySize[size] / (sizeof(JudySlot) + keysize) < cnt - slot; size++ );
+
+		idx = JudySize[size] / (sizeof(JudySlot) + keysize);
+		block = judy_alloc (judy, size);
+		memcpy (block + (idx - cnt + slot) * keysize, base + slot * keysize, (cnt - slot) * keysize);
+		memcpy ((JudySlot *)(block + JudySize[size]) - idx, node - cnt, (cnt - slot) * sizeof(JudySlot));
+		judy->stack[level].slot -= cnt - idx;
+	  } else {
+		block = judy_alloc (judy, type);
+		memcpy (block, base, JudySize[type]);
+	  }
+
+	  judy_movecount (judy, base, block);
+	  next = (JudySlot)block | size;
+	  *judy_parent (judy, level) = judy->stack[level].next = next;
+	}
+
+	if( type != JUDY_radix )
+		return;
+
+	table = (JudySlot *)(next & JUDY_mask);
+
+	for( idx = 0; idx < 16; idx++ )
+	  if( table[idx] && judy_old (judy->compact, (void *)(table[idx] & JUDY_mask)) ) {
+		inner = judy_alloc (judy, table[idx] & 0x07);
+		memcpy (inner, (void *)(table[idx] & JUDY_mask), JudySize[table[idx] & 0x07]);
+		judy_movecount (judy, (void *)(table[idx] & JUDY_mask), inner);
+		table[idx] = (JudySlot)inner | (table[idx] & 0x07);
+	  }
+}
+
+//	set aside the segments to empty and start a new one
+
+JudyCompact *judy_segments (Judy *judy)
+{
+JudySeg *seg, *nxt, *keep = NULL, *fresh;
+JudyCompact *compact;
+uint count = 0, type;
+
+	for( seg = judy->seg; seg; seg = seg->seg )
+		count += !seg->data;
+
+	if( judy->pool )
+	  for( seg = judy->pool->seg; seg; seg = seg->seg )
+		count += !seg->data;
+
+	if( !count )
+		return NULL;
+
+	if( !(fresh = judy_segalloc (judy->segsize, judy->segflags)) )
+		return NULL;
+
+	if( !(compact = malloc (sizeof(JudyCompact) + count * sizeof(JudySeg *) + (judy->max + 1) * sizeof(JudyStack) + judy->max + JUDY_key_size)) ) {
+		judy_segfree (fresh, judy->segsize, judy->segflags);
+		return NULL;
+	}
+
+	compact->old = (JudySeg **)(compact + 1);
+	compact->prev = (JudyStack *)(compact->old + count);
+	compact->key = (uchar *)(compact->prev + judy->max + 1);
+	compact->size = judy->segsize;
+	compact->resume = 0;
+	compact->count = 0;
+
+	//	segments with judy_data memory stay on the chain
+
+	for( nxt = judy->seg; (seg = nxt); )
+	  if( nxt = seg->seg, seg->data )
+		seg->seg = keep, keep = seg;
+	  else
+		compact->old[compact->count++] = seg;
+
+	if( judy->pool ) {
+	  for( nxt = judy->pool->seg; (seg = nxt); )
+		if( nxt = seg->seg, seg->data )
+		  seg->seg = keep, keep = seg;
+		else
+		  compact->old[compact->count++] = seg;
+
+	  judy->pool->seg = NULL;
+	  memset (judy->pool->reuse, 0, sizeof(judy->pool->reuse));
+	}
+
+	qsort (compact->old, count, sizeof(JudySeg *), judy_segcmp);
+
+	fresh->next = judy->segsize;
+	fresh->seg = keep;
+	fresh->data = 0;
+	fresh->next -= (JudySlot)fresh & (JUDY_cache_line - 1);
+	judy->seg = fresh;
+
+#if defined(STANDALONE) || defined(ASKITIS)
+	MaxMem += judy->segsize;
+#endif
+	//	free blocks in the old segments are dropped
+
+	for( type = 0; type < 8; type++ )
+		judy->reuse[type] = NULL, judy->cache[type] = 0;
+
+	return compact;
+}
+
+uint judy_compact (Judy *judy, uint msecs)
+{
+JudyCompact *compact = judy->compact;
+uint top = 0, cnt = 0, idx;
+clock_t start = clock();
+JudySlot *cell;
+
+	if( judy->epoch || judy->mapped || !judy->seg )
+		return 0;
+
+	//	the cell of the last judy_cell is about to move
+
+	if( judy->log )
+		judy_logready (judy);
+
+	if( !compact )
+	  if( !(compact = judy->compact = judy_segments (judy)) )
+		return 0;
+
+	if( compact->resume )
+		cell = judy_strt (judy, compact->key, judy->depth ? judy->depth * JUDY_key_size : compact->len);
+	else
+		cell = judy_strt (judy, NULL, 0);
+
+	while( cell ) {
+		//	levels unchanged since the previous key
+		//	have been moved already
+
+		for( idx = top < judy->level ? top : judy->level; idx; idx-- )
+		  if( compact->prev[idx].next == judy->stack[idx].next && compact->prev[idx].slot == judy->stack[idx].slot )
+			break;
+
+		while( ++idx <= judy->level ) {
+			judy_move (judy, idx);
+			compact->prev[idx] = judy->stack[idx];
+		}
+
+		top = judy->level;
+
+		if( msecs && !(++cnt & 1023) )
+		  if( clock() - start > (clock_t)msecs * CLOCKS_PER_SEC / 1000 ) {
+			compact->len = judy_key (judy, compact->key, judy->max);
+			compact->resume = 1;
+			return compact->count;
+		  }
+
+		cell = judy_nxt (judy);
+	}
+
+	while( compact->count )
+		judy_segfree (compact->old[--compact->count], compact->size, judy->segflags);
+
+	free (compact);
+	judy->compact = NULL;
+	judy->level = 0;
+	return 0;
+}
+
+#if defined(STANDALONE) || defined(ASKITIS)
+
+#if defined(__APPLE__) || defined(linux)
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/times.h>
+#include <aio.h>
+#else
+#include <windows.h>
+#include <io.h>
+#endif
+
+#include <time.h>
+
+//	memory map input file and sort
+
+//	define pennysort parameters
+
+uint PennyRecs = (4096 * 400);	// records to sort to temp files
+uint PennyLine = 100;			// length of input record
+uint PennyKey = 10;				// length of input key
+uint PennyOff = 0;				// key offset in input record
+uint PennyVar = 0;				// variable length records: lines, or after a length
+uint PennyHead = 0;				// bytes of the length before each record
+uint PennyThreads = 0;			// sort and merge threads, zero for one per cpu
+uint PennyPack = 1;				// temp file coding: 0 whole records, 1 key prefixes, 2 and lz blocks
+
+unsigned long long PennyMerge;	// PennyRecs * PennyLine, or PennyRecs bytes of variable records = file map length
+uint PennyMax;					// longest record
+uint PennyPasses;				// number of intermediate files created
+uint PennySortTime;				// cpu time to run sort
+uint PennyMergeTime;			// cpu time to run merge
+
+//	temp files are written in blocks of about PENNY_raw
+//	bytes of coded records, each decoded on its own,
+//	and indexed in memory by their first records
+
+#define PENNY_raw 65536			// coded bytes per temp file block
+
+typedef struct {
+	unsigned long long off;		// file offset of the block
+	unsigned long long first;	// record number of its first record
+	unsigned long long data;	// record bytes before the block
+} PennyBlock;
+
+typedef struct {
+	PennyBlock *block;			// the temp file's blocks
+	uchar *keys;				// the first key of each block, zero filled
+	uint count, max;			// blocks used and allocated
+	uint most;					// coded bytes of the largest block
+	uint longest;				// longest record
+	unsigned long long recs;	// records in the temp file
+	unsigned long long data;	// record bytes in the temp file
+	unsigned long long bytes;	// temp file length
+} PennyRun;
+
+//	chunks of the input file are claimed by the sort
+//	threads, each sorting its chunk into the temp
+//	file of the same number
+
+unsigned long long PennySize;	// input file length
+unsigned long long PennyNext;	// input offset of the next chunk
+uint PennyPage;					// input mapping alignment
+uint PennyRaw;					// block buffer bytes, at least PENNY_raw
+PennyRun *PennyRuns;			// block index of each temp file
+uint PennyChunk;				// next chunk to sort
+char PennyLock[1];				// latch for PennyChunk, PennyNext and PennyRuns
+char *PennyName;				// output file name
+unsigned long long PennyRead;	// temp file bytes read
+unsigned long long PennyWrite;	// temp and output file bytes written
+#if defined(_WIN32)
+HANDLE PennyMap;				// input file mapping
+#else
+int PennyFd;					// input file descriptor
+#endif
+
+typedef struct {
+	void *buff;		// record pointer in input file map
+	void *next;		// duplicate chain
+	uint len;		// record length
+} PennySort;
+
+//	the length of the variable record at rec
+
+uint penny_reclen (uchar *rec, uchar *end)
+{
+uint len = 0, idx;
+uchar *eol;
+
+	if( !PennyHead )
+		return (eol = memchr (rec, '\n', end - rec)) ? eol - rec + 1 : end - rec;
+
+	for( idx = PennyHead; idx--; )
+		len = len << 8 | rec[idx];
+
+	return PennyHead + len;
+}
+
+//	the key of a record: the PennyKey bytes at PennyOff
+//	of its data after the length, or the part of them
+//	before the end of a line
+
+uint penny_key (uchar *rec, uint len, uchar **key)
+{
+uint data = len - PennyHead;
+
+	*key = rec + PennyHead + PennyOff;
+
+	if( !PennyVar )
+		return PennyKey;
+
+	if( !PennyHead && data && rec[len - 1] == '\n' )
+		data--;
+
+	if( data <= PennyOff )
+		return 0;
+
+	return data - PennyOff < PennyKey ? data - PennyOff : PennyKey;
+}
+
+//	compare keys as zero filled to PennyKey bytes,
+//	as the judy arrays and the block index have them
+
+int penny_cmp (uchar *a, uint alen, uchar *b, uint blen)
+{
+int cmp = memcmp (a, b, alen < blen ? alen : blen);
+
+	if( cmp )
+		return cmp;
+
+	while( alen > blen )
+		if( a[--alen] )
+			return 1;
+
+	while( blen > alen )
+		if( b[--blen] )
+			return -1;
+
+	return 0;
+}
+
+#if defined(_WIN32)
+#define penny_seek(file, off) _fseeki64 (file, off, SEEK_SET)
+#else
+#define penny_seek(file, off) fseeko (file, off, SEEK_SET)
+#endif
+
+//	temp file i/o: each file has two aligned blocks, one
+//	filled or emptied by the caller while the other is
+//	read ahead or written behind, so the cpu only waits
+//	when the disk falls behind
+
+#define PENNY_align 4096		// block alignment
+#define PENNY_block (4096 * 1024)	// block bytes per thread
+
+typedef struct {
+#if defined(_WIN32)
+	HANDLE hndl;				// file opened for overlapped i/o
+	OVERLAPPED ovl[1];			// the block in flight
+#else
+	int fd;
+	struct aiocb aio[1];		// the block in flight
+#endif
+	uchar *block[2];			// block in use and block in flight
+	uint size;					// block bytes
+	uint used, fill;			// bytes taken from or put in the block in use
+	uint want;					// bytes of the block in flight
+	int cur, busy, write;		// block in use, a block in flight, a write file
+	unsigned long long off;		// file offset of the next block
+	unsigned long long left;	// bytes still to read
+	unsigned long long bytes;	// bytes read or written
+} PennyIo;
+
+unsigned long long penny_msecs (void)
+{
+#if defined(_WIN32)
+	return GetTickCount64 ();
+#else
+struct timespec now[1];
+
+	clock_gettime (CLOCK_MONOTONIC, now);
+	return (unsigned long long)now->tv_sec * 1000 + now->tv_nsec / 1000000;
+#endif
+}
+
+//	start the transfer of amt bytes of the block not in use
+
+void penny_start (PennyIo *io, uint amt)
+{
+uchar *buff = io->block[io->cur ^ 1];
+
+	io->want = amt;
+	io->busy = 1;
+#if defined(_WIN32)
+	memset (io->ovl, 0, sizeof(OVERLAPPED));
+	io->ovl->Offset = (DWORD)io->off;
+	io->ovl->OffsetHigh = (DWORD)(io->off >> 32);
+
+	if( io->write ? !WriteFile (io->hndl, buff, amt, NULL, io->ovl) : !ReadFile (io->hndl, buff, amt, NULL, io->ovl) )
+	  if( GetLastError() != ERROR_IO_PENDING )
+		fprintf (stderr, "temp file i/o error %d\n", GetLastError()), exit(1);
+#else
+	memset (io->aio, 0, sizeof(struct aiocb));
+	io->aio->aio_fildes = io->fd;
+	io->aio->aio_buf = buff;
+	io->aio->aio_nbytes = amt;
+	io->aio->aio_offset = io->off;
+
+	if( io->write ? aio_write (io->aio) : aio_read (io->aio) )
+		fprintf (stderr, "temp file i/o error %d\n", errno), exit(1);
+#endif
+	io->off += amt;
+}
+
+//	wait for the block in flight and return its bytes
+
+uint penny_wait (PennyIo *io)
+{
+#if defined(_WIN32)
+DWORD done;
+#else
+const struct aiocb *list[1];
+ssize_t done;
+#endif
+
+	if( !io->busy )
+		return 0;
+
+	io->busy = 0;
+#if defined(_WIN32)
+	if( !GetOverlappedResult (io->hndl, io->ovl, &done, TRUE) )
+	  if( io->write || GetLastError() != ERROR_HANDLE_EOF )
+		fprintf (stderr, "temp file i/o error %d\n", GetLastError()), exit(1);
+#else
+	list[0] = io->aio;
+
+	while( aio_error (io->aio) == EINPROGRESS )
+		aio_suspend (list, 1, NULL);
+
+	if( (done = aio_return (io->aio)) < 0 )
+		fprintf (stderr, "temp file i/o error %d\n", aio_error (io->aio)), exit(1);
+#endif
+	if( io->write && done != io->want )
+		fprintf (stderr, "temp file short write\n"), exit(1);
+
+	io->bytes += done;
+	return (uint)done;
+}
+
+//	read ahead the next block of the file's range
+
+void penny_fetch (PennyIo *io)
+{
+uint amt = io->left < io->size ? (uint)io->left : io->size;
+
+	if( amt )
+		penny_start (io, amt), io->left -= amt;
+}
+
+//	open a file to read len bytes from off, with write
+//	set to create a new file, or to two to write into
+//	an existing one from off, with blocks of about
+//	size bytes
+
+PennyIo *penny_open (char *name, int write, unsigned long long off, unsigned long long len, uint size)
+{
+PennyIo *io = calloc (1, sizeof(PennyIo));
+int idx;
+
+	if( !(io->size = size & ~(PENNY_align - 1)) )
+		io->size = PENNY_align;
+
+	for( idx = 0; idx < 2; idx++ )
+#if defined(_WIN32)
+	  if( !(io->block[idx] = _aligned_malloc (io->size, PENNY_align)) )
+#else
+	  if( posix_memalign ((void **)&io->block[idx], PENNY_align, io->size) )
+#endif
+		fprintf (stderr, "temp file buffer allocation failed\n"), exit(1);
+
+	io->write = write;
+	io->left = len;
+	io->off = off;
+
+#if defined(_WIN32)
+	io->hndl = CreateFile (name, write ? GENERIC_WRITE : GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE, NULL, write == 1 ? CREATE_ALWAYS : OPEN_EXISTING, FILE_FLAG_OVERLAPPED, NULL);
+
+	if( io->hndl == INVALID_HANDLE_VALUE )
+		fprintf (stderr, "unable to open %s error %d\n", name, GetLastError()), exit(1);
+#else
+	if( (io->fd = open (name, write == 1 ? O_WRONLY | O_CREAT | O_TRUNC : write ? O_WRONLY : O_RDONLY, 0664)) < 0 )
+		fprintf (stderr, "unable to open %s error %d\n", name, errno), exit(1);
+#endif
+
+	if( !write )
+		penny_fetch (io);
+
+	return io;
+}
+
+//	copy the next len bytes read into buff, returning
+//	fewer at the end of the range
+
+uint penny_read (PennyIo *io, uchar *buff, uint len)
+{
+uint amt, done = 0;
+
+	while( done < len ) {
+		if( io->used == io->fill ) {
+			io->used = 0;
+
+			if( !(io->fill = penny_wait (io)) )
+				break;		// the range is done
+
+			io->cur ^= 1;
+			penny_fetch (io);
+		}
+
+		if( (amt = io->fill - io->used) > len - done )
+			amt = len - done;
+
+		memcpy (buff + done, io->block[io->cur] + io->used, amt);
+		io->used += amt;
+		done += amt;
+	}
+
+	return done;
+}
+
+//	write the block in use behind the caller
+
+void penny_flush (PennyIo *io)
+{
+	penny_wait (io);
+	io->cur ^= 1;
+	penny_start (io, io->fill);
+	io->fill = 0;
+}
+
+void penny_put (PennyIo *io, uchar *buff, uint len)
+{
+uint amt;
+
+	while( len ) {
+		if( (amt = io->size - io->fill) > len )
+			amt = len;
+
+		memcpy (io->block[io->cur] + io->fill, buff, amt);
+		buff += amt, len -= amt;
+
+		if( (io->fill += amt) == io->size )
+			penny_flush (io);
+	}
+}
+
+//	finish the file's i/o and close it
+
+void penny_close (PennyIo *io)
+{
+	if( io->write && io->fill )
+		penny_flush (io);
+
+	penny_wait (io);
+
+	JUDY_lock (PennyLock);
+
+	if( io->write )
+		PennyWrite += io->bytes;
+	else
+		PennyRead += io->bytes;
+
+	JUDY_unlock (PennyLock);
+
+#if defined(_WIN32)
+	CloseHandle (io->hndl);
+	_aligned_free (io->block[0]);
+	_aligned_free (io->block[1]);
+#else
+	close (io->fd);
+	free (io->block[0]);
+	free (io->block[1]);
+#endif
+	free (io);
+}
+
+//	report the temp file i/o rate over a phase
+
+void penny_rate (char *phase, unsigned long long bytes, unsigned long long msecs)
+{
+	fprintf (stderr, "%s i/o %llu MB", phase, bytes >> 20);
+
+	if( msecs )
+		fprintf (stderr, " %.0f MB/s", bytes / 1048576. * 1000 / msecs);
+
+	fputc ('\n', stderr);
+}
+
+//	temp file coding.  each record is coded as the
+//	number of leading key bytes it shares with the
+//	previous record of the block, and then its other
+//	bytes.  with PennyPack 2 a block is then packed in
+//	the lz4 block style: a token byte of literal and
+//	match lengths, the literals, a two byte match
+//	offset, with lengths of 15 or more continued in
+//	bytes of 255.
+
+#define PENNY_hash 12			// bits of the lz match table
+
+uint penny_len (uchar *dst, uint out, uint len)
+{
+	while( len >= 255 )
+		dst[out++] = 255, len -= 255;
+
+	dst[out++] = len;
+	return out;
+}
+
+//	pack len bytes of src into dst, returning the packed
+//	length, or zero when it would not be shorter
+
+uint penny_lz (uchar *src, uint len, uchar *dst)
+{
+uint table[1 << PENNY_hash];
+uint pos = 0, anchor = 0, out = 0;
+uint ref, lit, match, seq, hash;
+
+	memset (table, 0, sizeof(table));
+
+	while( pos + 8 < len ) {
+		memcpy (&seq, src + pos, 4);
+		hash = seq * 2654435761U >> (32 - PENNY_hash);
+		ref = table[hash];
+		table[hash] = pos + 1;
+
+		if( !ref-- || pos - ref > 65535 || memcmp (src + ref, src + pos, 4) ) {
+			pos++;
+			continue;
+		}
+
+		for( match = 4; pos + match < len; match++ )
+			if( src[ref + match] != src[pos + match] )
+				break;
+
+		lit = pos - anchor;
+
+		if( out + lit + lit / 255 + match / 255 + 5 >= len )
+			return 0;
+
+		dst[out++] = (lit < 15 ? lit : 15) << 4 | (match - 4 < 15 ? match - 4 : 15);
+
+		if( lit >= 15 )
+			out = penny_len (dst, out, lit - 15);
+
+		memcpy (dst + out, src + anchor, lit);
+		out += lit;
+		dst[out++] = (uchar)(pos - ref);
+		dst[out++] = (uchar)((pos - ref) >> 8);
+
+		if( match - 4 >= 15 )
+			out = penny_len (dst, out, match - 4 - 15);
+
+		anchor = pos += match;
+	}
+
+	//	the last literals end the block
+
+	lit = len - anchor;
+
+	if( out + lit + lit / 255 + 2 >= len )
+		return 0;
+
+	dst[out++] = (lit < 15 ? lit : 15) << 4;
+
+	if( lit >= 15 )
+		out = penny_len (dst, out, lit - 15);
+
+	memcpy (dst + out, src + anchor, lit);
+	return out + lit;
+}
+
+void penny_unlz (uchar *src, uint len, uchar *dst)
+{
+uchar *end = src + len, *from;
+uint token, amt;
+
+	while( src < end ) {
+		token = *src++;
+
+		if( (amt = token >> 4) == 15 )
+			do amt += *src;
+			while( *src++ == 255 );
+
+		memcpy (dst, src, amt);
+		dst += amt, src += amt;
+
+		if( src == end )
+			break;
+
+		from = dst - (src[0] | src[1] << 8);
+		src += 2;
+
+		if( (amt = token & 15) == 15 )
+			do amt += *src;
+			while( *src++ == 255 );
+
+		for( amt += 4; amt--; )
+			*dst++ = *from++;
+	}
+}
+
+uint penny_varint (uchar *dst, uint out, uint val)
+{
+	while( val >= 128 )
+		dst[out++] = val | 128, val >>= 7;
+
+	dst[out++] = val;
+	return out;
+}
+
+uchar *penny_unvarint (uchar *src, uint *val)
+{
+uint shift = 0;
+
+	*val = 0;
+
+	do *val |= (*src & 127) << shift, shift += 7;
+	while( *src++ & 128 );
+
+	return src;
+}
+
+//	code a record after the previous key of the block,
+//	or the first record of a block with prev NULL.
+//	variable records also code their length.
+
+uint penny_code (uchar *dst, uchar *rec, uint len, uchar *prev, uint prevlen)
+{
+uint shared = 0, out, lead;
+uchar *key;
+uint klen;
+
+	klen = penny_key (rec, len, &key);
+
+	if( prev && PennyPack )
+	  while( shared < klen && shared < prevlen && key[shared] == prev[shared] )
+		shared++;
+
+	out = penny_varint (dst, 0, shared);
+
+	if( PennyVar )
+		out = penny_varint (dst, out, len);
+
+	if( (lead = PennyHead + PennyOff) > len )
+		lead = len;
+
+	memcpy (dst + out, rec, lead);
+	out += lead;
+	memcpy (dst + out, rec + lead + shared, len - lead - shared);
+	return out + len - lead - shared;
+}
+
+//	decode the record at src over the previous record
+//	in line, returning the next record's coding
+
+uchar *penny_decode (uchar *src, uchar *line, uint *len)
+{
+uint shared, lead;
+
+	src = penny_unvarint (src, &shared);
+
+	if( PennyVar )
+		src = penny_unvarint (src, len);
+	else
+		*len = PennyLine;
+
+	if( (lead = PennyHead + PennyOff) > *len )
+		lead = *len;
+
+	memcpy (line, src, lead);
+	src += lead;
+	memcpy (line + lead + shared, src, *len - lead - shared);
+	return src + *len - lead - shared;
+}
+
+//	block header: the bytes written and the bytes
+//	coded, equal when the block is not packed
+
+void penny_unpack (uint *hdr, uchar *pack, uchar *raw)
+{
+	if( hdr[0] < hdr[1] )
+		penny_unlz (pack, hdr[0], raw);
+	else
+		memcpy (raw, pack, hdr[1]);
+}
+
+//	the block of a temp file holding a record
+
+uint penny_blockof (PennyRun *run, unsigned long long rec)
+{
+uint low = 0, high = run->count, mid;
+
+	while( high - low > 1 ) {
+		mid = low + (high - low) / 2;
+
+		if( run->block[mid].first > rec )
+			high = mid;
+		else
+			low = mid;
+	}
+
+	return low;
+}
+
+//	temp file writer: codes records into a block and
+//	writes the block when the next record may not fit
+
+typedef struct {
+	PennyIo *io;		// the temp file
+	PennyRun *run;		// its block index
+	uchar *raw, *pack;	// block being coded and its packing
+	uchar *prev;		// previous key of the block
+	uint prevlen;		// and its length
+	uint fill;			// bytes coded
+	uint room;			// bytes of raw and pack
+} PennyWriter;
+
+void run_flush (PennyWriter *out)
+{
+PennyRun *run = out->run;
+uint hdr[2];
+
+	if( !out->fill )
+		return;
+
+	hdr[1] = out->fill;
+
+	if( run->most < out->fill )
+		run->most = out->fill;
+
+	if( PennyPack < 2 || !(hdr[0] = penny_lz (out->raw, out->fill, out->pack)) )
+		hdr[0] = out->fill;
+
+	penny_put (out->io, (uchar *)hdr, sizeof(hdr));
+	penny_put (out->io, hdr[0] < hdr[1] ? out->pack : out->raw, hdr[0]);
+	run->bytes += sizeof(hdr) + hdr[0];
+	out->fill = 0;
+}
+
+void run_put (PennyWriter *out, uchar *rec, uint len)
+{
+PennyRun *run = out->run;
+uint need = len + 10;
+uchar *key;
+uint klen;
+
+	if( out->fill && out->fill + need > PENNY_raw )
+		run_flush (out);
+
+	//	a record longer than a block gets a block to itself
+
+	if( need > out->room ) {
+		out->raw = realloc (out->raw, need);
+		out->pack = realloc (out->pack, need);
+		out->room = need;
+	}
+
+	klen = penny_key (rec, len, &key);
+
+	//	a new block goes in the index with its first key
+
+	if( !out->fill ) {
+		if( run->count == run->max ) {
+			run->max = run->max ? 2 * run->max : 64;
+			run->block = realloc (run->block, run->max * sizeof(PennyBlock));
+			run->keys = realloc (run->keys, run->max * PennyKey);
+		}
+
+		run->block[run->count].off = run->bytes;
+		run->block[run->count].first = run->recs;
+		run->block[run->count].data = run->data;
+		memset (run->keys + run->count * PennyKey, 0, PennyKey);
+		memcpy (run->keys + run->count++ * PennyKey, key, klen);
+	}
+
+	out->fill += penny_code (out->raw + out->fill, rec, len, out->fill ? out->prev : NULL, out->prevlen);
+	memcpy (out->prev, key, out->prevlen = klen);
+
+	if( run->longest < len )
+		run->longest = len;
+
+	run->data += len;
+	run->recs++;
+}
+
+PennyWriter *run_create (char *name, PennyRun *run)
+{
+PennyWriter *out = calloc (1, sizeof(PennyWriter));
+
+	out->io = penny_open (name, 1, 0, 0, PENNY_block);
+	out->raw = malloc (PENNY_raw);
+	out->pack = malloc (PENNY_raw);
+	out->room = PENNY_raw;
+	out->prev = malloc (PennyKey + 1);
+	out->run = run;
+	return out;
+}
+
+void run_close (PennyWriter *out)
+{
+	run_flush (out);
+	penny_close (out->io);
+	free (out->raw);
+	free (out->pack);
+	free (out->prev);
+	free (out);
+}
+
+//	temp file reader for a range of its records
+
+typedef struct {
+	PennyIo *io;		// the temp file
+	uchar *raw, *pack;	// decoded block and block as read
+	uchar *next, *end;	// coding of the next record in raw
+	uchar *line;		// the current record
+	uint len;			// and its length
+	unsigned long long left;	// records left in the range
+} PennyReader;
+
+//	return the next record of the range, or NULL
+//	at its end.  it stays in line until the next call.
+
+uchar *run_next (PennyReader *in)
+{
+uint hdr[2];
+
+	if( !in->left )
+		return NULL;
+
+	if( in->next == in->end ) {
+		if( penny_read (in->io, (uchar *)hdr, sizeof(hdr)) < sizeof(hdr) || penny_read (in->io, in->pack, hdr[0]) < hdr[0] )
+			fprintf (stderr, "temp file truncated\n"), exit(1);
+
+		penny_unpack (hdr, in->pack, in->raw);
+		in->next = in->raw;
+		in->end = in->raw + hdr[1];
+	}
+
+	in->next = penny_decode (in->next, in->line, &in->len);
+	in->left--;
+	return in->line;
+}
+
+PennyReader *run_open (char *name, PennyRun *run, unsigned long long first, unsigned long long last, uint size)
+{
+PennyReader *in = calloc (1, sizeof(PennyReader));
+uint idx = penny_blockof (run, first), end = penny_blockof (run, last - 1) + 1;
+unsigned long long skip;
+
+	in->raw = malloc (PennyRaw);
+	in->pack = malloc (PennyRaw);
+	in->line = malloc (PennyMax);
+	in->io = penny_open (name, 0, run->block[idx].off, (end < run->count ? run->block[end].off : run->bytes) - run->block[idx].off, size);
+	in->left = last - run->block[idx].first;
+
+	//	decode up to the range in the first block
+
+	for( skip = first - run->block[idx].first; skip--; )
+		run_next (in);
+
+	return in;
+}
+
+void run_finish (PennyReader *in)
+{
+	penny_close (in->io);
+	free (in->raw);
+	free (in->pack);
+	free (in->line);
+	free (in);
+}
+
+uint penny_cpus (void)
+{
+#if defined(_WIN32)
+SYSTEM_INFO info[1];
+
+	GetSystemInfo (info);
+	return info->dwNumberOfProcessors;
+#else
+long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+
+	return cpus > 0 ? cpus : 1;
+#endif
+}
+
+//	a chunk of the input file claimed by a sort thread
+
+typedef struct {
+	uint chunk;					// chunk and temp file number
+	uchar *map;					// the mapped window of the input
+	unsigned long long maplen;	// bytes mapped
+	uchar *base;				// the chunk's first record
+	unsigned long long len;		// the chunk's bytes
+} PennyPart;
+
+//	claim the next chunk of the input, mapping a window
+//	of PennyMerge bytes at its start.  a chunk of
+//	variable records ends with the last whole record
+//	in its window.  returns zero when none are left.
+
+int sort_claim (PennyPart *part)
+{
+unsigned long long start, offset;
+uchar *end, *rec;
+
+	JUDY_lock (PennyLock);
+
+	if( (start = PennyNext) >= PennySize ) {
+		JUDY_unlock (PennyLock);
+		return 0;
+	}
+
+	offset = start - start % PennyPage;
+	part->len = PennySize - start < PennyMerge ? PennySize - start : PennyMerge;
+	part->maplen = start - offset + part->len;
+
+#if defined(_WIN32)
+	part->map = MapViewOfFile( PennyMap, FILE_MAP_READ, offset >> 32, (DWORD)offset, part->maplen);
+	if( !part->map )
+		fprintf (stderr, "MapViewOfFile error %d\n", GetLastError()), exit(1);
+#else
+	part->map = mmap (NULL, part->maplen, PROT_READ,  MAP_SHARED, PennyFd, offset);
+
+	if( part->map == MAP_FAILED )
+		fprintf (stderr, "mmap error %d\n", errno), exit(1);
+
+	if( madvise (part->map, part->maplen, MADV_WILLNEED | MADV_SEQUENTIAL) < 0 )
+		fprintf (stderr, "madvise error %d\n", errno);
+#endif
+	part->base = part->map + (start - offset);
+	end = part->base + part->len;
+
+	//	lines end after the window's last newline, unless
+	//	it ends the file, and records after a length
+	//	end where the next one would not fit
+
+	if( PennyVar && !PennyHead && start + part->len < PennySize ) {
+		while( end > part->base && end[-1] != '\n' )
+			end--;
+	} else if( PennyHead ) {
+		for( rec = part->base; end - rec >= PennyHead && penny_reclen (rec, end) <= (uint)(end - rec); )
+			rec += penny_reclen (rec, end);
+
+		if( rec < end && start + part->len == PennySize )
+			fprintf (stderr, "last record is cut short\n"), exit(1);
+
+		end = rec;
+	}
+
+	if( end == part->base )
+		fprintf (stderr, "record longer than %llu byte sort chunk\n", PennyMerge), exit(1);
+
+	part->len = end - part->base;
+	PennyNext = start + part->len;
+	part->chunk = PennyChunk++;
+	JUDY_unlock (PennyLock);
+	return 1;
+}
+
+//	sort one chunk of the input file into its temp file
+
+void sort_chunk (PennyPart *part)
+{
+uchar *rec, *key, *tail = NULL;
+unsigned long long off;
+char filename[512];
+PennyRun run[1];
+PennySort *line;
+JudySlot *cell;
+PennyWriter *out;
+void *judy;
+uint len, klen;
+
+	judy = judy_open (PennyKey, 0);
+	memset (run, 0, sizeof(run));
+
+	//	build judy array from mapped input chunk
+
+	for( off = 0; off < part->len; off += len ) {
+	  rec = part->base + off;
+	  len = PennyVar ? penny_reclen (rec, part->base + part->len) : PennyLine;
+
+	  //	the file's last line gets its newline
+
+	  if( PennyVar && !PennyHead && rec[len - 1] != '\n' ) {
+		tail = malloc (len + 1);
+		memcpy (tail, rec, len);
+		tail[len] = '\n';
+		rec = tail;
+	  }
+
+	  line = judy_data (judy, sizeof(PennySort));
+	  klen = penny_key (rec, len, &key);
+	  cell = judy_cell (judy, key, klen);
+	  line->next = *(void **)cell;
+	  line->buff = rec;
+	  line->len = len + (rec == tail);
+
+	  *(PennySort **)cell = line;
+	}
+
+	sprintf (filename, "%s.%d", PennyName, part->chunk);
+	out = run_create (filename, run);
+
+#ifndef _WIN32
+	if( madvise (part->map, part->maplen, MADV_WILLNEED | MADV_RANDOM) < 0 )
+		fprintf (stderr, "madvise error %d\n", errno);
+#endif
+
+	//	write judy array in sorted order to temporary file
+
+	cell = judy_strt (judy, NULL, 0);
+
+	if( cell ) do {
+		line = *(PennySort **)cell;
+		do run_put (out, line->buff, line->len);
+		while( line = line->next );
+	} while( cell = judy_nxt (judy) );
+
+#if defined(_WIN32)
+	UnmapViewOfFile (part->map);
+#else
+	munmap (part->map, part->maplen);
+#endif
+	judy_close (judy);
+	run_close (out);
+	free (tail);
+
+	//	file the run's index under its chunk number
+
+	JUDY_lock (PennyLock);
+
+	if( part->chunk >= PennyPasses ) {
+		PennyRuns = realloc (PennyRuns, (2 * part->chunk + 2) * sizeof(PennyRun));
+		memset (PennyRuns + PennyPasses, 0, (2 * part->chunk + 2 - PennyPasses) * sizeof(PennyRun));
+		PennyPasses = 2 * part->chunk + 2;
+	}
+
+	PennyRuns[part->chunk] = *run;
+	JUDY_unlock (PennyLock);
+}
+
+//	sort thread: take chunks until none are left,
+//	so one thread writes its temp file while the
+//	others build their judy arrays
+
+#ifdef _WIN32
+DWORD WINAPI sort_chunks (void *arg)
+#else
+void *sort_chunks (void *arg)
+#endif
+{
+PennyPart part[1];
+
+	while( sort_claim (part) )
+		sort_chunk (part);
+
+	return 0;
+}
+
+void sort (FILE *infile, char *outname)
+{
+int ifd = fileno (infile);
+uint idx, threads;
+#if defined(_WIN32)
+HANDLE *thread;
+HANDLE hndl;
+DWORD hiword;
+FILETIME dummy[1];
+FILETIME user[1];
+SYSTEM_INFO info[1];
+#else
+pthread_t *thread;
+struct tms buff[1];
+#endif
+unsigned long long msecs = penny_msecs ();
+time_t start = time(NULL);
+
+  if( !PennyVar && PennyOff + PennyKey > PennyLine )
+	fprintf (stderr, "Key Offset + Key Length > Record Length\n"), exit(1);
+
+  PennyName = outname;
+  PennyChunk = 0;
+  PennyNext = 0;
+  PennyMax = PennyLine;
+
+#if defined(_WIN32)
+  hndl = (HANDLE)_get_osfhandle(ifd);
+  PennySize = GetFileSize (hndl, &hiword);
+  PennyMap = CreateFileMapping(hndl, NULL, PAGE_READONLY, hiword, (DWORD)PennySize, NULL);
+  if( !PennyMap )
+	fprintf (stderr, "CreateFileMapping error %d\n", GetLastError()), exit(1);
+  PennySize |= (unsigned long long)hiword << 32;
+  GetSystemInfo (info);
+  PennyPage = info->dwAllocationGranularity;
+#else
+  PennyFd = ifd;
+  PennySize = lseek (ifd, 0L, 2);
+  PennyPage = sysconf (_SC_PAGESIZE);
+#endif
+
+  //	variable records end their chunks early, so the
+  //	number of runs is known after the sort threads finish
+
+  PennyPasses = (uint)((PennySize + PennyMerge - 1) / PennyMerge);
+  PennyRuns = calloc (PennyPasses + 1, sizeof(PennyRun));
+
+  if( !PennyThreads )
+	PennyThreads = penny_cpus ();
+
+  threads = PennyThreads < PennyPasses ? PennyThreads : PennyPasses;
+  thread = calloc (threads + 1, sizeof(*thread));
+
+  for( idx = 0; idx < threads; idx++ )
+#ifdef _WIN32
+	thread[idx] = CreateThread (NULL, 0, sort_chunks, NULL, 0, NULL);
+#else
+	pthread_create (thread + idx, NULL, sort_chunks, NULL);
+#endif
+
+  for( idx = 0; idx < threads; idx++ ) {
+#ifdef _WIN32
+	WaitForSingleObject (thread[idx], INFINITE);
+	CloseHandle (thread[idx]);
+#else
+	pthread_join (thread[idx], NULL);
+#endif
+  }
+
+  free (thread);
+  PennyPasses = PennyChunk;
+  PennyRaw = PENNY_raw;
+
+  //	size the merge buffers for the largest coded block
+
+  for( idx = 0; idx < PennyPasses; idx++ ) {
+	if( PennyRuns[idx].most > PennyRaw )
+		PennyRaw = PennyRuns[idx].most;
+	if( PennyRuns[idx].longest > PennyMax )
+		PennyMax = PennyRuns[idx].longest;
+  }
+
+  fprintf (stderr, "End Sort %d secs", time(NULL) - start);
+#if defined(_WIN32)
+  CloseHandle (PennyMap);
+  GetProcessTimes (GetCurrentProcess(), dummy, dummy, dummy, user);
+  PennySortTime = *(unsigned long long*)user / 10000000;
+#else
+  times (buff);
+  PennySortTime = buff->tms_utime/100;
+#endif
+  fprintf (stderr, " Cpu %d\n", PennySortTime);
+  penny_rate ("Sort", PennyWrite, penny_msecs () - msecs);
+}
+
+//	the merge splits the key space into one range for
+//	each thread, which merges the range's records from
+//	every temp file into its own part of the output file
+
+typedef struct {
+	unsigned long long *first;	// first record of the range in each temp file
+	unsigned long long *last;	// record after the range in each temp file
+	unsigned long long out;		// output file offset of the range, its record bytes before
+} PennyRange;
+
+//	merge the runs through a judy array of their
+//	current keys, with the runs holding equal keys
+//	chained from the key's cell
+
+void merge_judy (PennyReader **in, PennyIo *out)
+{
+JudySlot *cell;
+uint nxt, idx;
+uchar **line;
+uchar *key;
+uint klen;
+uint *next;
+void *judy;
+
+	next = calloc (PennyPasses + 1, sizeof(uint));
+	line = calloc (PennyPasses, sizeof(void *));
+	judy = judy_open (PennyKey, 0);
+
+	// initialize merge with one record from each temp file
+
+	for( idx = 0; idx < PennyPasses; idx++ )
+	  if( in[idx] && (line[idx] = run_next (in[idx])) ) {
+		klen = penny_key (line[idx], in[idx]->len, &key);
+		cell = judy_cell (judy, key, klen);
+		next[idx + 1] = *(uint *)cell;
+		*cell = idx + 1;	
+	  }
+
+	//	output records, replacing smallest each time
+
+	while( cell = judy_strt (judy, NULL, 0) ) {
+		nxt = *(uint *)cell;
+		judy_del (judy); 
+
+		// process duplicates
+
+		while( idx = nxt ) {
+			nxt = next[idx--];
+			penny_put (out, line[idx], in[idx]->len);
+
+			if( line[idx] = run_next (in[idx]) ) {
+				klen = penny_key (line[idx], in[idx]->len, &key);
+				cell = judy_cell (judy, key, klen);
+				next[idx + 1] = *(uint *)cell;
+				*cell = idx + 1;	
+			} else
+				next[idx + 1] = 0;
+		}
+	}
+
+	judy_close (judy);
+	free (line);
+	free (next);
+}
+
+//	does run a's current record go before run b's?
+//	equal keys go in run order, and used up runs last
+
+int merge_less (PennyReader **in, uchar **head, uint a, uint b)
+{
+uchar *akey, *bkey;
+uint alen, blen;
+int cmp;
+
+	if( !head[a] || !head[b] )
+		return head[a] != NULL;
+
+	if( !PennyVar ) {
+		cmp = memcmp (head[a] + PennyOff, head[b] + PennyOff, PennyKey);
+		return cmp < 0 || !cmp && a < b;
+	}
+
+	alen = penny_key (head[a], in[a]->len, &akey);
+	blen = penny_key (head[b], in[b]->len, &bkey);
+	cmp = penny_cmp (akey, alen, bkey, blen);
+	return cmp < 0 || !cmp && a < b;
+}
+
+//	merge the runs through a loser tree.  the runs are
+//	the leaves runs thru 2 * runs - 1, and each inner
+//	node keeps the run that lost the match played there,
+//	so replacing the output record replays only the
+//	matches on its run's path to the root.
+
+void merge_tree (PennyReader **in, PennyIo *out)
+{
+uint runs = PennyPasses, node, run, idx;
+uint *tree, *win;
+uchar **head;
+
+	if( !runs )		// an empty input file
+		return;
+
+	head = calloc (runs, sizeof(void *));
+	tree = calloc (runs, sizeof(uint));
+	win = calloc (2 * runs, sizeof(uint));
+
+	for( idx = 0; idx < runs; idx++ ) {
+		if( in[idx] )
+			head[idx] = run_next (in[idx]);
+		win[runs + idx] = idx;
+	}
+
+	//	play the first matches bottom up
+
+	for( node = runs; --node; )
+	  if( merge_less (in, head, win[2 * node], win[2 * node + 1]) )
+		win[node] = win[2 * node], tree[node] = win[2 * node + 1];
+	  else
+		win[node] = win[2 * node + 1], tree[node] = win[2 * node];
+
+	run = win[1];
+	free (win);
+
+	//	output the winner's record and replay its path
+
+	while( head[run] ) {
+		penny_put (out, head[run], in[run]->len);
+		head[run] = run_next (in[run]);
+
+		for( node = (runs + run) / 2; node; node /= 2 )
+		  if( merge_less (in, head, tree[node], run) )
+			idx = tree[node], tree[node] = run, run = idx;
+	}
+
+	free (head);
+	free (tree);
+}
+
+//	merge one key range of the temp files, through a
+//	loser tree, or compiled with -D JUDYMERGE through
+//	a judy array for comparison.  each run's next block
+//	is read while the current one is merged.
+
+void merge_range (PennyRange *range)
+{
+char filename[512];
+PennyReader **in;
+PennyIo *out;
+uint size;
+uint idx;
+
+	in = calloc (PennyPasses, sizeof(void *));
+
+	//	share the read buffer space between the threads
+
+	if( (size = PENNY_block / PennyThreads) < 65536 )
+		size = 65536;
+
+	out = penny_open (PennyName, 2, range->out, 0, PENNY_block);
+
+	for( idx = 0; idx < PennyPasses; idx++ ) {
+		if( range->last[idx] == range->first[idx] )
+			continue;
+
+		sprintf (filename, "%s.%d", PennyName, idx);
+		in[idx] = run_open (filename, PennyRuns + idx, range->first[idx], range->last[idx], size);
+	}
+
+#ifdef JUDYMERGE
+	merge_judy (in, out);
+#else
+	merge_tree (in, out);
+#endif
+
+	for( idx = 0; idx < PennyPasses; idx++ )
+	  if( in[idx] )
+		run_finish (in[idx]);
+
+	penny_close (out);
+	free (in);
+}
+
+#ifdef _WIN32
+DWORD WINAPI merger (void *arg)
+#else
+void *merger (void *arg)
+#endif
+{
+	merge_range (arg);
+	return 0;
+}
+
+//	find the first record of a temp file whose key is
+//	not below the given key, in the block the index
+//	gives for it, and the record bytes before it
+
+unsigned long long merge_find (FILE *in, PennyRun *run, uchar *key, uchar *pack, uchar *raw, uchar *line, unsigned long long *data)
+{
+uint low = 0, high = run->count, mid;
+unsigned long long rec;
+uchar *next, *end, *lkey;
+uint hdr[2], len, klen;
+
+	while( low < high ) {
+		mid = low + (high - low) / 2;
+
+		if( memcmp (run->keys + mid * PennyKey, key, PennyKey) < 0 )
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	//	it is the first record of block low,
+	//	or in the block before
+
+	if( !low-- )
+		return *data = 0;
+
+	penny_seek (in, run->block[low].off);
+	fread (hdr, sizeof(hdr), 1, in);
+	fread (pack, hdr[0], 1, in);
+	penny_unpack (hdr, pack, raw);
+
+	rec = run->block[low].first;
+	*data = run->block[low].data;
+
+	for( next = raw, end = raw + hdr[1]; next < end; rec++ ) {
+		next = penny_decode (next, line, &len);
+		klen = penny_key (line, len, &lkey);
+
+		if( penny_cmp (lkey, klen, key, PennyKey) >= 0 )
+			break;
+
+		*data += len;
+	}
+
+	return rec;
+}
+
+int merge (FILE *out, char *outname)
+{
+unsigned long long msecs = penny_msecs (), written = PennyWrite;
+time_t start = time(NULL);
+unsigned long long total, seen, want, recs, from, at;
+uchar *split, *pack, *raw, *line;
+uint idx, run, threads;
+PennyRange *range;
+char filename[512];
+JudySlot *cell;
+void *judy;
+FILE *in;
+#ifdef _WIN32
+HANDLE *thread;
+#else
+pthread_t *thread;
+#endif
+
+	threads = PennyThreads;
+
+	range = calloc (threads, sizeof(PennyRange));
+	split = calloc (threads + 1, PennyKey + 1);
+	pack = malloc (PennyRaw);
+	raw = malloc (PennyRaw);
+	line = malloc (PennyMax);
+
+	//	choose range splitting keys from the first
+	//	keys of the temp file blocks, each counting
+	//	for the records of its block
+
+	judy = judy_open (PennyKey, 0);
+	total = 0;
+
+	for( run = 0; run < PennyPasses; run++ )
+	  for( idx = 0; idx < PennyRuns[run].count; idx++ ) {
+		recs = idx + 1 < PennyRuns[run].count ? PennyRuns[run].block[idx + 1].first : PennyRuns[run].recs;
+		recs -= PennyRuns[run].block[idx].first;
+		*judy_cell (judy, PennyRuns[run].keys + idx * PennyKey, PennyKey) += recs;
+		total += recs;
+	  }
+
+	seen = 0;
+	idx = 1;
+
+	if( cell = judy_strt (judy, NULL, 0) ) do {
+		want = total * idx / threads;
+
+		if( idx < threads && seen >= want )
+			judy_key (judy, split + idx++ * (PennyKey + 1), PennyKey + 1);
+
+		seen += *cell;
+	} while( cell = judy_nxt (judy) );
+
+	judy_close (judy);
+
+	//	with fewer distinct sampled keys than threads
+	//	the ranges past the last key are left empty
+
+	for( ; idx < threads; idx++ )
+		memset (split + idx * (PennyKey + 1), 0xff, PennyKey);
+
+	//	find each range's records in every temp file,
+	//	and its place in the output file
+
+	for( idx = 0; idx < threads; idx++ ) {
+		range[idx].first = calloc (PennyPasses + 1, sizeof(unsigned long long));
+		range[idx].last = calloc (PennyPasses + 1, sizeof(unsigned long long));
+	}
+
+	for( run = 0; run < PennyPasses; run++ ) {
+		sprintf (filename, "%s.%d", outname, run);
+		in = fopen (filename, "rb");
+		from = 0;
+
+		for( idx = 0; idx < threads; idx++ ) {
+			range[idx].first[run] = idx ? range[idx - 1].last[run] : 0;
+			range[idx].out += from;
+
+			if( idx < threads - 1 )
+				range[idx].last[run] = merge_find (in, PennyRuns + run, split + (idx + 1) * (PennyKey + 1), pack, raw, line, &at);
+			else
+				range[idx].last[run] = PennyRuns[run].recs, at = PennyRuns[run].data;
+
+			if( range[idx].last[run] < range[idx].first[run] )
+				range[idx].last[run] = range[idx].first[run], at = from;
+
+			from = at;
+		}
+
+		fclose (in);
+	}
+
+	//	the range threads write through their own
+	//	file handles
+
+	fflush (out);
+	thread = calloc (threads, sizeof(*thread));
+
+	for( idx = 0; idx < threads; idx++ )
+#ifdef _WIN32
+		thread[idx] = CreateThread (NULL, 0, merger, range + idx, 0, NULL);
+#else
+		pthread_create (thread + idx, NULL, merger, range + idx);
+#endif
+
+	for( idx = 0; idx < threads; idx++ ) {
+#ifdef _WIN32
+		WaitForSingleObject (thread[idx], INFINITE);
+		CloseHandle (thread[idx]);
+#else
+		pthread_join (thread[idx], NULL);
+#endif
+		free (range[idx].first);
+		free (range[idx].last);
+	}
+
+	free (thread);
+	free (range);
+	free (split);
+	free (pack);
+	free (raw);
+	free (line);
+
+	for( run = 0; run < PennyPasses; run++ ) {
+		free (PennyRuns[run].block);
+		free (PennyRuns[run].keys);
+	}
+
+	free (PennyRuns);
+
+	fprintf (stderr, "End Merge %d secs", time(NULL) - start);
+#ifdef _WIN32
+	{
+	FILETIME dummy[1];
+	FILETIME user[1];
+		GetProcessTimes (GetCurrentProcess(), dummy, dummy, dummy, user);
+		PennyMergeTime = *(unsigned long long*)user / 10000000;
+	}
+#else
+	{
+	struct tms buff[1];
+		times (buff);
+		PennyMergeTime = buff->tms_utime/100;
+	}
+#endif
+	fprintf (stderr, " Cpu %d\n", PennyMergeTime - PennySortTime);
+	penny_rate ("Merge", PennyRead + PennyWrite - written, penny_msecs () - msecs);
+	fclose (out);
+	return 0;
+}
+
+#ifdef SEARCHBENCH
+//	compare the scalar and vector linear node searches
+//	on full nodes of each size and key width
+
+//	compilation:
+//	cc -O3 -D STANDALONE -D SEARCHBENCH judy64.c
+
+void search_bench (void)
+{
+int type, keysize, cnt, slot, idx, loops, found;
+judyvalue keys[64], probe[1024], value;
+clock_t start, linear, vector;
+uchar *base;
+
+	base = malloc (JudySize[JUDY_max]);
+
+	fprintf (stderr, "node   keysize slots  linear ns  vector ns\n");
+
+	for( type = JUDY_1; type <= JUDY_max; type++ )
+	  for( keysize = 1; keysize <= JUDY_key_size; keysize <<= 1 ) {
+		cnt = JudySize[type] / (sizeof(JudySlot) + keysize);
+		memset (base, 0, JudySize[type]);
+
+		//	fill the node with ascending random keys
+
+		for( slot = 0; slot < cnt; slot++ ) {
+			value = (judyvalue)rand() << 32 | rand();
+			keys[slot] = value & JudyMask[keysize];
+		}
+
+		for( slot = 1; slot < cnt; slot++ )
+		  for( idx = slot; idx && keys[idx - 1] > keys[idx]; idx-- )
+			value = keys[idx], keys[idx] = keys[idx - 1], keys[idx - 1] = value;
+
+		for( slot = 0; slot < cnt; slot++ )
+		  for( idx = 0, value = keys[slot]; idx < keysize; idx++, value >>= 8 )
+#if BYTE_ORDER != BIG_ENDIAN
+			base[slot * keysize + idx] = (uchar)value;
+#else
+			base[slot * keysize + keysize - idx - 1] = (uchar)value;
+#endif
+
+		//	probe with a mix of present and absent keys
+
+		for( idx = 0; idx < 1024; idx++ )
+		  if( idx & 1 )
+			probe[idx] = keys[rand() % cnt];
+		  else
+			probe[idx] = ((judyvalue)rand() << 32 | rand()) & JudyMask[keysize];
+
+		for( idx = 0; idx < 1024; idx++ )
+		  if( judy_linear (base, cnt, keysize, probe[idx]) != JudySearch (base, cnt, keysize, probe[idx]) )
+			judy_abort ("vector search mismatch");
+
+		loops = 4096;
+		found = 0;
+
+		start = clock();
+		for( slot = 0; slot < loops; slot++ )
+		  for( idx = 0; idx < 1024; idx++ )
+			found += judy_linear (base, cnt, keysize, probe[idx]);
+		linear = clock() - start;
+
+		start = clock();
+		for( slot = 0; slot < loops; slot++ )
+		  for( idx = 0; idx < 1024; idx++ )
+			found -= JudySearch (base, cnt, keysize, probe[idx]);
+		vector = clock() - start;
+
+		fprintf (stderr, "JUDY_%-2d %6d %5d %10.2f %10.2f%s\n", 1 << (type - 1), keysize, cnt,
+			linear * 1e9 / CLOCKS_PER_SEC / loops / 1024, vector * 1e9 / CLOCKS_PER_SEC / loops / 1024,
+			found ? " mismatch" : "");
+	  }
+
+	free (base);
+}
+#endif
+
+#ifdef LINEBENCH
+//	compare lookups in arrays opened with and without
+//	JUDY_lines: cache lines each lookup touches, counted
+//	from the path on the judy stack, and L1 data cache
+//	misses from the linux performance counters
+
+//	compilation:
+//	cc -O3 -D STANDALONE -D LINEBENCH judy64.c
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#endif
+
+#define LINEBENCH_keys 1000000
+
+//	count the cache lines read by the last lookup:
+//	the keys of each linear node, and the pointer
+//	to the next node or cell, the two radix table
+//	slots, or the span bytes and pointer
+
+uint line_path (Judy *judy)
+{
+JudySlot first, last, ptr, addr;
+uint level, lines = 0;
+int size, keysize, cnt;
+JudyStack *stack;
+
+	for( level = 1; level <= judy->level; level++ ) {
+	  stack = judy->stack + level;
+	  addr = JUDY_addr(judy, stack->next);
+	  size = JudySize[stack->next & 0x07];
+
+	  switch( stack->next & 0x07 ) {
+	  case JUDY_radix:
+		lines += 2;
+		continue;
+#ifndef ASKITIS
+	  case JUDY_span:
+		lines += (addr + size - 1) / JUDY_line - addr / JUDY_line + 1;
+		continue;
+#endif
+	  default:
+		keysize = JUDY_key_size - (stack->off & JUDY_key_mask);
+		cnt = size / (sizeof(JudySlot) + keysize);
+		first = addr / JUDY_line;
+		last = (addr + cnt * keysize - 1) / JUDY_line;
+		ptr = (addr + size - (stack->slot + 1) * sizeof(JudySlot)) / JUDY_line;
+		lines += last - first + 1 + (ptr > last);
+	  }
+	}
+
+	return lines;
+}
+
+int line_counter (void)
+{
+#ifdef __linux__
+struct perf_event_attr attr[1];
+
+	memset (attr, 0, sizeof(attr));
+	attr->type = PERF_TYPE_HW_CACHE;
+	attr->size = sizeof(attr);
+	attr->config = PERF_COUNT_HW_CACHE_L1D | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+	attr->disabled = 1;
+	attr->exclude_kernel = 1;
+	attr->exclude_hv = 1;
+	return syscall (__NR_perf_event_open, attr, 0, -1, -1, 0);
+#else
+	return -1;
+#endif
+}
+
+void line_bench (void)
+{
+uchar *keys = malloc (LINEBENCH_keys * 16);
+uint *order = malloc (LINEBENCH_keys * sizeof(uint));
+int layout, depth, fd = line_counter ();
+unsigned long long misses, lines;
+uint idx, len, swap;
+JudyStats stats[1];
+clock_t start;
+double nsecs;
+Judy *judy;
+
+	//	random 8 byte integers, or strings of 4 to 15 letters
+
+	fprintf (stderr, "keys     layout    ns/lookup  lines/lookup  L1D misses/lookup  segments\n");
+
+	for( depth = 1; depth >= 0; depth-- ) {
+	  for( idx = 0; idx < LINEBENCH_keys; idx++ ) {
+		if( depth ) {
+		  for( len = 0; len < 8; len++ )
+			keys[idx * 16 + len] = rand();
+		  continue;
+		}
+
+		len = 4 + rand() % 12;
+		keys[idx * 16 + len] = 0;
+
+		while( len-- )
+			keys[idx * 16 + len] = 'a' + rand() % 26;
+	  }
+
+	  for( idx = 0; idx < LINEBENCH_keys; idx++ )
+		order[idx] = idx;
+
+	  for( idx = LINEBENCH_keys; --idx; ) {
+		len = rand() % (idx + 1);
+		swap = order[idx], order[idx] = order[len], order[len] = swap;
+	  }
+
+	  for( layout = 0; layout < 2; layout++ ) {
+		judy = judy_open_seg (16, depth, JUDY_seg, layout ? JUDY_lines : 0);
+
+		for( idx = 0; idx < LINEBENCH_keys; idx++ )
+		  *judy_cell (judy, keys + idx * 16, depth ? 0 : strlen ((char *)keys + idx * 16)) = idx + 1;
+
+		lines = 0;
+
+		for( idx = 0; idx < LINEBENCH_keys; idx++ ) {
+		  judy_slot (judy, keys + order[idx] * 16, depth ? 0 : strlen ((char *)keys + order[idx] * 16));
+		  lines += line_path (judy);
+		}
+
+		misses = 0;
+#ifdef __linux__
+		if( fd >= 0 )
+			ioctl (fd, PERF_EVENT_IOC_RESET, 0), ioctl (fd, PERF_EVENT_IOC_ENABLE, 0);
+#endif
+		start = clock();
+
+		for( idx = 0; idx < LINEBENCH_keys; idx++ )
+		  if( !judy_slot (judy, keys + order[idx] * 16, depth ? 0 : strlen ((char *)keys + order[idx] * 16)) )
+			judy_abort ("lookup mismatch");
+
+		nsecs = (clock() - start) * 1e9 / CLOCKS_PER_SEC / LINEBENCH_keys;
+#ifdef __linux__
+		if( fd >= 0 )
+			ioctl (fd, PERF_EVENT_IOC_DISABLE, 0), read (fd, &misses, sizeof(misses));
+#endif
+		judy_stats (judy, stats);
+
+		if( fd >= 0 )
+		  fprintf (stderr, "%-8s %-9s %9.1f %13.2f %18.2f %9u\n", depth ? "integer" : "string", layout ? "lines" : "packed",
+			nsecs, (double)lines / LINEBENCH_keys, (double)misses / LINEBENCH_keys, (uint)stats->segs);
+		else
+		  fprintf (stderr, "%-8s %-9s %9.1f %13.2f %18s %9u\n", depth ? "integer" : "string", layout ? "lines" : "packed",
+			nsecs, (double)lines / LINEBENCH_keys, "n/a", (uint)stats->segs);
+
+		judy_close (judy);
+	  }
+	}
+
+	free (order);
+	free (keys);
+}
+#endif
+
+#ifdef JUDYTEST
+//	regression checks of the Judy functions, each printing
+//	the failures it finds
+
+//	compilation:
+//	cc -O2 -D STANDALONE -D JUDYTEST judy64.c
+
+uint JudyFails;
+
+void judy_expect (int ok, char *what)
+{
+	if( !ok )
+		fprintf (stderr, "FAIL: %s\n", what), JudyFails++;
+}
+
+//	the vector linear node search against the scalar
+//	loop, on every node size and key width
+
+void test_search (void)
+{
+judyvalue seed = 3, keys[64], value;
+int type, keysize, cnt, slot, idx;
+uchar *base;
+
+	base = malloc (JudySize[JUDY_max]);
+
+	for( type = JUDY_1; type <= JUDY_max; type++ )
+	  for( keysize = 1; keysize <= JUDY_key_size; keysize++ ) {
+		cnt = JudySize[type] / (sizeof(JudySlot) + keysize);
+		memset (base, 0, JudySize[type]);
+
+		for( slot = 0; slot < cnt; slot++ ) {
+			seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+			keys[slot] = (seed >> 16) & JudyMask[keysize];
+		}
+
+		for( slot = 1; slot < cnt; slot++ )
+		  for( idx = slot; idx && keys[idx - 1] > keys[idx]; idx-- )
+			value = keys[idx], keys[idx] = keys[idx - 1], keys[idx - 1] = value;
+
+		for( slot = 0; slot < cnt; slot++ )
+		  for( idx = 0, value = keys[slot]; idx < keysize; idx++, value >>= 8 )
+#if BYTE_ORDER != BIG_ENDIAN
+			base[slot * keysize + idx] = (uchar)value;
+#else
+			base[slot * keysize + keysize - idx - 1] = (uchar)value;
+#endif
+
+		for( idx = 0; idx < 512; idx++ ) {
+			seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+			value = idx & 1 ? keys[(seed >> 33) % cnt] : (seed >> 16) & JudyMask[keysize];
+			value += idx % 3 == 2 && value < JudyMask[keysize];
+			judy_expect (judy_linear (base, cnt, keysize, value) == JudySearch (base, cnt, keysize, value), "vector node search");
+		}
+	  }
+
+	free (base);
+}
+
+//	batch lookups against single judy_slot calls, on an
+//	empty array, a one key array and a large one
+
+void test_batch (void)
+{
+uchar *keys[300], buff[300][16];
+judyvalue seed = 5, ints[300];
+JudySlot *out[300], *cell;
+uint lens[300], idx, pos;
+uint found, want;
+Judy *judy;
+int depth;
+
+	for( depth = 0; depth <= 1; depth++ ) {
+	  judy = judy_open (64, depth);
+
+	  for( idx = 0; idx < 300; idx++ ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		ints[idx] = seed >> (idx & 1 ? 20 : 50);
+		lens[idx] = (seed >> 33) % 16;
+
+		for( pos = 0; pos < lens[idx]; pos++ )
+			buff[idx][pos] = 'a' + (seed >> (pos * 2 + 3)) % 4;
+
+		keys[idx] = depth ? (uchar *)(ints + idx) : buff[idx];
+	  }
+
+	  memset (out, 0xff, sizeof(out));
+	  judy_expect (!judy_slot_batch (judy, keys, depth ? NULL : lens, 3, out), "batch on empty array");
+	  judy_expect (!out[0] && !out[1] && !out[2], "batch on empty array cells");
+
+	  *judy_cell (judy, keys[1], lens[1]) = 1;
+	  judy_expect (judy_slot_batch (judy, keys, depth ? NULL : lens, 3, out) == 1 && !out[0] && out[1] && *out[1] == 1 && !out[2], "batch on one key");
+
+	  for( idx = 0; idx < 300; idx += 2 )
+		*judy_cell (judy, keys[idx], lens[idx]) = idx + 1;
+
+	  found = judy_slot_batch (judy, keys, depth ? NULL : lens, 300, out);
+
+	  for( want = idx = 0; idx < 300; idx++ ) {
+		cell = judy_slot (judy, keys[idx], lens[idx]);
+		judy_expect (out[idx] == cell, "batch cell matches judy_slot");
+		want += cell != NULL;
+	  }
+
+	  judy_expect (found == want, "batch count of keys found");
+	  judy_close (judy);
+	}
+}
+
+//	concurrent mode: one writer adds and deletes keys
+//	while reader clones look keys up and iterate. a
+//	node reused while a reader can still reach it
+//	shows up as a missing key or a key whose cell
+//	doesn't match it.
+
+typedef struct {
+	Judy *judy;			// the reader's clone
+	uint *done;			// the writer has finished
+	uint passes;		// read sections completed
+	uint bad;			// wrong keys or cells seen
+} JudyReadCheck;
+
+uint judy_testkey (uchar *buff, uint id)
+{
+	sprintf ((char *)buff, "%04x%012x", id & 0xfff, id * 2654435761U);
+	return 16;
+}
+
+#ifdef _WIN32
+DWORD WINAPI test_reader (void *arg)
+#else
+void *test_reader (void *arg)
+#endif
+{
+JudyReadCheck *check = (JudyReadCheck *)arg;
+uchar buff[64], prev[64], want[64];
+Judy *judy = check->judy;
+uint id, len, cnt;
+JudySlot *cell;
+
+	while( !JUDY_load (check->done) ) {
+		judy_enter (judy);
+
+		//	the first 256 keys are never deleted
+
+		for( id = 0; id < 256; id++ ) {
+			len = judy_testkey (buff, id);
+			if( !(cell = judy_slot (judy, buff, len)) || *cell && *cell != id + 1 )
+				check->bad++;
+		}
+
+		*prev = 0;
+		cnt = 0;
+
+		for( cell = judy_strt (judy, NULL, 0); cell && cnt < 2048; cell = judy_nxt (judy), cnt++ ) {
+			len = judy_key (judy, buff, sizeof(buff));
+			if( len != 16 || strcmp ((char *)buff, (char *)prev) <= 0 )
+				check->bad++;
+			if( *cell && (judy_testkey (want, (uint)*cell - 1), strcmp ((char *)buff, (char *)want)) )
+				check->bad++;
+			memcpy (prev, buff, len + 1);
+		}
+
+		judy_leave (judy);
+		check->passes++;
+	}
+
+	return 0;
+}
+
+void test_concurrent (void)
+{
+JudyReadCheck check[3];
+judyvalue seed = 11;
+uint idx, id, now, done = 0;
+uchar buff[64];
+JudySlot *cell;
+Judy *judy;
+uint len;
+#ifdef _WIN32
+HANDLE thread[3];
+#else
+pthread_t thread[3];
+#endif
+
+	judy = judy_open (64, 0);
+
+	for( id = 0; id < 256; id++ ) {
+		len = judy_testkey (buff, id);
+		*judy_cell (judy, buff, len) = id + 1;
+	}
+
+	judy_concurrent (judy, 3);
+
+	for( idx = 0; idx < 3; idx++ ) {
+		check[idx].judy = judy_clone (judy);
+		check[idx].done = &done;
+		check[idx].passes = check[idx].bad = 0;
+#ifdef _WIN32
+		thread[idx] = CreateThread (NULL, 0, test_reader, check + idx, 0, NULL);
+#else
+		pthread_create (thread + idx, NULL, test_reader, check + idx);
+#endif
+	}
+
+	for( idx = 0; idx < 300000; idx++ ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		id = 256 + (seed >> 33) % 3840;
+		len = judy_testkey (buff, id);
+
+		if( judy_slot (judy, buff, len) )
+			judy_del (judy);
+		else if( (cell = judy_cell (judy, buff, len)) )
+			*cell = id + 1;
+	}
+
+	JUDY_store (&done, 1);
+
+	for( idx = 0; idx < 3; idx++ ) {
+#ifdef _WIN32
+		WaitForSingleObject (thread[idx], INFINITE);
+		CloseHandle (thread[idx]);
+#else
+		pthread_join (thread[idx], NULL);
+#endif
+		judy_expect (check[idx].passes > 0, "concurrent reader made progress");
+		judy_expect (!check[idx].bad, "concurrent reader saw only live keys");
+	}
+
+	//	a change frees blocks before it stores the links
+	//	replacing them, so the epoch may only advance
+	//	between changes
+
+	judy->epoch->retired = JUDY_retire - 1;
+	now = judy->epoch->global;
+	len = judy_testkey (buff, 5000);
+	*judy_cell (judy, buff, len) = 5001;
+	judy_expect (judy->epoch->retired >= JUDY_retire && judy->epoch->global == now, "epoch held during a change");
+	len = judy_testkey (buff, 5001);
+	*judy_cell (judy, buff, len) = 5002;
+	judy_expect (judy->epoch->global == now + 1, "epoch advanced between changes");
+
+	judy_close (judy);
+}
+
+//	shared pool: worker caches keep the count of each
+//	free list through mixed size allocations, and
+//	workers in two threads build arrays from one pool
+
+uint test_cached (Judy *judy)
+{
+uint type, cnt, bad = 0;
+void **block;
+
+	for( type = 0; type < 8; type++ ) {
+		for( cnt = 0, block = judy->reuse[type]; block; block = *block )
+			cnt++;
+		if( cnt != judy->cache[type] || judy->pool && cnt > JUDY_cache )
+			bad++;
+	}
+
+	return bad;
+}
+
+#ifdef _WIN32
+DWORD WINAPI test_worker (void *arg)
+#else
+void *test_worker (void *arg)
+#endif
+{
+Judy *worker = (Judy *)arg;
+judyvalue id;
+
+	for( id = 1; id <= 20000; id++ )
+		*judy_cell (worker, (uchar *)&id, sizeof(id)) = id + 1;
+
+	for( id = 2; id <= 20000; id += 2 )
+	  if( judy_slot (worker, (uchar *)&id, sizeof(id)) )
+		judy_del (worker);
+
+	return 0;
+}
+
+void test_pool (void)
+{
+judyvalue seed = 13;
+void *block[2000];
+uint type[2000];
+Judy *judy, *worker[2];
+judyvalue id;
+uint idx, cnt;
+JudySlot *cell;
+#ifdef _WIN32
+HANDLE thread[2];
+#else
+pthread_t thread[2];
+#endif
+
+	judy = judy_open (16, 1);
+	judy_expect (judy_shared (judy), "shared pool");
+	worker[0] = judy_worker (judy);
+
+	for( idx = 0; idx < 2000; idx++ ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		type[idx] = JUDY_1 + (seed >> 33) % (JUDY_max - JUDY_1 + 1);
+		block[idx] = judy_alloc (worker[0], type[idx]);
+
+		if( idx % 3 == 2 )
+			judy_free (worker[0], block[idx - 1], type[idx - 1]), block[idx - 1] = NULL;
+	}
+
+	judy_expect (!test_cached (worker[0]), "pool counts after allocation");
+
+	for( idx = 0; idx < 2000; idx++ )
+	  if( block[idx] )
+		judy_free (worker[0], block[idx], type[idx]);
+
+	judy_expect (!test_cached (worker[0]), "pool counts after release");
+
+	for( idx = 0; idx < 2000; idx++ ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		type[idx] = JUDY_1 + (seed >> 33) % (JUDY_max - JUDY_1 + 1);
+		block[idx] = judy_alloc (worker[0], type[idx]);
+	}
+
+	judy_expect (!test_cached (worker[0]), "pool counts after reuse");
+	judy_release (worker[0]);
+
+	for( idx = 0; idx < 2; idx++ ) {
+		worker[idx] = judy_worker (judy);
+#ifdef _WIN32
+		thread[idx] = CreateThread (NULL, 0, test_worker, worker[idx], 0, NULL);
+#else
+		pthread_create (thread + idx, NULL, test_worker, worker[idx]);
+#endif
+	}
+
+	for( idx = 0; idx < 2; idx++ ) {
+#ifdef _WIN32
+		WaitForSingleObject (thread[idx], INFINITE);
+		CloseHandle (thread[idx]);
+#else
+		pthread_join (thread[idx], NULL);
+#endif
+		for( cnt = 0, id = 1; id <= 20000; id++ )
+		  if( (cell = judy_slot (worker[idx], (uchar *)&id, sizeof(id))) && *cell )
+			cnt += *cell == id + 1 && id & 1;
+		  else
+			cnt += !(id & 1);
+
+		judy_expect (cnt == 20000, "worker array keys");
+		judy_expect (!test_cached (worker[idx]), "worker pool counts");
+		judy_release (worker[idx]);
+	}
+
+	judy_close (judy);
+}
+
+//	parallel builds against keys added one at a time,
+//	with duplicate keys counted or given values
+
+void test_parallel (void)
+{
+uchar *keys[3000], buff[3000][12];
+JudySlot values[3000], *cell, *want;
+judyvalue seed = 17, ints[3000];
+uint lens[3000], idx, pos, added;
+uint threads, bad;
+Judy *judy, *check;
+int depth;
+
+	for( depth = 0; depth <= 1; depth++ )
+	  for( threads = 1; threads <= 4; threads += 3 ) {
+		for( idx = 0; idx < 3000; idx++ ) {
+			seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+			ints[idx] = (seed >> 20) % 2000 + 1;
+			lens[idx] = (seed >> 33) % 12;
+
+			for( pos = 0; pos < lens[idx]; pos++ )
+				buff[idx][pos] = 'a' + (seed >> (pos * 3 + 1)) % 6;
+
+			keys[idx] = depth ? (uchar *)(ints + idx) : buff[idx];
+			values[idx] = idx + 1;
+		}
+
+		judy = judy_open (16, depth);
+		check = judy_open (16, depth);
+		added = judy_build_parallel (judy, keys, lens, depth ? values : NULL, 3000, threads);
+
+		for( idx = 0; idx < 3000; idx++ )
+			cell = judy_cell (check, keys[idx], lens[idx]), *cell = depth ? values[idx] : *cell + 1;
+
+		for( bad = idx = 0; idx < 3000; idx++ ) {
+			cell = judy_slot (judy, keys[idx], lens[idx]);
+			want = judy_slot (check, keys[idx], lens[idx]);
+			bad += !cell || *cell != *want;
+		}
+
+		for( idx = 0, cell = judy_strt (check, NULL, 0); cell; cell = judy_nxt (check) )
+			idx++;
+
+		judy_expect (!bad, depth ? "parallel build of integer keys" : "parallel build of string keys");
+		judy_expect (added == idx, "parallel build count of keys added");
+
+		for( idx = 0, cell = judy_strt (judy, NULL, 0); cell; cell = judy_nxt (judy) )
+			idx++;
+
+		judy_expect (added == idx, "parallel build iterates every key");
+		judy_close (check);
+		judy_close (judy);
+	  }
+}
+
+//	sorted loads against keys added one at a time,
+//	and an out of order load falling back to judy_cell
+
+int test_keysort (const void *a, const void *b)
+{
+	return strcmp (*(char **)a, *(char **)b);
+}
+
+void test_sorted (void)
+{
+uchar *keys[4000], buff[4000][40], key[2][40];
+JudySlot values[4000], *cell, *want;
+uint lens[4000], idx, pos, len[2];
+judyvalue seed = 19, ints[4000], swap;
+uint added, cnt, bad;
+Judy *judy, *check;
+int depth, order;
+
+	for( depth = 0; depth <= 1; depth++ )
+	  for( order = 0; order <= 1; order++ ) {
+		for( idx = 0; idx < 4000; idx++ ) {
+			seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+			ints[idx] = (seed >> 20) % (idx & 1 ? 5000 : 1000000000) + 1;
+			len[0] = (seed >> 33) % (idx & 1 ? 39 : 6) + 1;
+
+			for( pos = 0; pos < len[0]; pos++ )
+				buff[idx][pos] = 'a' + (seed >> (pos % 20 + 3)) % (idx & 1 ? 3 : 26);
+
+			buff[idx][len[0]] = 0;
+			keys[idx] = depth ? (uchar *)(ints + idx) : buff[idx];
+		}
+
+		if( order && depth ) {
+		  for( idx = 1; idx < 4000; idx++ )
+			for( pos = idx; pos && ints[pos - 1] > ints[pos]; pos-- )
+				swap = ints[pos], ints[pos] = ints[pos - 1], ints[pos - 1] = swap;
+		} else if( order )
+			qsort (keys, 4000, sizeof(uchar *), test_keysort);
+
+		for( idx = 0; idx < 4000; idx++ ) {
+			lens[idx] = depth ? 0 : strlen ((char *)keys[idx]);
+			values[idx] = idx + 1;
+		}
+
+		judy = judy_open (40, depth);
+		check = judy_open (40, depth);
+		added = judy_load_sorted (judy, keys, lens, depth ? values : NULL, 4000);
+
+		//	a duplicate keeps the cell of its last instance
+
+		for( idx = 0; idx < 4000; idx++ )
+			cell = judy_cell (check, keys[idx], lens[idx]), *cell = depth ? values[idx] : *cell + 1;
+
+		for( bad = idx = 0; idx < 4000; idx++ ) {
+			cell = judy_slot (judy, keys[idx], lens[idx]);
+			want = judy_slot (check, keys[idx], lens[idx]);
+			bad += !cell || *cell != *want;
+		}
+
+		judy_expect (!bad, order ? "sorted load cells" : "unsorted load cells");
+
+		//	both arrays iterate the same keys
+
+		cell = judy_strt (judy, NULL, 0);
+		want = judy_strt (check, NULL, 0);
+
+		for( cnt = 0; cell && want; cnt++ ) {
+			len[0] = judy_key (judy, key[0], 40);
+			len[1] = judy_key (check, key[1], 40);
+			bad += len[0] != len[1] || memcmp (key[0], key[1], len[0]);
+			cell = judy_nxt (judy);
+			want = judy_nxt (check);
+		}
+
+		judy_expect (!bad && !cell && !want && cnt == added, order ? "sorted load keys" : "unsorted load keys");
+		judy_close (check);
+		judy_close (judy);
+	  }
+}
+
+//	a saved and mapped image answers the same queries
+//	as the array it was saved from, and is read-only
+
+void test_image (void)
+{
+uchar buff[2000][24], key[2][24];
+judyvalue seed = 23, ints[2000];
+uint len[2], idx, pos, cnt, bad;
+JudySlot *cell, *want;
+Judy *judy, *image;
+uchar *keys[2000];
+uint lens[2000];
+JudySlot *out[2000];
+int depth;
+
+	for( depth = 0; depth <= 1; depth++ ) {
+		judy = judy_open (24, depth);
+
+		for( idx = 0; idx < 2000; idx++ ) {
+			seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+			ints[idx] = seed >> (idx & 1 ? 40 : 8) | 1;
+			lens[idx] = (seed >> 33) % 23 + 1;
+
+			for( pos = 0; pos < lens[idx]; pos++ )
+				buff[idx][pos] = 'a' + (seed >> (pos + 5)) % (idx & 1 ? 2 : 26);
+
+			keys[idx] = depth ? (uchar *)(ints + idx) : buff[idx];
+
+			if( idx % 4 )
+				*judy_cell (judy, keys[idx], lens[idx]) = idx + 1;
+		}
+
+		judy_expect (judy_save (judy, "judytest.img") != 0, "save image");
+		image = judy_map ("judytest.img");
+		judy_expect (image != NULL, "map image");
+
+		if( !image ) {
+			judy_close (judy);
+			continue;
+		}
+
+		for( bad = idx = 0; idx < 2000; idx++ ) {
+			cell = judy_slot (image, keys[idx], lens[idx]);
+			want = judy_slot (judy, keys[idx], lens[idx]);
+			bad += !cell != !want || cell && *cell != *want;
+		}
+
+		judy_expect (!bad, "image lookups");
+
+		judy_slot_batch (image, keys, depth ? NULL : lens, 2000, out);
+
+		for( bad = idx = 0; idx < 2000; idx++ )
+			bad += out[idx] != judy_slot (image, keys[idx], lens[idx]);
+
+		judy_expect (!bad, "image batch lookups");
+
+		//	forward and backward iteration
+
+		cell = judy_strt (image, NULL, 0);
+		want = judy_strt (judy, NULL, 0);
+
+		for( cnt = 0; cell && want; cnt++ ) {
+			len[0] = judy_key (image, key[0], 24);
+			len[1] = judy_key (judy, key[1], 24);
+			bad += len[0] != len[1] || memcmp (key[0], key[1], len[0]) || *cell != *want;
+			cell = judy_nxt (image);
+			want = judy_nxt (judy);
+		}
+
+		judy_expect (!bad && !cell && !want && cnt, "image iterates forward");
+
+		cell = judy_end (image);
+		want = judy_end (judy);
+
+		while( cell && want ) {
+			bad += *cell != *want;
+			cell = judy_prv (image);
+			want = judy_prv (judy);
+		}
+
+		judy_expect (!bad && !cell && !want, "image iterates backward");
+
+		judy_expect (!judy_cell (image, keys[0], lens[0]), "image is read-only");
+		judy_close (image);
+		judy_close (judy);
+	}
+
+	remove ("judytest.img");
+}
+
+//	scans against a count of the keys in range: string
+//	keys long enough for span nodes, integer keys whose
+//	zero low bytes match vacant slots, lo keys absent
+//	from the array, and scans continued in pieces
+
+typedef struct {
+	int depth;			// integer keys
+	uint count;			// keys passed
+	uint bad;			// empty cells, keys out of range or out of order
+	uchar prev[64];		// the previous key
+	uint len;			// and its length
+	uchar *lo, *hi;		// the scan's range
+	uint lolen, hilen;	// and its key lengths
+} JudyScanCheck;
+
+int judy_keycmp (JudyScanCheck *check, uchar *a, uint alen, uchar *b, uint blen)
+{
+int cmp;
+
+	if( check->depth )
+		return *(judyvalue *)a < *(judyvalue *)b ? -1 : *(judyvalue *)a > *(judyvalue *)b;
+
+	if( (cmp = memcmp (a, b, alen < blen ? alen : blen)) )
+		return cmp;
+
+	return (int)alen - (int)blen;
+}
+
+int judy_scancheck (void *arg, uchar *key, uint len, JudySlot *cell)
+{
+JudyScanCheck *check = (JudyScanCheck *)arg;
+
+	if( !*cell || judy_keycmp (check, key, len, check->lo, check->lolen) < 0 )
+		check->bad++;
+
+	if( judy_keycmp (check, key, len, check->hi, check->hilen) > 0 )
+		check->bad++;
+
+	if( check->count && judy_keycmp (check, key, len, check->prev, check->len) <= 0 )
+		check->bad++;
+
+	memcpy (check->prev, key, check->len = len);
+	check->count++;
+	return 0;
+}
+
+void test_scan (void)
+{
+uchar keys[400][40], lo[40], hi[40], added[400];
+judyvalue seed = 7, ints[400], value[2];
+uint idx, pos, len, probe, want, cnt;
+JudyScanCheck check[1];
+JudySlot *cell;
+Judy *judy;
+int depth;
+
+	for( depth = 0; depth <= 1; depth++ ) {
+	  judy = judy_open (64, depth);
+	  memset (check, 0, sizeof(check));
+	  check->depth = depth;
+
+	  for( idx = 0; idx < 400; idx++ ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+
+		if( depth ) {
+			ints[idx] = (seed >> 40 & 0x3ff00) | (seed >> 33 & 0xff) | 1;
+			cell = judy_cell (judy, (uchar *)(ints + idx), 0);
+		} else {
+			len = 1 + (seed >> 33) % 39;
+
+			for( pos = 0; pos < len; pos++ )
+				keys[idx][pos] = 'a' + (seed >> (pos % 30 + 2)) % 3;
+
+			keys[idx][len] = 0;
+			cell = judy_cell (judy, keys[idx], len);
+		}
+
+		added[idx] = !*cell;
+		*cell = idx + 1;
+	  }
+
+	  for( probe = 0; probe < 400; probe++ ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+
+		if( depth ) {
+			value[0] = probe & 1 ? ints[probe] : seed >> 40 & 0x3ff00;
+			value[1] = probe & 2 ? value[0] + (seed >> 20 & 0xffff) : ~(judyvalue)0;
+			memcpy (lo, value, check->lolen = sizeof(judyvalue));
+			memcpy (hi, value + 1, check->hilen = sizeof(judyvalue));
+		} else {
+			for( len = 1 + (seed >> 33) % 20, pos = 0; pos < len; pos++ )
+				lo[pos] = 'a' + (seed >> (pos + 3)) % 4;
+			for( check->lolen = len, len = 1 + (seed >> 27) % 8, pos = 0; pos < len; pos++ )
+				hi[pos] = probe & 2 ? lo[pos] + (pos == len - 1) : 'z';
+			check->hilen = len;
+		}
+
+		for( want = idx = 0; idx < 400; idx++ )
+		  if( added[idx] )
+			if( depth ? ints[idx] >= value[0] && ints[idx] <= value[1] : judy_keycmp (check, keys[idx], strlen ((char *)keys[idx]), lo, check->lolen) >= 0 && judy_keycmp (check, keys[idx], strlen ((char *)keys[idx]), hi, check->hilen) <= 0 )
+				want++;
+
+		check->count = check->bad = 0;
+		check->lo = lo;
+		check->hi = hi;
+		judy_expect (judy_scan (judy, lo, check->lolen, hi, check->hilen, judy_scancheck, check, 0) == want, depth ? "scan integers in range" : "scan strings in range");
+		judy_expect (check->count == want && !check->bad, depth ? "scan integer keys in range" : "scan string keys in range");
+
+		//	the same range in pieces of three keys
+
+		check->count = check->bad = 0;
+		cnt = judy_scan (judy, lo, check->lolen, hi, check->hilen, judy_scancheck, check, 3);
+
+		while( cnt && cnt < want && (len = judy_scan (judy, NULL, 0, hi, check->hilen, judy_scancheck, check, 3)) )
+			cnt += len;
+
+		judy_expect (cnt == want && check->count == want && !check->bad, "scan continued in pieces");
+	  }
+
+	  judy_close (judy);
+	}
+}
+
+//	statistics agree with the keys iterated and with
+//	the memory the array holds
+
+void test_stats (void)
+{
+judyvalue seed = 29, key;
+JudySlot total, depth;
+JudyStats stats[1];
+uchar buff[32];
+JudySlot *cell;
+uint idx, len, cnt;
+Judy *judy;
+
+	judy = judy_open (32, 0);
+
+	for( idx = 0; idx < 5000; idx++ ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		key = seed >> 16;
+		len = 1 + (seed >> 33) % 31;
+		memcpy (buff, "stats keys with a shared prefix", len);
+		buff[len - 1] = 'a' + key % 26;
+		*judy_cell (judy, buff, len) = 1;
+	}
+
+	for( cnt = 0, cell = judy_strt (judy, NULL, 0); cell; cell = judy_nxt (judy) )
+		if( cnt++ & 1 )
+			judy_del (judy);
+
+	for( cnt = 0, cell = judy_strt (judy, NULL, 0); cell; cell = judy_nxt (judy) )
+		cnt++;
+
+	judy_stats (judy, stats);
+
+	for( total = depth = idx = 0; idx < 8; idx++ )
+		total += stats->bytes[idx] + stats->idle[idx];
+
+	for( idx = 0; idx < JUDY_levels; idx++ )
+		depth += stats->depth[idx];
+
+	judy_expect (stats->keys == cnt && depth == cnt, "stats key count");
+	judy_expect (stats->used <= stats->slots && stats->fill == (stats->slots ? stats->used * 100 / stats->slots : 0), "stats linear node fill");
+	judy_expect (stats->segs && total <= stats->memory, "stats memory");
+
+	judy_save (judy, "judytest.img");
+	judy_close (judy);
+
+	if( (judy = judy_map ("judytest.img")) ) {
+		judy_stats (judy, stats);
+		judy_expect (stats->keys == cnt && !stats->segs, "stats of a mapped image");
+		judy_close (judy);
+	}
+
+	remove ("judytest.img");
+}
+
+//	compaction in steps, with keys added, deleted and
+//	changed between the calls, against a second array
+//	given the same changes
+
+void test_compact (void)
+{
+judyvalue seed = 31, key, other;
+JudySlot *cell, *want;
+JudyStats stats[1];
+JudySlot memory;
+Judy *judy, *check;
+uint idx, calls, bad;
+
+	judy = judy_open (8, 1);
+	check = judy_open (8, 1);
+
+	for( idx = 0; idx < 200000; idx++ ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		key = (seed >> 24) | 1;
+		*judy_cell (judy, (uchar *)&key, 0) = idx + 1;
+		*judy_cell (check, (uchar *)&key, 0) = idx + 1;
+	}
+
+	for( idx = 0, cell = judy_strt (judy, NULL, 0); cell; cell = judy_nxt (judy) )
+	  if( idx++ % 4 ) {
+		judy_key (judy, (uchar *)&key, sizeof(key));
+		judy_del (judy);
+		if( judy_slot (check, (uchar *)&key, 0) )
+			judy_del (check);
+	  }
+
+	judy_stats (judy, stats);
+	memory = stats->memory;
+
+	for( calls = 1; judy_compact (judy, 1); calls++ )
+	  for( idx = 0; idx < 200; idx++ ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		key = (seed >> 24) | 1;
+
+		if( idx % 3 == 0 ) {
+			*judy_cell (judy, (uchar *)&key, 0) = calls;
+			*judy_cell (check, (uchar *)&key, 0) = calls;
+		} else if( judy_slot (check, (uchar *)&key, 0) ) {
+			judy_del (check);
+			judy_slot (judy, (uchar *)&key, 0);
+			judy_del (judy);
+		} else if( (cell = judy_strt (check, (uchar *)&key, 0)) ) {
+			judy_key (check, (uchar *)&key, sizeof(key));
+			*cell = calls;
+			*judy_slot (judy, (uchar *)&key, 0) = calls;
+		}
+	  }
+
+	judy_stats (judy, stats);
+	judy_expect (calls > 1, "compaction in more than one call");
+	judy_expect (stats->memory < memory, "compaction freed segments");
+
+	cell = judy_strt (judy, NULL, 0);
+	want = judy_strt (check, NULL, 0);
+
+	for( bad = 0; cell && want; cell = judy_nxt (judy), want = judy_nxt (check) ) {
+		judy_key (judy, (uchar *)&key, sizeof(key));
+		judy_key (check, (uchar *)&other, sizeof(other));
+		bad += *cell != *want || key != other;
+	}
+
+	judy_expect (!bad && !cell && !want, "compacted array keeps its keys");
+	judy_close (check);
+	judy_close (judy);
+}
+
+//	arrays on larger segments from malloc, mmap and
+//	huge pages hold their keys, and judy_data takes
+//	requests up to the segment size
+
+void test_segments (void)
+{
+uint flags[4] = {0, JUDY_mmap, JUDY_hugepage, JUDY_hugetlb};
+uint sizes[4] = {100000, 1 << 20, 4 << 20, 2 << 20};
+judyvalue seed = 37, key;
+JudyStats stats[1];
+uint idx, run, bad;
+JudySlot *cell;
+Judy *judy;
+
+	for( run = 0; run < 4; run++ ) {
+		judy = judy_open_seg (0, 1, sizes[run], flags[run]);
+		judy_expect (judy != NULL, "open with segments");
+
+		if( !judy )
+			continue;
+
+		for( idx = 0; idx < 50000; idx++ ) {
+			seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+			key = seed >> 20 | 1;
+			*judy_cell (judy, (uchar *)&key, 0) = key;
+		}
+
+		for( bad = idx = 0, cell = judy_strt (judy, NULL, 0); cell; cell = judy_nxt (judy), idx++ ) {
+			judy_key (judy, (uchar *)&key, sizeof(key));
+			bad += *cell != key;
+		}
+
+		judy_stats (judy, stats);
+		judy_expect (!bad && idx == stats->keys, "keys on larger segments");
+		judy_expect (stats->memory == stats->segs * judy->segsize && judy->segsize >= sizes[run], "segment size");
+		judy_expect (judy_data (judy, (judy->segsize - 88) & -JUDY_cache_line) != NULL, "judy_data of a whole segment");
+		judy_close (judy);
+	}
+}
+
+//	JUDY_lines starts every node of a cache line or
+//	more on a line boundary, and the skipped bytes
+//	join the reuse lists
+
+void test_lines (void)
+{
+judyvalue seed = 41, key;
+uint idx, level, bad, size;
+JudySlot *cell, next;
+Judy *judy;
+int depth;
+
+	for( depth = 0; depth <= 1; depth++ ) {
+		judy = judy_open_seg (16, depth, JUDY_seg, JUDY_lines);
+
+		for( idx = 0; idx < 30000; idx++ ) {
+			seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+			key = seed >> (idx & 1 ? 16 : 44) | 1;
+			*judy_cell (judy, (uchar *)&key, depth ? 0 : sizeof(key)) = idx + 1;
+		}
+
+		for( bad = 0, cell = judy_strt (judy, NULL, 0); cell; cell = judy_nxt (judy) )
+		  for( bad += !*cell, level = 1; level <= judy->level; level++ ) {
+			next = judy->stack[level].next;
+			size = JudySize[next & 0x07];
+			bad += size >= JUDY_line && next & (JUDY_line - 1) & JUDY_mask;
+		  }
+
+		judy_expect (!bad, "nodes on cache lines");
+		judy_expect (!test_cached (judy), "reuse counts with JUDY_lines");
+		judy_close (judy);
+	}
+}
+
+//	the integer key engines against judy_slot and
+//	judy_cell, for 32, 64 and 128 bit keys
+
+void test_integers (void)
+{
+judyvalue seed = 43, key[2], keys[3000][2];
+uint idx, bad, miss, depth;
+JudySlot *cell, *want;
+Judy *judy;
+
+	for( depth = 1; depth <= 2; depth++ ) {
+		judy = judy_open (0, depth);
+
+		for( idx = 0; idx < 3000; idx++ ) {
+			seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+			keys[idx][0] = seed >> (idx % 3 * 20 + 4) | 1;
+			keys[idx][1] = seed >> 7 | 1;
+
+			switch( idx % 3 + depth * 3 - 3 ) {
+			case 0:	cell = judy_cell64 (judy, keys[idx][0]);	break;
+			case 1:	cell = judy_cell32 (judy, (uint)keys[idx][0]);
+					keys[idx][0] = (uint)keys[idx][0];	break;
+			case 2:	cell = judy_cell (judy, (uchar *)keys[idx], 0);	break;
+			default:
+				cell = idx & 1 ? judy_cell128 (judy, keys[idx]) : judy_cell (judy, (uchar *)keys[idx], 0);
+			}
+
+			*cell = idx + 1;
+		}
+
+		for( bad = miss = idx = 0; idx < 3000; idx++ ) {
+			want = judy_slot (judy, (uchar *)keys[idx], 0);
+			cell = depth > 1 ? judy_slot128 (judy, keys[idx]) : judy_slot64 (judy, keys[idx][0]);
+			bad += !want || cell != want;
+
+			if( depth == 1 && keys[idx][0] >> 32 == 0 )
+				bad += judy_slot32 (judy, (uint)keys[idx][0]) != want;
+
+			key[0] = keys[idx][0] + 2, key[1] = keys[idx][1] + 2;
+			want = judy_slot (judy, (uchar *)key, 0);
+			cell = depth > 1 ? judy_slot128 (judy, key) : judy_slot64 (judy, key[0]);
+			miss += cell != want;
+		}
+
+		judy_expect (!bad, depth > 1 ? "128 bit key lookups" : "32 and 64 bit key lookups");
+		judy_expect (!miss, depth > 1 ? "128 bit lookups of absent keys" : "64 bit lookups of absent keys");
+
+		for( bad = idx = 0; idx < 3000; idx++ ) {
+			want = judy_slot (judy, (uchar *)keys[idx], 0);
+			cell = depth > 1 ? judy_cell128 (judy, keys[idx]) : judy_cell64 (judy, keys[idx][0]);
+			bad += cell != want;
+		}
+
+		judy_expect (!bad, "integer inserts find existing keys");
+		judy_close (judy);
+	}
+}
+
+//	integer sets with bitmap leaves against a plain
+//	array of the same keys: inserts, lookups, lower
+//	bounds, iteration both ways and deletes
+
+void test_bitmap (void)
+{
+judyvalue seed = 47, key, other;
+JudySlot *cell, *want;
+JudyStats stats[1];
+uint idx, bad, cnt;
+Judy *judy, *check;
+
+	judy = judy_open_seg (0, 1, JUDY_seg, JUDY_set);
+	check = judy_open (0, 1);
+
+	for( bad = idx = 0; idx < 20000; idx++ ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		key = idx < 10000 ? idx * 3 + 1 : (seed >> 30) + 1;
+		cell = judy_cell (judy, (uchar *)&key, 0);
+		want = judy_cell (check, (uchar *)&key, 0);
+		bad += *cell != *want;
+		*cell = *want = 1;
+	}
+
+	judy_stats (judy, stats);
+	judy_expect (!bad, "set inserts report existing keys");
+	judy_expect (stats->count[JUDY_bitmap] > 0, "set has bitmap leaves");
+
+	for( cnt = 0; cnt < 4; cnt++ ) {
+	  for( bad = idx = 0; idx < 2000; idx++ ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		key = idx & 1 ? (seed >> 30) + 1 : (seed >> 33) % 40000;
+		cell = judy_slot (judy, (uchar *)&key, 0);
+		want = judy_slot (check, (uchar *)&key, 0);
+		bad += !cell != !(want && *want) || cell && *cell != 1;
+
+		cell = judy_strt (judy, (uchar *)&key, sizeof(key));
+		want = judy_strt (check, (uchar *)&key, sizeof(key));
+
+		if( cell && want ) {
+			judy_key (judy, (uchar *)&key, sizeof(key));
+			judy_key (check, (uchar *)&other, sizeof(other));
+			bad += key != other;
+		} else
+			bad += cell != want;
+	  }
+
+	  judy_expect (!bad, cnt ? "set lookups after deletes" : "set lookups");
+
+	  //	both directions visit the same keys
+
+	  cell = judy_strt (judy, NULL, 0);
+	  want = judy_strt (check, NULL, 0);
+
+	  for( bad = 0; cell && want; cell = judy_nxt (judy), want = judy_nxt (check) ) {
+		judy_key (judy, (uchar *)&key, sizeof(key));
+		judy_key (check, (uchar *)&other, sizeof(other));
+		bad += key != other;
+	  }
+
+	  judy_expect (!bad && !cell && !want, "set iterates forward");
+
+	  cell = judy_end (judy);
+	  want = judy_end (check);
+
+	  for( bad = 0; cell && want; cell = judy_prv (judy), want = judy_prv (check) ) {
+		judy_key (judy, (uchar *)&key, sizeof(key));
+		judy_key (check, (uchar *)&other, sizeof(other));
+		bad += key != other;
+	  }
+
+	  judy_expect (!bad && !cell && !want, "set iterates backward");
+
+	  //	delete a quarter of the keys
+
+	  for( idx = 0; idx < 5000; idx++ ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		key = idx & 1 ? (seed >> 33) % 30001 : (seed >> 30) + 1;
+
+		if( (cell = judy_slot (check, (uchar *)&key, 0)) && *cell ) {
+			judy_del (check);
+			judy_slot (judy, (uchar *)&key, 0);
+			judy_del (judy);
+		}
+	  }
+	}
+
+	judy_close (check);
+	judy_close (judy);
+}
+
+//	sparse inner radix tables: keys spread over few
+//	slots of many radix nodes against a sorted list,
+//	through lookups, lower bounds, iteration and
+//	deletes that empty the tables again
+
+int test_valuesort (const void *a, const void *b)
+{
+	return *(judyvalue *)a < *(judyvalue *)b ? -1 : *(judyvalue *)a > *(judyvalue *)b;
+}
+
+void test_sparse (void)
+{
+judyvalue seed = 53, keys[6000], key;
+uint idx, lo, hi, cnt, bad, round;
+JudySlot *cell;
+Judy *judy;
+
+	judy = judy_open (0, 1);
+
+	for( idx = 0; idx < 6000; idx++ ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		keys[idx] = seed >> 62 << 56 | (seed >> 20 & 0x0f) << 52 | (seed >> 40 & 3) * 5 << 48;
+		keys[idx] |= (seed >> 8 & 0xffffffff00ULL) | (idx & 0xfe) | 1;
+		*judy_cell (judy, (uchar *)(keys + idx), 0) = 1;
+	}
+
+	qsort (keys, 6000, sizeof(judyvalue), test_valuesort);
+
+	for( cnt = 1, idx = 1; idx < 6000; idx++ )
+	  if( keys[idx] != keys[cnt - 1] )
+		keys[cnt++] = keys[idx];
+
+	for( round = 0; round < 3; round++ ) {
+	  for( bad = idx = 0; idx < cnt; idx++ ) {
+		bad += !(cell = judy_slot (judy, (uchar *)(keys + idx), 0)) || *cell != 1;
+
+		//	keys are odd, so one above a key is absent
+		//	and its lower bound is the next key
+
+		key = keys[idx] + 1;
+		cell = judy_strt (judy, (uchar *)&key, sizeof(key));
+
+		if( idx + 1 < cnt ) {
+			bad += !cell;
+			judy_key (judy, (uchar *)&key, sizeof(key));
+			bad += key != keys[idx + 1];
+		} else
+			bad += cell != NULL;
+
+		//	and a key leaving the tree at a radix node
+
+		key = keys[idx] ^ (judyvalue)0x40 << (idx % 6 + 1) * 8;
+
+		for( lo = 0, hi = cnt; lo < hi; )
+		  if( keys[(lo + hi) / 2] < key )
+			lo = (lo + hi) / 2 + 1;
+		  else
+			hi = (lo + hi) / 2;
+
+		if( (cell = judy_strt (judy, (uchar *)&key, sizeof(key))) )
+			judy_key (judy, (uchar *)&key, sizeof(key));
+
+		bad += lo < cnt ? !cell || key != keys[lo] : cell != NULL;
+	  }
+
+	  for( lo = 0, cell = judy_strt (judy, NULL, 0); cell; cell = judy_nxt (judy), lo++ ) {
+		judy_key (judy, (uchar *)&key, sizeof(key));
+		bad += lo >= cnt || key != keys[lo];
+	  }
+
+	  judy_expect (!bad && lo == cnt, round ? "sparse radix tables after deletes" : "sparse radix tables");
+
+	  //	delete two keys of every three
+
+	  for( lo = hi = 0; hi < cnt; hi++ )
+		if( hi % 3 && judy_slot (judy, (uchar *)(keys + hi), 0) )
+		  judy_del (judy);
+		else
+		  keys[lo++] = keys[hi];
+
+	  cnt = lo;
+	}
+
+	judy_close (judy);
+}
+
+//	lazy span splits: string keys sharing long prefixes
+//	and leaving them three times at any offset, against a sorted
+//	list through lookups, lower bounds, iteration and
+//	deletes
+
+int test_strsort (const void *a, const void *b)
+{
+	return strcmp ((const char *)a, (const char *)b);
+}
+
+void test_spans (void)
+{
+uchar text[] = "the quick brown fox jumps over the lazy dog and keeps on running";
+uchar keys[2000][64], probe[66], buff[66];
+judyvalue seed = 11;
+uint idx, pos, len, lo, hi, cnt, bad, round;
+JudySlot *cell;
+Judy *judy;
+
+	judy = judy_open (66, 0);
+
+	for( idx = 0; idx < 2000; idx++ ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		memcpy (keys[idx], text, 63);
+		pos = (seed >> 33) % 20;
+		keys[idx][pos] = 'A' + (seed >> 20 & 1);
+		pos += 1 + (seed >> 38) % 20;
+		keys[idx][pos] = 'A' + (seed >> 21 & 1);
+		pos += 1 + (seed >> 43) % 20;
+		keys[idx][pos] = 'A' + (seed >> 22 & 1);
+		len = pos + 1 + (seed >> 50) % (63 - pos);
+		keys[idx][len] = 0;
+		*judy_cell (judy, keys[idx], len) = 1;
+	}
+
+	qsort (keys, 2000, sizeof(keys[0]), test_strsort);
+
+	for( cnt = 1, idx = 1; idx < 2000; idx++ )
+	  if( strcmp ((char *)keys[idx], (char *)keys[cnt - 1]) )
+		memcpy (keys[cnt++], keys[idx], sizeof(keys[0]));
+
+	for( round = 0; round < 2; round++ ) {
+	  for( bad = idx = 0; idx < cnt; idx++ ) {
+		len = strlen ((char *)keys[idx]);
+		bad += !(cell = judy_slot (judy, keys[idx], len)) || *cell != 1;
+
+		//	one byte past a key is absent, and its lower
+		//	bound is the next key
+
+		memcpy (probe, keys[idx], len);
+		probe[len] = 1;
+		cell = judy_strt (judy, probe, len + 1);
+
+		if( idx + 1 < cnt ) {
+			bad += !cell;
+			judy_key (judy, buff, sizeof(buff));
+			bad += strcmp ((char *)buff, (char *)keys[idx + 1]) != 0;
+		} else
+			bad += cell != NULL;
+
+		//	and half a key ends inside a span
+
+		probe[len / 2] = 0;
+
+		for( lo = 0, hi = cnt; lo < hi; )
+		  if( strcmp ((char *)keys[(lo + hi) / 2], (char *)probe) < 0 )
+			lo = (lo + hi) / 2 + 1;
+		  else
+			hi = (lo + hi) / 2;
+
+		if( (cell = judy_strt (judy, probe, len / 2)) )
+			judy_key (judy, buff, sizeof(buff));
+
+		bad += lo < cnt ? !cell || strcmp ((char *)buff, (char *)keys[lo]) : cell != NULL;
+	  }
+
+	  for( lo = 0, cell = judy_strt (judy, NULL, 0); cell; cell = judy_nxt (judy), lo++ ) {
+		judy_key (judy, buff, sizeof(buff));
+		bad += lo >= cnt || strcmp ((char *)buff, (char *)keys[lo]);
+	  }
+
+	  judy_expect (!bad && lo == cnt, round ? "lazy span splits after deletes" : "lazy span splits");
+
+	  //	delete every other key
+
+	  for( lo = hi = 0; hi < cnt; hi++ )
+		if( hi & 1 && judy_slot (judy, keys[hi], strlen ((char *)keys[hi])) )
+		  judy_del (judy);
+		else
+		  memcpy (keys[lo++], keys[hi], sizeof(keys[0]));
+
+	  cnt = lo;
+	}
+
+	judy_close (judy);
+}
+
+//	JUDY_binary: 20 byte keys full of zero bytes against
+//	a memcmp sorted list, through lookups, lower bounds
+//	of incremented and shortened keys, iteration, and a
+//	copy loaded by judy_load_sorted
+
+int test_binsort (const void *a, const void *b)
+{
+	return memcmp (a, b, 20);
+}
+
+void test_binary (void)
+{
+uchar keys[1500][20], probe[20], buff[20], *ptrs[1500];
+uint idx, pos, len, lo, hi, cnt, bad, lens[1500];
+JudySlot *cell, values[1500];
+judyvalue seed = 17;
+Judy *judy, *load;
+
+	judy = judy_open_seg (20, 0, 0, JUDY_binary);
+
+	for( idx = 0; idx < 1500; idx++ ) {
+	  for( pos = 0; pos < 20; pos++ ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		keys[idx][pos] = seed >> 60 < 6 ? 0 : seed >> 33;
+	  }
+
+	  *judy_cell (judy, keys[idx], 20) = 1;
+	}
+
+	qsort (keys, 1500, 20, test_binsort);
+
+	for( cnt = 1, idx = 1; idx < 1500; idx++ )
+	  if( memcmp (keys[idx], keys[cnt - 1], 20) )
+		memcpy (keys[cnt++], keys[idx], 20);
+
+	for( bad = idx = 0; idx < cnt; idx++ ) {
+		bad += !(cell = judy_slot (judy, keys[idx], 20)) || *cell != 1;
+		bad += judy_key (judy, buff, sizeof(buff)) != 20 || memcmp (buff, keys[idx], 20);
+
+		//	one above a key is absent, unless it is the
+		//	next key, and its lower bound is the next key
+
+		memcpy (probe, keys[idx], 20);
+
+		for( pos = 20; pos-- && !++probe[pos]; );
+
+		if( (cell = judy_strt (judy, probe, 20)) )
+			judy_key (judy, buff, sizeof(buff));
+
+		bad += idx + 1 < cnt ? !cell || memcmp (buff, keys[idx + 1], 20) : cell != NULL;
+
+		//	a shorter key is padded with zero bytes
+
+		len = idx % 19 + 1;
+		memset (probe, 0, 20);
+		memcpy (probe, keys[idx], len);
+
+		for( lo = 0, hi = cnt; lo < hi; )
+		  if( memcmp (keys[(lo + hi) / 2], probe, 20) < 0 )
+			lo = (lo + hi) / 2 + 1;
+		  else
+			hi = (lo + hi) / 2;
+
+		if( (cell = judy_strt (judy, keys[idx], len)) )
+			judy_key (judy, buff, sizeof(buff));
+
+		bad += !cell || memcmp (buff, keys[lo], 20);
+	}
+
+	judy_expect (!bad, "binary key lookups and lower bounds");
+
+	for( idx = 0; idx < cnt; idx++ ) {
+		ptrs[idx] = keys[idx];
+		lens[idx] = 20;
+		values[idx] = idx + 1;
+	}
+
+	load = judy_open_seg (20, 0, 0, JUDY_binary);
+	judy_load_sorted (load, ptrs, lens, values, cnt);
+
+	for( bad = lo = 0, cell = judy_strt (judy, NULL, 0); cell; cell = judy_nxt (judy), lo++ ) {
+		judy_key (judy, buff, sizeof(buff));
+		bad += lo >= cnt || memcmp (buff, keys[lo], 20);
+		bad += !(cell = judy_slot (load, buff, 20)) || *cell != lo + 1;
+	}
+
+	judy_expect (!bad && lo == cnt, "binary key order and judy_load_sorted");
+	judy_close (load);
+	judy_close (judy);
+}
+
+//	kept subtree counts: judy_rank, judy_select and
+//	judy_count_prefix against a sorted list, after
+//	inserts and deletes made once the counts are kept
+
+void test_rank (void)
+{
+uchar keys[3000][26], buff[26];
+uint idx, pos, len, cnt, bad, want, rank;
+uchar present[3000];
+judyvalue seed = 19;
+JudySlot *cell;
+Judy *judy;
+
+	for( idx = 0; idx < 3000; idx++ ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		len = 1 + (seed >> 33) % 24;
+
+		for( pos = 0; pos < len; pos++ )
+			keys[idx][pos] = 'a' + (seed >> (pos * 2 + 10) & 3);
+
+		keys[idx][len] = 0;
+	}
+
+	qsort (keys, 3000, sizeof(keys[0]), test_strsort);
+
+	for( cnt = 1, idx = 1; idx < 3000; idx++ )
+	  if( strcmp ((char *)keys[idx], (char *)keys[cnt - 1]) )
+		memcpy (keys[cnt++], keys[idx], sizeof(keys[0]));
+
+	judy = judy_open (26, 0);
+	memset (present, 0, sizeof(present));
+
+	for( idx = 0; idx < cnt; idx += 2 ) {
+		*judy_cell (judy, keys[idx], strlen ((char *)keys[idx])) = 1;
+		present[idx] = 1;
+	}
+
+	judy_expect (judy_rank (judy, keys[cnt - 1], strlen ((char *)keys[cnt - 1])) == (cnt - 1) / 2 + ((cnt - 1) & 1), "rank of the last key");
+
+	//	change the array once the counts are kept
+
+	for( idx = 0; idx < cnt; idx++ )
+	  if( idx % 4 == 1 ) {
+		*judy_cell (judy, keys[idx], strlen ((char *)keys[idx])) = 1;
+		present[idx] = 1;
+	  } else if( idx % 8 == 0 && judy_slot (judy, keys[idx], strlen ((char *)keys[idx])) ) {
+		judy_del (judy);
+		present[idx] = 0;
+	  }
+
+	for( bad = rank = idx = 0; idx < cnt; rank += present[idx++] ) {
+		len = strlen ((char *)keys[idx]);
+		bad += judy_rank (judy, keys[idx], len) != rank;
+
+		if( present[idx] ) {
+			cell = judy_select (judy, rank);
+			bad += !cell || judy_key (judy, buff, sizeof(buff)) != len || memcmp (buff, keys[idx], len);
+		}
+
+		if( idx % 10 )
+			continue;
+
+		for( want = pos = 0; pos < cnt; pos++ )
+		  if( present[pos] && !strncmp ((char *)keys[pos], (char *)keys[idx], len / 2 + 1) )
+			want++;
+
+		bad += judy_count_prefix (judy, keys[idx], len / 2 + 1) != want;
+	}
+
+	judy_expect (!bad, "rank, select and prefix counts after changes");
+	judy_expect (!judy_select (judy, rank) && judy_select (judy, rank - 1), "select past the last key");
+	judy_close (judy);
+}
+
+//	integer keys ending in zero bytes added after the
+//	key counts are kept, which can match a vacant slot
+
+void test_zerotail (void)
+{
+judyvalue seed = 1, key[2], top[2];
+uint idx, added, depth;
+JudySlot *cell;
+Judy *judy;
+
+	for( depth = 1; depth <= 2; depth++ ) {
+		judy = judy_open (8 * depth, depth);
+		top[0] = top[1] = ~(judyvalue)0;
+		added = 0;
+
+		for( idx = 0; idx < 600; idx++ ) {
+			seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+			key[0] = idx % 3;
+			key[depth - 1] = (seed >> 40 & 0xffff) | 1;
+			cell = depth > 1 ? judy_cell128 (judy, key) : judy_cell64 (judy, key[0]);
+			added += !*cell;
+			*cell = 1;
+		}
+
+		judy_expect (judy_rank (judy, (uchar *)top, 0) == added, "rank before zero tail keys");
+
+		for( idx = 1; idx <= 255; idx++ ) {
+			key[0] = idx % 3;
+			key[depth - 1] = (judyvalue)idx << 8;
+			cell = depth > 1 ? judy_cell128 (judy, key) : judy_cell64 (judy, key[0]);
+			added += !*cell;
+			*cell = 1;
+		}
+
+		judy_expect (judy_rank (judy, (uchar *)top, 0) == added, "rank after zero tail keys");
+		judy_expect (judy_count_prefix (judy, (uchar *)top, 0) == added, "count after zero tail keys");
+		judy_expect (judy_select (judy, added - 1) && !judy_select (judy, added), "select after zero tail keys");
+		judy_close (judy);
+	}
+}
+
+//	bulk deletes: ranges and prefixes taken out of
+//	string and integer arrays refilled between rounds,
+//	against a sorted list of the keys present, then
+//	under concurrent readers
+
+uint test_remaining (Judy *judy, uchar (*keys)[14], judyvalue *ints, uchar *present, uint cnt)
+{
+uchar buff[14];
+judyvalue value;
+JudySlot *cell;
+uint idx, bad;
+
+	for( idx = 0; idx < cnt && !present[idx]; idx++ );
+
+	for( bad = 0, cell = judy_strt (judy, NULL, 0); cell; cell = judy_nxt (judy) ) {
+		if( idx == cnt || !*cell )
+			return 1;
+
+		if( ints )
+			judy_key (judy, (uchar *)&value, sizeof(value)), bad += value != ints[idx];
+		else
+			judy_key (judy, buff, sizeof(buff)), bad += strcmp ((char *)buff, (char *)keys[idx]) != 0;
+
+		for( idx++; idx < cnt && !present[idx]; idx++ );
+	}
+
+	return bad || idx < cnt;
+}
+
+void test_delrange (void)
+{
+uchar keys[2000][14], present[2000], prefix[14];
+uint idx, pos, len, lo, hi, cnt, bad, want, round, depth;
+judyvalue seed = 23, ints[2000];
+Judy *judy;
+
+	for( idx = 0; idx < 2000; idx++ ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		len = 1 + (seed >> 33) % 12;
+
+		for( pos = 0; pos < len; pos++ )
+			keys[idx][pos] = 'a' + (seed >> (pos * 2 + 8) & 3);
+
+		keys[idx][len] = 0;
+		ints[idx] = seed >> 40 << 40 | (seed >> 20 & 0xff) << 24 | idx << 1 | 1;
+	}
+
+	qsort (keys, 2000, sizeof(keys[0]), test_strsort);
+	qsort (ints, 2000, sizeof(judyvalue), test_valuesort);
+
+	for( cnt = 1, idx = 1; idx < 2000; idx++ )
+	  if( strcmp ((char *)keys[idx], (char *)keys[cnt - 1]) )
+		memcpy (keys[cnt++], keys[idx], sizeof(keys[0]));
+
+	for( depth = 0; depth <= 1; depth++ ) {
+	  judy = judy_open (14, depth);
+	  memset (present, 0, sizeof(present));
+
+	  if( depth )
+		cnt = 2000;
+
+	  for( bad = round = 0; round < 40; round++ ) {
+		for( idx = 0; idx < cnt; idx++ ) {
+		  seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+
+		  if( present[idx] || seed >> 62 )
 			continue;
-#endif
+
+		  if( depth )
+			*judy_cell (judy, (uchar *)(ints + idx), 0) = idx + 1;
+		  else
+			*judy_cell (judy, keys[idx], strlen ((char *)keys[idx])) = idx + 1;
+
+		  present[idx] = 1;
+		}
+
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		lo = (seed >> 33) % cnt;
+		hi = lo + (seed >> 45) % (cnt - lo);
+
+		if( round % 2 ) {		// a range, open at an end now and then
+		  if( round % 10 == 1 )
+			lo = 0;
+		  if( round % 10 == 3 )
+			hi = cnt - 1;
+
+		  for( want = 0, idx = lo; idx <= hi; idx++ )
+			want += present[idx], present[idx] = 0;
+
+		  if( depth )
+			bad += judy_del_range (judy, round % 10 == 1 ? NULL : (uchar *)(ints + lo), 0, round % 10 == 3 ? NULL : (uchar *)(ints + hi), 0) != want;
+		  else
+			bad += judy_del_range (judy, round % 10 == 1 ? NULL : keys[lo], strlen ((char *)keys[lo]), round % 10 == 3 ? NULL : keys[hi], strlen ((char *)keys[hi])) != want;
+		} else {				// a prefix of a key
+		  len = 1 + (seed >> 20) % (depth ? 7 : strlen ((char *)keys[lo]));
+
+		  for( pos = 0; pos < len; pos++ )
+			prefix[pos] = depth ? ints[lo] >> (56 - pos * 8) : keys[lo][pos];
+
+		  for( want = idx = 0; idx < cnt; idx++ )
+			if( depth ? ints[idx] >> (64 - len * 8) == ints[lo] >> (64 - len * 8) : !strncmp ((char *)keys[idx], (char *)prefix, len) )
+			  want += present[idx], present[idx] = 0;
+
+		  bad += judy_del_prefix (judy, prefix, len) != want;
 		}
+
+		bad += test_remaining (judy, keys, depth ? ints : NULL, present, cnt);
+	  }
+
+	  judy_expect (!bad, depth ? "integer range and prefix deletes" : "string range and prefix deletes");
+	  judy_close (judy);
 	}
+}
 
-	// place JUDY_1 node under JUDY_radix node(s)
+void test_delconcurrent (void)
+{
+JudyReadCheck check[3];
+uchar buff[64], lo[8], hi[8];
+judyvalue seed = 29;
+uint idx, id, now, done = 0;
+JudySlot *cell;
+Judy *judy;
+uint len;
+#ifdef _WIN32
+HANDLE thread[3];
+#else
+pthread_t thread[3];
+#endif
 
-#ifndef ASKITIS
-	if( off & JUDY_key_mask )
-	 if( judy->depth || off <= max ) {
+	judy = judy_open (64, 0);
+
+	for( id = 0; id < 256; id++ ) {
+		len = judy_testkey (buff, id);
+		*judy_cell (judy, buff, len) = id + 1;
+	}
+
+	judy_concurrent (judy, 3);
+
+	for( idx = 0; idx < 3; idx++ ) {
+		check[idx].judy = judy_clone (judy);
+		check[idx].done = &done;
+		check[idx].passes = check[idx].bad = 0;
+#ifdef _WIN32
+		thread[idx] = CreateThread (NULL, 0, test_reader, check + idx, 0, NULL);
 #else
-	  while( off <= max ) {
+		pthread_create (thread + idx, NULL, test_reader, check + idx);
 #endif
-		base = judy_alloc (judy, JUDY_1);
-		keysize = JUDY_key_size - (off & JUDY_key_mask);
-		node = (JudySlot  *)(base + JudySize[JUDY_1]);
-		*next = (JudySlot)base | JUDY_1;
+	}
 
-		//	fill in slot 0 with bytes of key
+	//	keys of ids from 256 start "01" thru "0f", and
+	//	are taken out a range or a prefix at a time
+
+	for( idx = 0; idx < 200000; idx++ ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		id = 256 + (seed >> 33) % 3840;
+		len = judy_testkey (buff, id);
+
+		if( (cell = judy_cell (judy, buff, len)) )
+			*cell = id + 1;
+
+		if( idx % 1000 == 999 )
+		  if( idx % 2000 == 999 ) {
+			sprintf ((char *)lo, "0%x", (uint)(seed >> 20) % 15 + 1);
+			judy_del_prefix (judy, lo, 2);
+		  } else {
+			sprintf ((char *)lo, "0%x", (uint)(seed >> 20) % 15 + 1);
+			sprintf ((char *)hi, "0%x", (uint)(seed >> 24) % 15 + 1);
+			judy_del_range (judy, strcmp ((char *)lo, (char *)hi) < 0 ? lo : hi, 2, strcmp ((char *)lo, (char *)hi) < 0 ? hi : lo, 2);
+		  }
+	}
 
-		if( judy->depth ) {
-			value = src[depth];
-#if BYTE_ORDER != BIG_ENDIAN
-			  memcpy(base, &value, keysize);	// copy new key into slot
+	JUDY_store (&done, 1);
+
+	for( idx = 0; idx < 3; idx++ ) {
+#ifdef _WIN32
+		WaitForSingleObject (thread[idx], INFINITE);
+		CloseHandle (thread[idx]);
 #else
-			  while( keysize-- )
-				  base[keysize] = value, value >>= 8;
+		pthread_join (thread[idx], NULL);
 #endif
+		judy_expect (check[idx].passes > 0, "reader made progress through bulk deletes");
+		judy_expect (!check[idx].bad, "reader saw only live keys through bulk deletes");
+	}
+
+	//	the epoch may only advance between bulk deletes
+
+	judy->epoch->retired = JUDY_retire - 1;
+	now = judy->epoch->global;
+	judy_del_range (judy, (uchar *)"01", 2, (uchar *)"0g", 2);
+	judy_expect (judy->epoch->retired >= JUDY_retire && judy->epoch->global == now, "epoch held during a bulk delete");
+	judy_del_prefix (judy, (uchar *)"00ff", 4);
+	judy_expect (judy->epoch->global == now + 1, "epoch advanced between bulk deletes");
+
+	judy_close (judy);
+}
+
+//	write ahead log: changes made to a logged array
+//	and to an unlogged copy, including deletes, bulk
+//	deletes, sorted loads and snapshots, must come back
+//	from recovery, also past a torn record and with
+//	snapshots taken by a reader clone as the writer goes
+
+#define JUDY_testlog "judytest.log"
+
+void test_walclean (void)
+{
+char path[64];
+uint gen;
+
+	remove (JUDY_testlog);
+	remove (JUDY_testlog ".tmp");
+
+	for( gen = 1; gen < 1000; gen++ ) {
+		sprintf (path, JUDY_testlog ".%u", gen);
+		remove (path);
+	}
+}
+
+uint test_walsame (Judy *judy, Judy *check)
+{
+JudySlot *cell, *want;
+uint len, cnt = 0, bad = 0;
+uchar buff[16];
+
+	for( cell = judy_strt (check, NULL, 0); cell; cell = judy_nxt (check), cnt++ ) {
+		len = judy_key (check, buff, sizeof(buff));
+		bad += !(want = judy_slot (judy, buff, len)) || *want != *cell;
+	}
+
+	for( cell = judy_strt (judy, NULL, 0); cell; cell = judy_nxt (judy) )
+		cnt--;
+
+	return bad || cnt;
+}
+
+void test_walops (Judy *judy, Judy *check, judyvalue *seed, uint ops)
+{
+uchar key[16], hi[16];
+uint idx, len, hilen;
+
+	for( idx = 0; idx < ops; idx++ ) {
+		*seed = *seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		len = sprintf ((char *)key, "k%04x", (uint)(*seed >> 33) % 20000);
+
+		if( idx % 997 == 996 ) {
+			hilen = sprintf ((char *)hi, "k%04x", (uint)(*seed >> 17) % 20000);
+
+			if( strcmp ((char *)key, (char *)hi) > 0 ) {
+				judy_del_range (judy, hi, hilen, key, len);
+				judy_del_range (check, hi, hilen, key, len);
+			} else {
+				judy_del_range (judy, key, len, hi, hilen);
+				judy_del_range (check, key, len, hi, hilen);
+			}
+		} else if( idx % 1499 == 1498 ) {
+			judy_del_prefix (judy, key, 3);
+			judy_del_prefix (check, key, 3);
+		} else if( *seed >> 62 ) {
+			*judy_cell (judy, key, len) = *seed >> 40 | 1;
+			*judy_cell (check, key, len) = *seed >> 40 | 1;
 		} else {
-#if BYTE_ORDER != BIG_ENDIAN
-		  while( keysize )
-			if( off + keysize <= max )
-				*base++ = buff[off + --keysize];
-			else
-				base++, --keysize;
+			if( judy_slot (judy, key, len) )
+				judy_del (judy);
+			if( judy_slot (check, key, len) )
+				judy_del (check);
+		}
+	}
+}
+
+typedef struct {
+	Judy *judy;			// the logged array
+	Judy *view;			// its reader clone
+	uint *done;			// the writer has finished
+	uint passes;		// snapshots taken
+	uint bad;			// snapshots failed
+} JudySnapCheck;
+
+#ifdef _WIN32
+DWORD WINAPI test_snapper (void *arg)
 #else
-		  tst = keysize;
+void *test_snapper (void *arg)
+#endif
+{
+JudySnapCheck *check = (JudySnapCheck *)arg;
+
+	while( !JUDY_load (check->done) ) {
+		check->bad += !judy_snapshot (check->judy, check->view);
+		check->passes++;
+	}
+
+	return 0;
+}
+
+void test_wal (void)
+{
+uchar sorted[300][16], *keys[300];
+judyvalue seed = 31, junk = ~(judyvalue)0;
+JudySlot values[300];
+JudySnapCheck snap[1];
+Judy *judy, *check;
+uint idx, lens[300], gen, last, done = 0;
+char path[64];
+FILE *file;
+#ifdef _WIN32
+HANDLE thread;
+#else
+pthread_t thread;
+#endif
+
+	test_walclean ();
+	judy = judy_open (16, 0);
+	check = judy_open (16, 0);
+	judy_expect (judy_log_open (judy, JUDY_testlog, 0), "log opens");
+
+	test_walops (judy, check, &seed, 6000);
+	judy_expect (judy_snapshot (judy, judy), "snapshot");
+	test_walops (judy, check, &seed, 6000);
+
+	for( idx = 0; idx < 300; idx++ ) {
+		lens[idx] = sprintf ((char *)sorted[idx], "m%04u", idx);
+		keys[idx] = sorted[idx];
+		values[idx] = idx + 1;
+	}
+
+	judy_load_sorted (judy, keys, lens, values, 300);
+	judy_load_sorted (check, keys, lens, values, 300);
+	test_walops (judy, check, &seed, 3000);
+	judy_close (judy);
+
+	judy = judy_open (16, 0);
+	judy_expect (judy_log_open (judy, JUDY_testlog, 0), "log reopens");
+	judy_expect (!test_walsame (judy, check), "log recovers a snapshot and the changes after it");
+
+	test_walops (judy, check, &seed, 3000);
+	judy_expect (judy_snapshot (judy, judy), "second snapshot");
+	test_walops (judy, check, &seed, 1000);
+	judy_close (judy);
+
+	//	a crash tearing the last record
+
+	for( last = 0, gen = 1; gen < 1000; gen++ ) {
+		sprintf (path, JUDY_testlog ".%u", gen);
+		if( (file = fopen (path, "rb")) )
+			fclose (file), last = gen;
+	}
+
+	sprintf (path, JUDY_testlog ".%u", last);
+
+	if( (file = fopen (path, "ab")) ) {
+		fwrite (&junk, sizeof(junk), 1, file);
+		fwrite (&seed, sizeof(seed), 1, file);
+		fclose (file);
+	}
+
+	judy = judy_open (16, 0);
+	judy_expect (judy_log_open (judy, JUDY_testlog, 0), "log reopens after a torn record");
+	judy_expect (!test_walsame (judy, check), "replay stops at a torn record");
+	judy_close (judy);
+	judy_close (check);
+
+	//	snapshots taken by a reader clone while the
+	//	writer logs changes and deletes
+
+	test_walclean ();
+	judy = judy_open (16, 0);
+	check = judy_open (16, 0);
+	judy_log_open (judy, JUDY_testlog, 0);
+	judy_concurrent (judy, 1);
+
+	snap->judy = judy;
+	snap->view = judy_clone (judy);
+	snap->done = &done;
+	snap->passes = snap->bad = 0;
+#ifdef _WIN32
+	thread = CreateThread (NULL, 0, test_snapper, snap, 0, NULL);
+#else
+	pthread_create (&thread, NULL, test_snapper, snap);
+#endif
+
+	test_walops (judy, check, &seed, 150000);
+	JUDY_store (&done, 1);
+
+#ifdef _WIN32
+	WaitForSingleObject (thread, INFINITE);
+	CloseHandle (thread);
+#else
+	pthread_join (thread, NULL);
+#endif
+	judy_expect (snap->passes > 0 && !snap->bad, "snapshots from a reader clone");
+	judy_close (judy);
+
+	judy = judy_open (16, 0);
+	judy_expect (judy_log_open (judy, JUDY_testlog, 0), "log reopens after concurrent snapshots");
+	judy_expect (!test_walsame (judy, check), "recovery from snapshots taken during changes");
+	judy_close (judy);
+	judy_close (check);
+	test_walclean ();
+}
+
+//	pennysort: records with random and repeated keys
+//	sorted into many runs and merged on several
+//	threads must come out in key order, holding just
+//	the records that went in
+
+int test_recsort (const void *a, const void *b)
+{
+	return memcmp (a, b, PennyLine);
+}
+
+//	sort and merge count records on the threads given,
+//	returning the output file's bytes, or NULL when it
+//	is not the size of the input
+
+uchar *test_pennyrun (uchar *recs, uint count, uint threads)
+{
+uint size = count * PennyLine, idx;
+char filename[64];
+uchar *sorted;
+FILE *in, *out;
+
+	if( (in = fopen ("judytest.in", "wb")) )
+		fwrite (recs, 1, size, in), fclose (in);
+
+	in = fopen ("judytest.in", "rb");
+	out = fopen ("judytest.out", "wb");
+
+	if( !in || !out )
+		return NULL;
+
+	PennyThreads = threads;
+	PennyMerge = (unsigned long long)PennyLine * PennyRecs;
+	sort (in, "judytest.out");
+	merge (out, "judytest.out");
+	fclose (in);
+
+	for( idx = 0; idx < PennyPasses; idx++ ) {
+		sprintf (filename, "judytest.out.%d", idx);
+		remove (filename);
+	}
+
+	sorted = malloc (size + 1);
+
+	if( !(out = fopen ("judytest.out", "rb")) || fread (sorted, 1, size + 1, out) != size )
+		free (sorted), sorted = NULL;
+
+	if( out )
+		fclose (out);
+
+	remove ("judytest.in");
+	remove ("judytest.out");
+	return sorted;
+}
+
+uint test_penny (uchar *recs, uint count, uint threads)
+{
+uchar *sorted = test_pennyrun (recs, count, threads);
+uint idx, bad = 0;
+
+	if( !sorted )
+		return 1;
+
+	for( idx = 1; idx < count; idx++ )
+	  if( memcmp (sorted + idx * PennyLine + PennyOff, sorted + (idx - 1) * PennyLine + PennyOff, PennyKey) < 0 )
+		bad++;
+
+	qsort (recs, count, PennyLine, test_recsort);
+	qsort (sorted, count, PennyLine, test_recsort);
+	bad += count && memcmp (recs, sorted, count * PennyLine);
+	free (sorted);
+	return bad;
+}
+
+void test_pennysort (void)
+{
+judyvalue seed = 37;
+uint idx, pos;
+uchar *recs;
+
+	recs = malloc (10000 * 100);
+
+	//	pennysort records: ten byte keys in 100 bytes,
+	//	1024 records to a run
+
+	PennyLine = 100, PennyKey = 10, PennyOff = 0, PennyRecs = 1024;
+
+	for( idx = 0; idx < 10000 * 100; idx++ ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		recs[idx] = ' ' + (seed >> 33) % 95;
+	}
+
+	judy_expect (!test_penny (recs, 10000, 1), "pennysort on one thread");
+	judy_expect (!test_penny (recs, 10000, 4), "pennysort on four threads");
+	judy_expect (!test_penny (recs, 1, 2), "pennysort of one record");
+	judy_expect (!test_penny (recs, 0, 2), "pennysort of no records");
+
+	//	keys of few values at an offset, and more runs
+	//	than records in each
+
+	PennyLine = 64, PennyKey = 8, PennyOff = 5, PennyRecs = 64;
+
+	for( idx = 0; idx < 5000; idx++ )
+	  for( pos = 0; pos < 8; pos++ ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		recs[idx * 64 + 5 + pos] = 'a' + (seed >> 33) % (pos < 6 ? 1 : 3);
+	  }
+
+	judy_expect (!test_penny (recs, 5000, 3), "pennysort of repeated keys at an offset");
+	free (recs);
+}
+
+//	loser tree merges: run counts that are and are not
+//	powers of two, and keys repeated across the runs.
+//	equal keys come out in run order, each run giving
+//	its latest record first as its judy duplicate chain
+//	does, whatever the thread count.  the judy merge
+//	keeps no such order.
+
+uchar *JudyTestRecs;
+
+int test_runorder (const void *a, const void *b)
+{
+uint x = *(uint *)a, y = *(uint *)b;
+int cmp;
+
+	if( (cmp = memcmp (JudyTestRecs + x * PennyLine + PennyOff, JudyTestRecs + y * PennyLine + PennyOff, PennyKey)) )
+		return cmp;
+
+	if( x / PennyRecs != y / PennyRecs )
+		return x / PennyRecs < y / PennyRecs ? -1 : 1;
+
+	return x < y ? 1 : x > y ? -1 : 0;
+}
+
+void test_losertree (void)
+{
+uint runs[] = {1, 2, 3, 5, 8, 13, 31};
+uint idx, pos, cnt, bad, *order;
+uchar *recs, *want, *out;
+judyvalue seed = 41;
+
+	PennyLine = 32, PennyKey = 6, PennyOff = 2, PennyRecs = 128;
+	JudyTestRecs = recs = malloc (31 * 128 * 32);
+	want = malloc (31 * 128 * 32);
+	order = malloc (31 * 128 * sizeof(uint));
+
+	for( idx = 0; idx < 31 * 128; idx++ )
+	  for( pos = 0; pos < 32; pos++ ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		recs[idx * 32 + pos] = pos < 2 || pos > 7 ? '0' + (idx >> pos % 8) % 10 : 'a' + (seed >> 33) % (pos < 7 ? 1 : 4);
+	  }
+
+	for( idx = 0; idx < sizeof(runs) / sizeof(uint); idx++ ) {
+		cnt = runs[idx] * 128 - 17;
+
+		for( pos = 0; pos < cnt; pos++ )
+			order[pos] = pos;
+
+		qsort (order, cnt, sizeof(uint), test_runorder);
+
+		for( pos = 0; pos < cnt; pos++ )
+			memcpy (want + pos * 32, recs + order[pos] * 32, 32);
+
+		for( bad = 0, pos = 1; pos <= 4; pos += 3 ) {
+			out = test_pennyrun (recs, cnt, pos);
+#ifdef JUDYMERGE
+			bad += !out;
+#else
+			bad += !out || memcmp (out, want, cnt * 32);
+#endif
+			free (out);
+		}
+
+		judy_expect (!bad, "loser tree merges equal keys in run order");
+	}
+
+	free (order);
+	free (want);
+	free (recs);
+}
+
+//	temp file i/o: records put and read through blocks
+//	they do not divide, ranges read from inside a file,
+//	writes into an existing file, and sorts whose runs
+//	and output span several blocks
+
+void test_pennyio (void)
+{
+uint idx, cnt, bad, size;
+uchar *recs, *back, rec[24];
+judyvalue seed = 43;
+unsigned long long written;
+PennyIo *io;
+FILE *file;
+
+	PennyLine = 24;
+	recs = malloc (5000 * 24);
+	back = malloc (5000 * 24 + 1);
+
+	for( idx = 0; idx < 5000 * 24; idx++ ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		recs[idx] = 'a' + (seed >> 33) % 26;
+	}
+
+	//	block sizes below the alignment, of records and
+	//	a part, and of more than the file, with records
+	//	put one at a time and all at once
+
+	for( bad = 0, size = 1; size < 400000; size = size * 3 + 4100 ) {
+		written = PennyWrite;
+		io = penny_open ("judytest.io", 1, 0, 0, size);
+
+		if( size > 100000 )
+			penny_put (io, recs, 5000 * 24);
+		else for( idx = 0; idx < 5000; idx++ )
+			penny_put (io, recs + idx * 24, 24);
+
+		penny_close (io);
+		bad += PennyWrite - written != 5000 * 24;
+
+		if( (file = fopen ("judytest.io", "rb")) )
+			bad += fread (back, 1, 5000 * 24 + 1, file) != 5000 * 24 || memcmp (back, recs, 5000 * 24), fclose (file);
+		else
+			bad++;
+
+		//	a range from inside the file
+
+		io = penny_open ("judytest.io", 0, 37 * 24, 3001 * 24, size);
+
+		for( cnt = 0; penny_read (io, rec, 24) == 24; cnt++ )
+			bad += cnt >= 3001 || memcmp (rec, recs + (37 + cnt) * 24, 24);
+
+		bad += cnt != 3001 || penny_read (io, rec, 24) != 0;
+		penny_close (io);
+
+		//	overwrite the records of a range in place
+
+		io = penny_open ("judytest.io", 2, 100 * 24, 0, size);
+
+		for( idx = 0; idx < 777; idx++ )
+			penny_put (io, recs + (4999 - idx) * 24, 24);
+
+		penny_close (io);
+		io = penny_open ("judytest.io", 0, 0, 5000 * 24, size);
+
+		for( cnt = 0; penny_read (io, rec, 24) == 24; cnt++ )
+		  if( cnt >= 100 && cnt < 877 )
+			bad += memcmp (rec, recs + (4999 - cnt + 100) * 24, 24) != 0;
+		  else
+			bad += memcmp (rec, recs + cnt * 24, 24) != 0;
+
+		bad += cnt != 5000;
+		penny_close (io);
+
+		//	a read running past the end of the range
+
+		io = penny_open ("judytest.io", 0, 4990 * 24, 10 * 24, size);
+		bad += penny_read (io, back, 11 * 24) != 10 * 24 || memcmp (back, recs + 4990 * 24, 10 * 24);
+		penny_close (io);
+	}
+
+	judy_expect (!bad, "temp file blocks put, read and rewritten");
+	remove ("judytest.io");
+
+	//	an empty range reads nothing
+
+	io = penny_open ("judytest.io", 1, 0, 0, 4096);
+	penny_close (io);
+	io = penny_open ("judytest.io", 0, 0, 0, 4096);
+	judy_expect (!penny_read (io, back, 24), "empty temp file range");
+	penny_close (io);
+	remove ("judytest.io");
+	free (back);
+	free (recs);
+
+	//	runs and output larger than the merge blocks of
+	//	four threads, with a record length that does not
+	//	divide the blocks
+
+	PennyLine = 96, PennyKey = 12, PennyOff = 7, PennyRecs = 4096 * 4;
+	recs = malloc (70001 * 96);
+
+	for( idx = 0; idx < 70001 * 96; idx++ ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		recs[idx] = ' ' + (seed >> 33) % 95;
+	}
 
-		  if( tst > (int)(max - off) )
-			tst = max - off;
+	judy_expect (!test_penny (recs, 70001, 4), "pennysort over several i/o blocks");
+	free (recs);
+}
 
-		  memcpy (base, buff + off, tst);
-#endif
+//	temp file coding: lz packing of blocks of random,
+//	repeated and mixed bytes, key prefixes of more than
+//	a byte's coding, and sorts with each PennyPack that
+//	must give the same output from smaller run files
+
+void test_pennypack (void)
+{
+uint shares[] = {0, 1, 127, 128, 200, 299, 300};
+uint idx, pos, len, cnt, bad, pack, shared;
+uchar *src, *dst, *back, *recs, *want, *out[3];
+unsigned long long written[3];
+judyvalue seed = 47;
+uint *order;
+
+	src = malloc (65536);
+	dst = malloc (65536);
+	back = malloc (65536);
+
+	for( bad = 0, idx = 0; idx < 5; idx++ ) {
+		len = idx < 4 ? 65536 : 9;
+
+		for( pos = 0; pos < len; pos++ ) {
+			seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+
+			switch( idx ) {
+			case 0:		// random bytes do not pack
+				src[pos] = seed >> 33;
+				break;
+			case 1:		// one byte repeated
+				src[pos] = 'x';
+				break;
+			case 2:		// runs of literals between repeats
+				src[pos] = pos % 1000 < 300 ? seed >> 33 : src[pos % 700];
+				break;
+			default:	// text of a few words
+				src[pos] = pos % 7 ? 'a' + (seed >> 33) % 3 : ' ';
+			}
 		}
-#ifndef ASKITIS
-		if( judy->level < judy->max )
-			judy->level++;
-		judy->stack[judy->level].next = *next;
-		judy->stack[judy->level].slot = 0;
-		judy->stack[judy->level].off = off;
-#endif
-		next = &node[-1];
 
-		off |= JUDY_key_mask;
-		depth++;
-		off++;
+		if( (cnt = penny_lz (src, len, dst)) ) {
+			memset (back, 0, len);
+			penny_unlz (dst, cnt, back);
+			bad += cnt >= len || memcmp (back, src, len);
+		}
+
+		bad += idx % 4 ? !cnt : cnt != 0;
 	}
 
-	//	produce span nodes to consume rest of key
-	//  or judy_1 nodes if not string tree
+	judy_expect (!bad, "temp file blocks lz packed and unpacked");
 
-#ifndef ASKITIS
-	if( !judy->depth )
-	  while( off <= max ) {
-		base = judy_alloc (judy, JUDY_span);
-		*next = (JudySlot)base | JUDY_span;
-		node = (JudySlot  *)(base + JudySize[JUDY_span]);
-		cnt = tst = JUDY_span_bytes;
-		if( tst > (int)(max - off) )
-			tst = max - off;
-		memcpy (base, buff + off, tst);
+	//	records sharing more key bytes than a byte codes
 
-		if( judy->level < judy->max )
-			judy->level++;
-		judy->stack[judy->level].next = *next;
-		judy->stack[judy->level].slot = 0;
-		judy->stack[judy->level].off = off;
-		next = &node[-1];
-		off += tst;
-		depth++;
+	PennyLine = 400, PennyKey = 300, PennyOff = 50, PennyPack = 1;
 
-		if( !base[cnt-1] )	// done on leaf
-			break;
-	  }
-	else
-	  while( depth < judy->depth ) {
-		base = judy_alloc (judy, JUDY_1);
-		node = (JudySlot  *)(base + JudySize[JUDY_1]);
-		*next = (JudySlot)base | JUDY_1;
+	for( pos = 0; pos < 800; pos++ )
+		src[pos] = 'a' + pos % 23;
 
-		//	fill in slot 0 with bytes of key
+	for( bad = idx = 0; idx < sizeof(shares) / sizeof(uint); idx++ ) {
+		shared = shares[idx];
+		memcpy (src + 400, src, 400);
+		src[400 + PennyOff + shared] ^= shared < PennyKey;
+		len = penny_code (dst, src + 400, 400, src + PennyOff, PennyKey);
+		memcpy (back, src, 400);
+		bad += penny_decode (dst, back, &cnt) != dst + len || cnt != 400 || memcmp (back, src + 400, 400);
+		bad += len != (shared < 128 ? 1 : 2) + 400 - shared;
+	}
 
-		*(judyvalue *)base = src[depth];
+	judy_expect (!bad, "records coded after their shared key bytes");
 
-		if( judy->level < judy->max )
-			judy->level++;
-		judy->stack[judy->level].next = *next;
-		judy->stack[judy->level].slot = 0;
-		judy->stack[judy->level].off = off;
-		next = &node[-1];
-		off |= JUDY_key_mask;
-		depth++;
-		off++;
+	//	sorts of long records with long shared keys
+
+	PennyLine = 256, PennyKey = 200, PennyOff = 30, PennyRecs = 512;
+	JudyTestRecs = recs = malloc (5000 * 256);
+	want = malloc (5000 * 256);
+	order = malloc (5000 * sizeof(uint));
+
+	for( idx = 0; idx < 5000; idx++ )
+	  for( pos = 0; pos < 256; pos++ ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		recs[idx * 256 + pos] = pos >= 230 ? 'a' + pos % 5 : pos < 30 ? 'a' + (seed >> 33) % 4 : pos < 190 ? 'k' : 'a' + (seed >> 33) % (pos < 198 ? 2 : 10);
 	  }
-#endif
 
-	return next;
-}
+	for( idx = 0; idx < 5000; idx++ )
+		order[idx] = idx;
 
-#if defined(STANDALONE) || defined(ASKITIS)
+	qsort (order, 5000, sizeof(uint), test_runorder);
 
-#if defined(__APPLE__) || defined(linux)
-#include <fcntl.h>
-#include <unistd.h>
-#include <errno.h>
-#include <sys/mman.h>
-#include <sys/times.h>
+	for( idx = 0; idx < 5000; idx++ )
+		memcpy (want + idx * 256, recs + order[idx] * 256, 256);
+
+	for( bad = pack = 0; pack < 3; pack++ ) {
+		PennyPack = pack;
+		written[pack] = PennyWrite;
+		out[pack] = test_pennyrun (recs, 5000, 4);
+		written[pack] = PennyWrite - written[pack];
+#ifdef JUDYMERGE
+		bad += !out[pack] || memcmp (out[pack], out[0], 5000 * 256);
 #else
-#include <windows.h>
-#include <io.h>
+		bad += !out[pack] || memcmp (out[pack], want, 5000 * 256);
 #endif
+	}
 
-#include <time.h>
+	judy_expect (!bad, "pennysort output the same with each coding");
+	judy_expect (written[2] < written[1] && written[1] < written[0], "coding shrinks the run files");
 
-//	memory map input file and sort
+	for( pack = 0; pack < 3; pack++ )
+		free (out[pack]);
 
-//	define pennysort parameters
+	PennyPack = 1;
+	free (order);
+	free (want);
+	free (recs);
+	free (back);
+	free (dst);
+	free (src);
+}
 
-uint PennyRecs = (4096 * 400);	// records to sort to temp files
-uint PennyLine = 100;			// length of input record
-uint PennyKey = 10;				// length of input key
-uint PennyOff = 0;				// key offset in input record
+//	variable records: lines, some empty or without a
+//	key, and records after one, two and four byte
+//	lengths, one longer than a temp file block, sorted
+//	in small chunks on several threads with each
+//	coding.  equal keys, compared zero filled, come out
+//	in chunk order and latest first within a chunk, as
+//	for fixed records, and a last line gets its newline.
+//	fixed chunks need no longer be page multiples.
 
-unsigned long long PennyMerge;	// PennyRecs * PennyLine = file map length
-uint PennyPasses;				// number of intermediate files created
-uint PennySortTime;				// cpu time to run sort
-uint PennyMergeTime;			// cpu time to run merge
+uint *JudyTestOff, *JudyTestLen, *JudyTestRun;
 
-typedef struct {
-	void *buff;		// record pointer in input file map
-	void *next;		// duplicate chain
-} PennySort;
+//	a record's key as the sort sees it, zero filled
 
-void sort (FILE *infile, char *outname)
+void test_varkey (uint idx, uchar *key)
 {
-unsigned long long size, off, offset, part;
-int ifd = fileno (infile);
-char filename[512];
-PennySort *line;
-JudySlot *cell;
-uchar *inbuff;
-void *judy;
-FILE *out;
-#if defined(_WIN32)
-HANDLE hndl, fm;
-DWORD hiword;
-FILETIME dummy[1];
-FILETIME user[1];
-#else
-struct tms buff[1];
-#endif
-time_t start = time(NULL);
+uint data = JudyTestLen[idx] - PennyHead, amt;
+uchar *rec = JudyTestRecs + JudyTestOff[idx] + PennyHead;
 
-  if( PennyOff + PennyKey > PennyLine )
-	fprintf (stderr, "Key Offset + Key Length > Record Length\n"), exit(1);
+	if( !PennyHead && data && rec[data - 1] == '\n' )
+		data--;
 
-  offset = 0;
-  PennyPasses = 0;
+	memset (key, 0, PennyKey);
 
-#if defined(_WIN32)
-  hndl = (HANDLE)_get_osfhandle(ifd);
-  size = GetFileSize (hndl, &hiword);
-  fm = CreateFileMapping(hndl, NULL, PAGE_READONLY, hiword, (DWORD)size, NULL);
-  if( !fm )
-	fprintf (stderr, "CreateFileMapping error %d\n", GetLastError()), exit(1);
-  size |= (unsigned long long)hiword << 32;
-#else
-  size = lseek (ifd, 0L, 2);
-#endif
+	if( data > PennyOff )
+		amt = data - PennyOff < PennyKey ? data - PennyOff : PennyKey, memcpy (key, rec + PennyOff, amt);
+}
 
-  while( offset < size ) {
-#if defined(_WIN32)
-	part = offset + PennyMerge > size ? size - offset : PennyMerge;
-	inbuff = MapViewOfFile( fm, FILE_MAP_READ, offset >> 32, offset, part);
-	if( !inbuff )
-		fprintf (stderr, "MapViewOfFile error %d\n", GetLastError()), exit(1);
-#else
-	inbuff = mmap (NULL, PennyMerge, PROT_READ,  MAP_SHARED, ifd, offset);
+int test_varorder (const void *a, const void *b)
+{
+uint x = *(uint *)a, y = *(uint *)b;
+uchar xkey[64], ykey[64];
+int cmp;
 
-	if( inbuff == MAP_FAILED )
-		fprintf (stderr, "mmap error %d\n", errno), exit(1);
+	test_varkey (x, xkey);
+	test_varkey (y, ykey);
 
-	if( madvise (inbuff, PennyMerge, MADV_WILLNEED | MADV_SEQUENTIAL) < 0 )
-		fprintf (stderr, "madvise error %d\n", errno);
-#endif
-	judy = judy_open (PennyKey, 0);
+	if( (cmp = memcmp (xkey, ykey, PennyKey)) )
+		return cmp;
 
-	off = 0;
+	if( JudyTestRun[x] != JudyTestRun[y] )
+		return JudyTestRun[x] < JudyTestRun[y] ? -1 : 1;
 
-	//	build judy array from mapped input chunk
+	return x < y ? 1 : x > y ? -1 : 0;
+}
 
-	while( offset + off < size && off < PennyMerge ) {
-	  line = judy_data (judy, sizeof(PennySort));
-	  cell = judy_cell (judy, inbuff + off + PennyOff, PennyKey);
-	  line->next = *(void **)cell;
-	  line->buff = inbuff + off;
+//	sort size bytes of variable records in chunks of
+//	chunk bytes, returning the output's bytes and
+//	length, or NULL when it is not the expected one
 
-	  *(PennySort **)cell = line;
-	  off += PennyLine;
+uchar *test_varrun (uchar *data, uint size, uint chunk, uint threads, uint *outlen)
+{
+char filename[64];
+uchar *sorted;
+FILE *in, *out;
+uint idx;
+
+	if( (in = fopen ("judytest.in", "wb")) )
+		fwrite (data, 1, size, in), fclose (in);
+
+	in = fopen ("judytest.in", "rb");
+	out = fopen ("judytest.out", "wb");
+
+	if( !in || !out )
+		return NULL;
+
+	PennyThreads = threads;
+	PennyMerge = chunk;
+	sort (in, "judytest.out");
+	merge (out, "judytest.out");
+	fclose (in);
+
+	for( idx = 0; idx < PennyPasses; idx++ ) {
+		sprintf (filename, "judytest.out.%d", idx);
+		remove (filename);
 	}
 
-	sprintf (filename, "%s.%d", outname, PennyPasses);
-	out = fopen (filename, "wb");
-	setvbuf (out, NULL, _IOFBF, 4096 * 1024);
+	sorted = malloc (*outlen + 1);
 
-#ifndef _WIN32
-	if( madvise (inbuff, PennyMerge, MADV_WILLNEED | MADV_RANDOM) < 0 )
-		fprintf (stderr, "madvise error %d\n", errno);
-#endif
+	if( !(out = fopen ("judytest.out", "rb")) || fread (sorted, 1, *outlen + 1, out) != *outlen )
+		free (sorted), sorted = NULL;
 
-	//	write judy array in sorted order to temporary file
+	if( out )
+		fclose (out);
 
-	cell = judy_strt (judy, NULL, 0);
+	remove ("judytest.in");
+	remove ("judytest.out");
+	return sorted;
+}
 
-	if( cell ) do {
-		line = *(PennySort **)cell;
-		do fwrite (line->buff, PennyLine, 1, out);
-		while( line = line->next );
-	} while( cell = judy_nxt (judy) );
+//	check the sorts of the records in data on one and
+//	four threads with each coding
 
-#if defined(_WIN32)
-	UnmapViewOfFile (inbuff);
-#else
-	munmap (inbuff, PennyMerge);
-#endif
-	judy_close (judy);
-	offset += off;
-	fflush (out);
-	fclose (out);
-	PennyPasses++;
-  }
-  fprintf (stderr, "End Sort %d secs", time(NULL) - start);
-#if defined(_WIN32)
-  CloseHandle (fm);
-  GetProcessTimes (GetCurrentProcess(), dummy, dummy, dummy, user);
-  PennySortTime = *(unsigned long long*)user / 10000000;
+uint test_varsort (uchar *data, uint size, uint chunk)
+{
+uint idx, cnt, len, start, pack, threads, outlen, bad = 0;
+uchar *want, *out;
+uint *order;
+
+	JudyTestRecs = data;
+
+	//	the records, and the chunks a sort thread
+	//	claims: as many whole records as fit
+
+	for( cnt = start = idx = 0; idx < size; idx += len, cnt++ ) {
+		len = penny_reclen (data + idx, data + size);
+		JudyTestOff[cnt] = idx;
+		JudyTestLen[cnt] = len;
+
+		if( idx + len > start + chunk )
+			start = idx;
+
+		JudyTestRun[cnt] = start;
+	}
+
+	order = malloc (cnt * sizeof(uint));
+	want = malloc (size + 1);
+
+	for( idx = 0; idx < cnt; idx++ )
+		order[idx] = idx;
+
+	qsort (order, cnt, sizeof(uint), test_varorder);
+
+	for( outlen = idx = 0; idx < cnt; idx++ ) {
+		memcpy (want + outlen, data + JudyTestOff[order[idx]], JudyTestLen[order[idx]]);
+		outlen += JudyTestLen[order[idx]];
+
+		if( !PennyHead && want[outlen - 1] != '\n' )
+			want[outlen++] = '\n';
+	}
+
+	for( pack = 0; pack < 3; pack++ )
+	  for( threads = 1; threads <= 4; threads += 3 ) {
+		PennyPack = pack;
+		out = test_varrun (data, size, chunk, threads, &outlen);
+#ifdef JUDYMERGE
+		bad += !out;
 #else
-  times (buff);
-  PennySortTime = buff->tms_utime/100;
+		bad += !out || memcmp (out, want, outlen);
 #endif
-  fprintf (stderr, " Cpu %d\n", PennySortTime);
+		free (out);
+	  }
+
+	PennyPack = 1;
+	free (order);
+	free (want);
+	return bad;
 }
 
-int merge (FILE *out, char *outname)
+void test_pennyvar (void)
 {
-time_t start = time(NULL);
-char filename[512];
-JudySlot *cell;
-uint nxt, idx;
-uchar **line;
-uint *next;
-void *judy;
-FILE **in;
+uint idx, pos, len, size, head, cnt;
+judyvalue seed = 53;
+uchar *data;
 
-	next = calloc (PennyPasses + 1, sizeof(uint));
-	line = calloc (PennyPasses, sizeof(void *));
-	in = calloc (PennyPasses, sizeof(void *));
+	data = malloc (600000);
+	JudyTestOff = malloc (20000 * sizeof(uint));
+	JudyTestLen = malloc (20000 * sizeof(uint));
+	JudyTestRun = malloc (20000 * sizeof(uint));
 
-	judy = judy_open (PennyKey, 0);
+	//	lines of up to 60 bytes with keys of up to 6
+	//	bytes at offset 2, many of them equal or cut
+	//	short, in chunks of 1000 bytes
 
-	// initialize merge with one record from each temp file
+	PennyVar = 1, PennyHead = 0, PennyLine = 0, PennyKey = 6, PennyOff = 2;
 
-	for( idx = 0; idx < PennyPasses; idx++ ) {
-		sprintf (filename, "%s.%d", outname, idx);
-		in[idx] = fopen (filename, "rb");
-		line[idx] = malloc (PennyLine);
-		setvbuf (in[idx], NULL, _IOFBF, 4096 * 1024);
-		fread (line[idx], PennyLine, 1, in[idx]);
-		cell = judy_cell (judy, line[idx] + PennyOff, PennyKey);
-		next[idx + 1] = *(uint *)cell;
-		*cell = idx + 1;	
+	for( size = idx = 0; idx < 8000; idx++ ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		len = (seed >> 33) % 61 + (idx == 7999);
+
+		for( pos = 0; pos < len; pos++ )
+			data[size++] = 'a' + (seed >> (pos % 24 + 8)) % (pos < 5 ? 2 : 26);
+
+		data[size++] = '\n';
 	}
 
-	//	output records, replacing smallest each time
+	judy_expect (!test_varsort (data, size, 1000), "lines sorted");
+	judy_expect (!test_varsort (data, size - 1, 1000), "lines ending without a newline sorted");
+	judy_expect (!test_varsort ((uchar *)"\n", 1, 1000), "one empty line sorted");
 
-	while( cell = judy_strt (judy, NULL, 0) ) {
-		nxt = *(uint *)cell;
-		judy_del (judy); 
+	//	records after lengths of 1, 2 and 4 bytes, the
+	//	last with a record longer than a temp file block
 
-		// process duplicates
+	PennyKey = 10, PennyOff = 3;
 
-		while( idx = nxt ) {
-			nxt = next[idx--];
-			fwrite (line[idx], PennyLine, 1, out);
+	for( head = 1; head <= 4; head <<= 1 ) {
+		PennyHead = head;
 
-			if( fread (line[idx], PennyLine, 1, in[idx]) ) {
-				cell = judy_cell (judy, line[idx] + PennyOff, PennyKey);
-				next[idx + 1] = *(uint *)cell;
-				*cell = idx + 1;	
-			} else
-				next[idx + 1] = 0;
+		for( size = cnt = 0; cnt < 2000; cnt++ ) {
+			seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+			len = head == 4 && cnt == 1000 ? 70000 : (seed >> 33) % (head > 1 ? 300 : 200);
+
+			for( pos = 0; pos < head; pos++ )
+				data[size++] = (uchar)(len >> pos * 8);
+
+			for( pos = 0; pos < len; pos++ )
+				data[size++] = 'a' + (seed >> (pos % 24 + 8)) % (pos < 8 ? 2 : 26);
 		}
-	}
 
-	for( idx = 0; idx < PennyPasses; idx++ ) {
-		fclose (in[idx]);
-		free (line[idx]);
+		judy_expect (!test_varsort (data, size, head == 4 ? 100000 : 4000), "length prefixed records sorted");
 	}
 
-	free (line);
-	free (next);
-	free (in);
+	PennyVar = 0, PennyHead = 0;
+	free (JudyTestRun);
+	free (JudyTestLen);
+	free (JudyTestOff);
+	free (data);
+}
 
-	fprintf (stderr, "End Merge %d secs", time(NULL) - start);
-#ifdef _WIN32
-	{
-	FILETIME dummy[1];
-	FILETIME user[1];
-		GetProcessTimes (GetCurrentProcess(), dummy, dummy, dummy, user);
-		PennyMergeTime = *(unsigned long long*)user / 10000000;
+//	fixed records in chunks of a size that is not a
+//	multiple of the page
+
+void test_pennyodd (void)
+{
+uchar *recs, *want, *out;
+judyvalue seed = 59;
+uint idx, *order;
+
+	PennyLine = 100, PennyKey = 5, PennyOff = 9, PennyRecs = 1001;
+	JudyTestRecs = recs = malloc (7777 * 100);
+	want = malloc (7777 * 100);
+	order = malloc (7777 * sizeof(uint));
+
+	for( idx = 0; idx < 7777 * 100; idx++ ) {
+		seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+		recs[idx] = 'a' + (seed >> 33) % (idx % 100 < 12 ? 3 : 26);
 	}
+
+	for( idx = 0; idx < 7777; idx++ )
+		order[idx] = idx;
+
+	qsort (order, 7777, sizeof(uint), test_runorder);
+
+	for( idx = 0; idx < 7777; idx++ )
+		memcpy (want + idx * 100, recs + order[idx] * 100, 100);
+
+	out = test_pennyrun (recs, 7777, 3);
+#ifdef JUDYMERGE
+	judy_expect (out != NULL, "fixed records in chunks off the page size");
 #else
-	{
-	struct tms buff[1];
-		times (buff);
-		PennyMergeTime = buff->tms_utime/100;
-	}
+	judy_expect (out && !memcmp (out, want, 7777 * 100), "fixed records in chunks off the page size");
 #endif
-	fprintf (stderr, " Cpu %d\n", PennyMergeTime - PennySortTime);
-	judy_close (judy);
-	fflush (out);
-	fclose (out);
-	return 0;
+	free (out);
+	free (order);
+	free (want);
+	free (recs);
 }
 
+void judy_tests (void)
+{
+	test_search ();
+	test_batch ();
+	test_concurrent ();
+	test_pool ();
+	test_parallel ();
+	test_sorted ();
+	test_image ();
+	test_scan ();
+	test_stats ();
+	test_compact ();
+	test_segments ();
+	test_lines ();
+	test_integers ();
+	test_bitmap ();
+	test_sparse ();
+	test_spans ();
+	test_binary ();
+	test_rank ();
+	test_zerotail ();
+	test_delrange ();
+	test_delconcurrent ();
+	test_walclean ();
+	test_wal ();
+	test_pennysort ();
+	test_losertree ();
+	test_pennyio ();
+	test_pennypack ();
+	test_pennyvar ();
+	test_pennyodd ();
+
+	if( JudyFails )
+		fprintf (stderr, "%d checks failed\n", JudyFails), exit(1);
+
+	fprintf (stderr, "all checks passed\n");
+}
+#endif
+
 //	compilation:
 //	cc -O3 judy64j.c
 
@@ -1864,6 +10361,12 @@ time_t start[1], stop[1];
 	if( !out )
 		fprintf (stderr, "unable to open output file\n");
 
+	if( argc > 8 )
+		PennyPack = atoi(argv[8]);
+
+	if( argc > 7 )
+		PennyThreads = atoi(argv[7]);
+
 	if( argc > 6 )
 		PennyRecs = atoi(argv[6]);
 
@@ -1873,8 +10376,34 @@ time_t start[1], stop[1];
 	if( argc > 4 )
 		PennyLine = atoi(argv[4]);
 
-	PennyMerge = (unsigned long long)PennyLine * PennyRecs;
+	//	a record length of 0 sorts lines, and of -1, -2
+	//	or -4 records after a little endian length of
+	//	that many bytes, in chunks of argv[6] bytes
+
+	if( (int)PennyLine <= 0 ) {
+		PennyHead = -(int)PennyLine;
+		PennyVar = 1;
+		PennyLine = 0;
 
+		if( PennyHead == 3 || PennyHead > 4 )
+			fprintf (stderr, "record length must be 0, -1, -2 or -4 for variable records\n"), exit(1);
+
+		PennyMerge = argc > 6 ? PennyRecs : 100ULL * PennyRecs;
+	} else
+		PennyMerge = (unsigned long long)PennyLine * PennyRecs;
+
+#ifdef SEARCHBENCH
+	search_bench ();
+	return 0;
+#endif
+#ifdef LINEBENCH
+	line_bench ();
+	return 0;
+#endif
+#ifdef JUDYTEST
+	judy_tests ();
+	return 0;
+#endif
 	if( argc > 3 ) {
 		PennyKey = atoi(argv[3]);
 		sort (in, argv[2]);